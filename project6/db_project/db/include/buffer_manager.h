@@ -5,29 +5,101 @@
 
 #include "disk_space_manager/file.h"
 
+// page replacement policies
+const int kReplaceLRU = 0;
+const int kReplaceLRUK = 1;  // LRU-2, scan resistant
+const int kReplace2Q = 2;    // simplified 2Q, scan resistant
+// second chance, hits only set a reference bit of the frame without latch
+// of the partition
+const int kReplaceClock = 3;
+const int kNumReplacementPolicies = 4;
+
+// pages backing page data of the buffer pool
+const int kArenaPages = 0;
+const int kArenaTransparentHugePages = 1;  // advised, may be split by kernel
+const int kArenaHugePages = 2;             // reserved (MAP_HUGETLB)
+
+// get the page linked next to the page in a chain of pages (0 at the end)
+typedef pagenum_t (*buffer_next_page_t)(const page_t *page);
+
 // initialize buffer manager
+// page data of kPageSize pages is kept in one arena on huge pages (if the
+// system has them), apart from metadata of the frames
+// frames are split into partitions by page (up to 64, each having 64 frames
+// at least), see buffer_num_partitions. frames of a partition are replaced
+// by the policy set by buffer_set_replacement_policy
 // return 0 on success
 int init_buffer_manager(int num_buf);
 
+// Choose page replacement policy (kReplace*, only affects buffer pools
+// initialized afterwards, kReplaceLRU by default)
+// return 0 on success
+int buffer_set_replacement_policy(int policy);
+
+// Run num_cleaners page cleaner threads (only affects buffer pools
+// initialized afterwards, none by default). cleaners write dirty frames
+// among the clean_target frames to be evicted next in each partition (after
+// flushing their logs), so misses rarely have to write a dirty victim
+// return 0 on success
+int buffer_set_page_cleaners(int num_cleaners, int clean_target);
+
+// Read pages ahead along chains (up to max_window pages, only affects buffer
+// pools initialized afterwards, 0 to disable by default)
+// return 0 on success
+int buffer_set_read_ahead(int max_window);
+
+// Keep pointers from frames to frames of their children read through
+// buffer_read_child_optimistic (only affects buffer pools initialized
+// afterwards, off by default)
+// return 0 on success
+int buffer_set_pointer_swizzling(int enabled);
+
+// Let buffer pools initialized afterwards grow up to max_num_buf frames by
+// buffer_resize (0 by default, they only shrink and grow back then)
+// frames and address space of page data are reserved up to it
+// return 0 on success
+int buffer_set_max_frames(int max_num_buf);
+
+// Resize the buffer pool to num_buf frames while it is in use
+// partitions are kept, so each of them keeps 16 frames at least. new frames
+// are added one at a time, removed ones are evicted one at a time (written
+// back if dirty, after pins on them are released) and their page data is
+// given back. a frame pinned for about a second stops the shrink, the pool
+// is left at the size reached then (see buffer_pool_size)
+// return 0 on success
+int buffer_resize(int num_buf);
+
 // free buffer manager
 int free_buffer_manager();
 
-// allocate new page
+// allocate new page from the space maps
+// page is placed near the hint (0 for no hint), see space_map_alloc
 // return allocated page number (0 on failed)
-pagenum_t buffer_alloc_page(int64_t table_id);
+pagenum_t buffer_alloc_page(int64_t table_id, pagenum_t hint = 0);
 
-// free page
+// free page (clear its bit in the space map)
 void buffer_free_page(int64_t table_id, pagenum_t pagenum);
 
+// drop frames of pages from first_pagenum without writing them back
+// (pages cut off by file_truncate)
+// return 0 on success (nonzero if one of them is pinned)
+int buffer_discard_pages(int64_t table_id, pagenum_t first_pagenum);
+
 // get frame ptr (if there is no corresponding frame in buffer then load it
+// pages of read-only tables are returned from their mapping without pinning
+// frame holds file_page_size(table_id) bytes
+// frame is pinned exclusively, or shared with other readers if shared is
+// set (the page should not be modified then), unpin releases both
 // return NULL on failed
-page_t *buffer_get_page_ptr(int64_t table_id, pagenum_t pagenum);
+page_t *buffer_get_page_ptr(int64_t table_id, pagenum_t pagenum,
+                            int shared = false);
 
 // get frame ptr (if there is no corresponding frame in buffer then load it
 // return NULL on failed
 template <typename T>
-T *buffer_get_page_ptr(int64_t table_id, pagenum_t pagenum) {
-  return (T *)(buffer_get_page_ptr(table_id, pagenum));
+T *buffer_get_page_ptr(int64_t table_id, pagenum_t pagenum,
+                       int shared = false) {
+  return (T *)(buffer_get_page_ptr(table_id, pagenum, shared));
 }
 
 // set dirty flag on the frame ptr (gotten by buffer_get_page_ptr)
@@ -43,6 +115,7 @@ void set_dirty(T *page) {
 
 // read specific page from the buffer and copy it to dest
 // just a wrapper of the buffer_get_page_ptr
+// file_page_size(table_id) bytes are copied (same for buffer_write_page)
 // return 0 on success
 void buffer_read_page(int64_t table_id, pagenum_t pagenum, page_t *dest);
 
@@ -59,6 +132,19 @@ void buffer_write_page(int64_t table_id, pagenum_t pagenum, const page_t *src);
 // just a wrapper of the buffer_write_page
 void buffer_write_header_page(int64_t table_id, const header_page_t *src);
 
+// hint that the page (pinned by the caller) is reached by a walk along the
+// chain linked by next (e.g. leaf siblings). once the walk of the thread
+// looks sequential, pages ahead are loaded into clean frames by the
+// read-ahead thread, the window grows while they are hit and shrinks while
+// they are not
+void buffer_read_ahead(page_t *page, buffer_next_page_t next);
+
+// hint that the page is reached by a walk along the chain
+template <typename T>
+void buffer_read_ahead(T *page, buffer_next_page_t next) {
+  buffer_read_ahead((page_t *)page, next);
+}
+
 // unpin(decrease pin count) specific page in the buffer
 // if buffer does not have that page, failed
 void unpin(int64_t table_id, pagenum_t pagenum);
@@ -67,6 +153,31 @@ void unpin(int64_t table_id, pagenum_t pagenum);
 // if someone putting an invalid ptr, then segfault will occur
 void unpin(page_t *page);
 
+// get cached page to read it optimistically (without pinning)
+// page may be changed or replaced while it is read, so what is read is only
+// valid if buffer_validate_page passes afterwards, and should be checked
+// before it is used to index the page
+// return NULL if it cannot be read so (not cached, latched exclusively,
+// larger than kPageSize or read-only table), pin it instead
+const page_t *buffer_read_optimistic(int64_t table_id, pagenum_t pagenum,
+                                     uint64_t *version);
+
+// get child page linked by the parent page (gotten by buffer_read_optimistic)
+// to read it optimistically, link is the index of the child in the parent
+// with swizzling, the frame of the parent keeps a pointer to the frame of
+// the child per link, so a cached child is reached without the page table.
+// pointers are kept beside the page (never in it), and one is only followed
+// while the frame it points to holds the page
+// return NULL if it cannot be read so, see buffer_read_optimistic
+const page_t *buffer_read_child_optimistic(const page_t *parent, int link,
+                                           int64_t table_id,
+                                           pagenum_t pagenum,
+                                           uint64_t *version);
+
+// check if the page (gotten by buffer_read_optimistic) is not changed since
+// version is taken
+bool buffer_validate_page(const page_t *page, uint64_t version);
+
 // unpin with frame ptr (gotten by buffer_get_page_ptr)
 // if someone putting an invalid ptr, then segfault will occur
 template <typename T>
@@ -82,6 +193,28 @@ void unpin_header(int64_t table_id);
 // count not pinned frames
 int count_free_frames();
 
+// for debug purpose
+// get number of partitions of the buffer pool
+int buffer_num_partitions();
+
+// get number of frames in use (see buffer_resize)
+int buffer_pool_size();
+
+// for debug purpose
+// get kind of pages backing page data of the buffer pool (kArena*)
+int buffer_page_arena_kind();
+
+// Get number of buffer_get_page_ptr calls which found the page in the pool
+// (hits) and which loaded it (misses) since init or the last reset
+void buffer_get_hit_stats(uint64_t *hits, uint64_t *misses);
+
+// Get number of children reached through swizzled pointers (hits) and
+// through the page table (misses) since init or the last reset
+void buffer_get_swizzle_stats(uint64_t *hits, uint64_t *misses);
+
+// Clear hit stats (and swizzle stats)
+void buffer_reset_hit_stats();
+
 // flush all free frames
 // this function ignores all page lockings
 // this function is to flush updated data (after insertion) outside of the trx
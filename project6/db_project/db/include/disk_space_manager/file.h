@@ -4,14 +4,40 @@
 #include <stdint.h>
 
 #include <climits>
+#include <cstddef>
 
 typedef uint64_t pagenum_t;
 typedef char byte;
 
-const uint64_t kPageSize = 4 * 1024;
+const uint64_t kPageSize = 4 * 1024;  // default (and minimum) page size
+// slot offsets in leaves and page patch logs are 16 bits
+const uint64_t kMaxPageSize = 32 * 1024;
 const uint64_t kDefaultFileSize = 10 * 1024 * 1024;
 const pagenum_t kHeaderPagenum = 0;
 const pagenum_t kNullPagenum = ULONG_MAX;
+const int64_t kMaxNumTables = 1024;  // table ids are in [0, kMaxNumTables)
+const uint64_t kHeaderMagic = 0x50414d4543415053;  // "SPACEMAP"
+const uint64_t kHeaderFlagCompressed = 1;  // pages are stored compressed
+const uint64_t kHeaderFlagStriped = 2;     // pages are spread over stripes
+const int kMaxStripes = 8;
+const int kMaxStripePathLen = 256;
+// unsynced page writes of a table which trigger a sync in deferred mode
+const uint64_t kDeferredSyncPages = 1024;
+// checksum of tree pages is at this offset (header and space map pages have
+// their own field, see page_checksum_offset)
+const uint64_t kPageChecksumOffset = 32;
+// page_lsn of every page is at this offset (header, space map and tree
+// pages), so the buffer checks it against flushed logs before writing
+const uint64_t kPageLsnOffset = 24;
+
+// space map
+// pages are grouped by kPagesPerSpaceMap, each group has a space map page
+// whose bitmap tracks pages in use (header and space map pages included)
+const uint64_t kSpaceMapHeaderSize = 64;
+const uint64_t kSpaceMapBitmapWords = (kPageSize - kSpaceMapHeaderSize) / 8;
+const uint64_t kPagesPerSpaceMap = kSpaceMapBitmapWords * 64;
+const uint64_t kMaxNumSpaceMaps = 4096;  // about 500GB per table
+const uint64_t kPagesPerExtent = 64;      // a word of the bitmap
 
 struct page_t {
   byte data[kPageSize];
@@ -20,36 +46,257 @@ struct page_t {
 union header_page_t {
   page_t page;
   struct {
-    pagenum_t first_free_page;
+    uint64_t magic;  // kHeaderMagic
     uint64_t num_of_pages;
     pagenum_t root_page_number;
+    uint64_t page_lsn;  // page patch logs (compaction) change the header
+    uint64_t flags;     // kHeaderFlag*, set on creation
+    // striped table, runs of stripe_pages pages go round-robin over stripe
+    // files. stripe 0 is the table file, paths of the others are kept here
+    uint32_t num_stripes;
+    uint32_t stripe_pages;
+    char stripe_paths[kMaxStripes - 1][kMaxStripePathLen];
+    uint64_t page_size;  // set on creation, 0 for kPageSize
+    uint32_t checksum;   // of the first kPageSize bytes
   } header;
 };
 
-union page_node_t {
+union space_map_page_t {
   page_t page;
-  pagenum_t next_free_page;
+  struct {
+    uint64_t num_pages;  // number of pages in the group (in the file)
+    uint64_t num_free_pages;
+    uint32_t checksum;  // of the first kPageSize bytes
+    uint32_t __reserved;
+    uint64_t page_lsn;
+    byte padding[kSpaceMapHeaderSize - 32];
+    uint64_t bitmap[kSpaceMapBitmapWords];  // bit is set if page is in use
+  } space_map;
+};
+static_assert(offsetof(header_page_t, header.page_lsn) == kPageLsnOffset &&
+                  offsetof(space_map_page_t, space_map.page_lsn) ==
+                      kPageLsnOffset,
+              "page_lsn should be at kPageLsnOffset");
+
+// group of the page
+inline uint64_t space_map_group(pagenum_t pagenum) {
+  return pagenum / kPagesPerSpaceMap;
+}
+
+// space map page of the group
+// first page of the group (second one for the first group, after header)
+inline pagenum_t space_map_pagenum(uint64_t group) {
+  return group == 0 ? 1 : group * kPagesPerSpaceMap;
+}
+
+// offset of the checksum field of the page
+// checksum (CRC32C) is set on write and checked on read, 0 means the page
+// has none (never written, or written before checksums)
+inline uint64_t page_checksum_offset(pagenum_t pagenum) {
+  if (pagenum == kHeaderPagenum)
+    return offsetof(header_page_t, header.checksum);
+  if (pagenum == space_map_pagenum(space_map_group(pagenum)))
+    return offsetof(space_map_page_t, space_map.checksum);
+  return kPageChecksumOffset;
+}
+
+// asynchronous page I/O request
+// page should be alive until the request is done
+struct file_io_request_t {
+  int64_t table_id;
+  pagenum_t pagenum;
+  page_t *page;  // destination on read, source on write
+  int is_write;
+  void (*callback)(file_io_request_t *req);  // called on completion (nullable)
+  void *arg;                                 // for callback
+
+  // set on completion
+  int done;
+  int result;  // 0 on success, negative errno on failed
+
+  uint64_t io_start;  // set on submission to time it (io_stats)
 };
 
 // Open existing database file or create one if not existed.
+// pathname should be DATA<table id>
+// return table id (negative on failed)
 int64_t file_open_table_file(const char *pathname);
 
 // Open existing database file if it is not loaded.
 int64_t file_open_table_file(int64_t table_id);
 
-// Expand file twice and create new free pages
-// for page allocation in buffer layer
+// Open existing database file read-only and map it into memory
+// pages of the table are served from the mapping (file_mapped_page), so
+// the table cannot be modified. pathname should be DATA<table id>
+// return table id (negative on failed)
+int64_t file_open_mapped_table_file(const char *pathname);
+
+// Get the mapped page of the read-only table
+// return NULL if the table is not mapped or the page is out of it
+const page_t *file_mapped_page(int64_t table_id, pagenum_t pagenum);
+
+// Hint that mapped pages [pagenum, pagenum + n) will be accessed soon
+// the table is mapped for random access, so scans call this to read ahead
+// do nothing if the table is not mapped
+void file_prefetch_pages(int64_t table_id, pagenum_t pagenum, uint64_t n);
+
+// Check if the table is opened read-only (memory-mapped)
+int file_is_read_only(int64_t table_id);
+
+// Expand file twice for page allocation in buffer layer
+// new pages [start, end] are only reserved (not written). caller should add
+// them into num_of_pages of the header and space maps (space_map_extend)
 // return 0 on success
 int file_expand_twice(int64_t table_id, pagenum_t *start, pagenum_t *end,
                       uint64_t *num_new_pages);
 
-// Allocate an on-disk page from the free page list
-pagenum_t file_alloc_page(int64_t table_id);
+// Shrink file to num_pages pages
+// pages beyond num_pages should be free and out of the header and space maps
+// return 0 on success
+int file_truncate(int64_t table_id, uint64_t num_pages);
+
+// Allocate an on-disk page
+// page is placed near the hint (0 for no hint), see space_map_alloc
+// file is expanded if there is no free page
+pagenum_t file_alloc_page(int64_t table_id, pagenum_t hint = 0);
 
-// Free an on-disk page to the free page list
+// Free an on-disk page (clear its bit in the space map)
 void file_free_page(int64_t table_id, pagenum_t pagenum);
 
+// Initialize space map page of the group (with no page)
+void space_map_init(space_map_page_t *map, uint64_t group);
+
+// Extend pages covered by the space map up to num_pages
+// return number of added free pages
+uint64_t space_map_extend(space_map_page_t *map, uint64_t num_pages);
+
+// Mark a free page in use, the page is placed near start index
+// the extent of start is tried first (pages after start are preferred), then
+// an extent having room for pages allocated near it later, then any extent
+// (start 0 means no hint, the first free page is taken)
+// return index of the page in the group (negative if there is no free page)
+int64_t space_map_alloc(space_map_page_t *map, uint64_t start);
+
+// Mark a page free
+// return true on success (false if it is not in use)
+bool space_map_free(space_map_page_t *map, uint64_t idx);
+
+// Find the last page in use except header and space map pages
+// return index of the page in the group (negative if there is no such page)
+int64_t space_map_last_used(const space_map_page_t *map, uint64_t group);
+
+// Find a space map having free pages in the in-memory summary
+// search starts from the hint group (wraps around)
+// return group (negative if there is no free page in the table)
+int64_t file_find_free_space_map(int64_t table_id, uint64_t hint_group);
+
+// get space map page of the group to extend it, is_new if the group is added
+// (the page is initialized then), and put it back (see file_grow_space_maps)
+typedef space_map_page_t *(*space_map_get_t)(int64_t table_id,
+                                             uint64_t group, bool is_new);
+typedef void (*space_map_put_t)(int64_t table_id, uint64_t group,
+                                space_map_page_t *map);
+
+// Expand file twice and extend space maps of the table having num_of_pages
+// pages to the new pages, space map pages are gotten and put back by the
+// callbacks (from disk or the buffer). header page is left to the caller
+// return number of pages of the table after it (0 on failed)
+uint64_t file_grow_space_maps(int64_t table_id, uint64_t num_of_pages,
+                              space_map_get_t get, space_map_put_t put);
+
+// Take a free page of the group from its space map page (held by the caller)
+// and count it in the summary, the page is placed near the hint if it is in
+// the group (see space_map_alloc)
+// return page number (0 if there is no free page in the group)
+pagenum_t file_take_free_page(int64_t table_id, space_map_page_t *map,
+                              uint64_t group, pagenum_t hint);
+
+// Give the page back to its space map page (held by the caller) and count it
+// in the summary
+// return true on success (false if it is not in use)
+bool file_give_back_page(int64_t table_id, space_map_page_t *map,
+                         pagenum_t pagenum);
+
+// Add delta to the number of free pages of the group in the summary
+// callers hold the space map page (latch) while changing it, groups are
+// added in order
+void file_update_space_summary(int64_t table_id, uint64_t group,
+                               int64_t delta);
+
+// Drop groups from num_groups in the summary (after the file is shrunk)
+void file_truncate_space_summary(int64_t table_id, uint64_t num_groups);
+
+// Open tables with O_DIRECT to bypass the kernel page cache
+// (only affects tables opened afterwards, disabled by default)
+// pages aligned to kPageSize are transferred directly, others are bounced
+void file_set_direct_io(int enable);
+
+// Check if the table is opened with O_DIRECT
+int file_is_direct_io(int64_t table_id);
+
+// Defer durability of data page writes (disabled by default)
+// writes of data pages are not synced one by one (sync argument is ignored
+// for them). a table is synced once kDeferredSyncPages pages are written and
+// on file_sync_all (after each flush batch of the buffer), pages written in
+// between are recoverable from the log. header and space map pages are
+// synced as asked. if the double-write area is open, data pages are staged
+// in memory until then and written through the area as a batch (so a crash
+// never leaves them torn in place), otherwise they are written in place and
+// only their writeback is started
+void file_set_deferred_sync(int enable);
+
+// Create tables with compressed page format (only affects tables created
+// afterwards, disabled by default). pages are compressed on write and packed
+// into 1K/2K slots (4K if they do not compress), the file only grows with
+// written pages. the header page is stored as is, file_size is the size of
+// the table in pages (up to about 4GB). compressed tables use buffered I/O
+void file_set_compression(int enable);
+
+// Create tables with pages of page_size bytes (only affects tables created
+// afterwards, kPageSize by default). page_size is a power of two in
+// [kPageSize, kMaxPageSize]. larger pages make trees shallower and scans
+// read more per I/O, header and space map pages only use their first
+// kPageSize bytes. compressed tables always have kPageSize pages
+// return 0 on success
+int file_set_page_size(uint64_t page_size);
+
+// Get page size of the table (kPageSize if it is not opened)
+uint64_t file_page_size(int64_t table_id);
+
+// Check if pages of the table are stored compressed
+int file_is_compressed(int64_t table_id);
+
+// Create tables striped over num_stripes files (only affects tables created
+// afterwards, 1 disables it as by default). runs of stripe_pages pages are
+// placed round-robin, stripe 0 is DATA<id> itself and stripe i is
+// DATA<id>.<i> in dirs[i - 1] (next to DATA<id> if dirs is NULL), so stripes
+// can sit on different devices. compressed tables are not striped
+// return 0 on success
+int file_set_striping(int num_stripes, uint64_t stripe_pages,
+                      const char *const *dirs = NULL);
+
+// Get number of stripe files of the table (1 if it is not striped)
+int file_num_stripes(int64_t table_id);
+
+// Write batched page writes (file_io_submit) and staged data pages of
+// deferred mode (file_set_deferred_sync) through the double-write area
+// at path (NULL disables it as by default). pages of a batch are written
+// and synced in the area first, then in place and synced again, so a page
+// torn by a crash in the middle is still whole in the area. pages left in
+// the area are checked on open, torn pages (bad checksum) of existing tables
+// are restored from it
+// return 0 on success
+int file_open_double_write(const char *path);
+
+// Stop double write and remove the area (tables should be synced)
+void file_close_double_write();
+
 // Read an on-disk page into the in-memory page structure(dest)
+// pages are transferred with file_page_size bytes, so dest (and src of
+// writes and I/O requests) should be that large
+// checksum of the page is verified, a mismatch is fatal (failed result of
+// I/O requests)
+// page I/O uses pread/pwrite, so it is safe to call concurrently
 void file_read_page(int64_t table_id, pagenum_t pagenum, page_t *dest);
 
 // Write an in-memory page(src) to the on-disk page
@@ -63,10 +310,34 @@ void file_read_header_page(int64_t table_id, header_page_t *dest);
 void file_write_header_page(int64_t table_id, const header_page_t *src,
                             int sync = true);
 
+// Submit batch of page reads/writes
+// checksums are set in pages of writes (in copies of them if double write is
+// on, then writes are done before return)
+// requests are served by io_uring of calling thread if it is available,
+// otherwise they are served synchronously before return
+// completions are delivered by file_io_reap/file_io_wait of the same thread
+// return 0 on success
+int file_io_submit(file_io_request_t *reqs, int n);
+
+// Deliver completed requests of calling thread (call their callbacks)
+// if wait is set, block until at least one request is completed
+// return number of delivered requests (negative on failed)
+int file_io_reap(int wait);
+
+// Wait until all given requests are completed
+// return 0 if all of them are succeeded
+int file_io_wait(file_io_request_t *reqs, int n);
+
+// Check if the calling thread can use asynchronous I/O (io_uring)
+int file_io_is_async();
+
+// Enable or disable io_uring (synchronous I/O is used when disabled)
+void file_io_set_async(int enable);
+
 // Calculate file size (byte)
 uint64_t file_size(int64_t table_id);
 
-// sync file descriptor
+// Sync tables written since their last sync (fdatasync)
 void file_sync_all();
 
 // Stop referencing the database file
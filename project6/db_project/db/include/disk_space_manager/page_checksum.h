@@ -0,0 +1,20 @@
+#ifndef DB_PAGE_CHECKSUM_H_
+#define DB_PAGE_CHECKSUM_H_
+
+#include <stdint.h>
+
+#include "disk_space_manager/file.h"
+
+// CRC32C (Castagnoli) of pages
+// computed by the crc32 instruction of SSE4.2 (x86-64) or ARMv8 if the cpu
+// has it, by a lookup table otherwise
+
+// Continue CRC32C of data from crc (0 to start)
+uint32_t crc32c(uint32_t crc, const byte *data, uint64_t size);
+
+// Compute checksum of the page of size bytes
+// 4 bytes of the checksum field at offset are taken as zero, and 0 is never
+// returned (stored checksum 0 means the page has none)
+uint32_t page_checksum(const byte *page, uint64_t size, uint64_t offset);
+
+#endif
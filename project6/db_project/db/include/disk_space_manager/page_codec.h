@@ -0,0 +1,25 @@
+#ifndef DB_PAGE_CODEC_H_
+#define DB_PAGE_CODEC_H_
+
+#include <stdint.h>
+
+#include "disk_space_manager/file.h"
+
+// byte-oriented LZ77 codec for pages (LZ4-like block format)
+// a block is a series of sequences: token (literal length << 4 | match
+// length - 4), extended literal length, literals, 2-byte offset, extended
+// match length. the last sequence has literals only.
+// it favors speed over ratio, runs of zero (free space of pages) and repeated
+// values are what it is for
+
+// Compress src into dst
+// return compressed size (0 if it does not fit in dst_capacity)
+uint32_t page_compress(const byte *src, uint32_t src_size, byte *dst,
+                       uint32_t dst_capacity);
+
+// Decompress src into dst
+// return decompressed size (negative if src is malformed or dst is small)
+int64_t page_decompress(const byte *src, uint32_t src_size, byte *dst,
+                        uint32_t dst_capacity);
+
+#endif
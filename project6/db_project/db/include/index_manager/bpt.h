@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <cstddef>
+
 #include "buffer_manager.h"
 
 // constants
@@ -12,13 +14,23 @@ constexpr uint64_t kBptPageHeaderSize = 128;
 // type definitions
 typedef int64_t bpt_key_t;
 
+// called on each record of the scan, return nonzero to stop the scan
+typedef int (*bpt_scan_callback_t)(bpt_key_t key, const byte *value,
+                                   uint16_t size, void *arg);
+
 struct bpt_header_t {  // used in lock manager
   pagenum_t parent_page;
   uint32_t is_leaf;
   uint32_t num_of_keys;
-  uint64_t __reserved;
+  uint64_t page_size;  // of the table, 0 for kPageSize (older files)
   uint64_t page_lsn;
+  uint32_t checksum;  // set by the file layer (kPageChecksumOffset)
+  uint32_t __reserved;
 };
+static_assert(offsetof(bpt_header_t, checksum) == kPageChecksumOffset,
+              "checksum of tree pages should be at kPageChecksumOffset");
+static_assert(offsetof(bpt_header_t, page_lsn) == kPageLsnOffset,
+              "page_lsn of tree pages should be at kPageLsnOffset");
 
 union bpt_page_t {
   page_t page;
@@ -26,6 +38,7 @@ union bpt_page_t {
 };
 
 struct lock_t;
+struct page_patch_t;
 
 // find record
 // if trx_id is less than 1, then do nothing with trx
@@ -33,6 +46,12 @@ struct lock_t;
 bool bpt_find(int64_t table_id, pagenum_t root, bpt_key_t key, uint16_t *size,
               byte *value, int trx_id, lock_t *lock = NULL);
 
+// scan records whose keys are in [begin, end] in key order
+// records are read without record locks
+// return number of scanned records
+int64_t bpt_scan(int64_t table_id, pagenum_t root, bpt_key_t begin,
+                 bpt_key_t end, bpt_scan_callback_t callback, void *arg);
+
 // update record
 // if trx_id is less than 1, then do nothing with trx
 // return true on success
@@ -49,4 +68,13 @@ pagenum_t bpt_insert(int64_t table_id, pagenum_t root, bpt_key_t key,
 // return root (0 on failed)
 pagenum_t bpt_delete(int64_t table_id, pagenum_t root, bpt_key_t key);
 
+// move page of the tree to an unused page (to) for compaction
+// the page is copied and pointers to it (parent or header, left sibling,
+// parent of children) are redirected, all in a page patch log together with
+// extra patches (space map changes of the move)
+// no one else should traverse the tree (table is latched exclusively)
+// return true on success (false if records of the page are locked)
+bool bpt_move_page(int64_t table_id, pagenum_t from, pagenum_t to,
+                   const page_patch_t *extra, int num_extra);
+
 #endif
\ No newline at end of file
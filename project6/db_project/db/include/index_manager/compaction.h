@@ -0,0 +1,35 @@
+#ifndef DB_COMPACTION_H_
+#define DB_COMPACTION_H_
+
+#include <cstdint>
+
+// constants
+constexpr int kCompactionLatchRetries = 8;
+constexpr int kCompactionInitialBackoffUs = 100;
+
+// table latch
+// index operations hold it shared while traversing the tree, compaction
+// holds it exclusively while moving a page (it never waits for the latch)
+void latch_table_shared(int64_t table_id);
+void unlatch_table(int64_t table_id);
+
+// move live pages at the end of the table into free pages at the front and
+// shrink the file, each move is logged (page patch log) to survive a crash
+// up to max_moves pages are moved (no limit if it is not positive)
+// compaction stops early if the table is busy or the last page is locked
+// return number of moved pages (negative on failed)
+int64_t compact_table(int64_t table_id, int64_t max_moves);
+
+// run compaction of the table in a background thread
+// moves_per_round pages are moved every interval_ms to throttle it
+// return 0 on success
+int start_compaction(int64_t table_id, int64_t moves_per_round,
+                     int interval_ms);
+
+// stop background compaction of the table and wait for it
+void stop_compaction(int64_t table_id);
+
+// stop all background compactions (before shutting down)
+void stop_all_compactions();
+
+#endif
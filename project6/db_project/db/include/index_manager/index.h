@@ -7,6 +7,12 @@
 // return unique table id (negative on failed)
 int64_t open_table(char *pathname);
 
+// Open existing data file using 'pathname' read-only
+// the file is memory-mapped and pages are read without buffer frames
+// db_find, db_scan work as usual, modifications are rejected
+// return unique table id (negative on failed)
+int64_t open_table_read_only(char *pathname);
+
 // insert (key, value) with its size to data file
 // return 0 on success (other value on failed);
 int db_insert(int64_t table_id, int64_t key, char *value, uint16_t val_size);
@@ -17,6 +23,15 @@ int db_insert(int64_t table_id, int64_t key, char *value, uint16_t val_size);
 int db_find(int64_t table_id, int64_t key, char *ret_val, uint16_t *val_size,
             int trx_id);
 
+// call callback on each record whose key is in [begin_key, end_key]
+// in key order, scan stops if callback returns nonzero
+// records are read without record locks
+// return number of scanned records (negative on failed)
+int64_t db_scan(int64_t table_id, int64_t begin_key, int64_t end_key,
+                int (*callback)(int64_t key, const char *value,
+                                uint16_t size, void *arg),
+                void *arg);
+
 // update the record with given key
 // does not change val_size (new_val_size is used for validation)
 // return 0 on success (other value on failed)
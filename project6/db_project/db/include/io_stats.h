@@ -0,0 +1,74 @@
+#ifndef DB_IO_STATS_H_
+#define DB_IO_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+// I/O accounting
+// every read, write, sync and expand syscall of table files and the log is
+// counted per call site and per table (count and bytes, always on, relaxed
+// atomics). latency histograms are kept when timing is enabled, and each
+// call is written to the trace file when tracing is enabled
+
+// operations
+const int kIoOpRead = 0;
+const int kIoOpWrite = 1;
+const int kIoOpSync = 2;    // fsync/fdatasync
+const int kIoOpExpand = 3;  // fallocate/ftruncate growing a file
+const int kNumIoOps = 4;
+
+// call sites
+const int kIoSitePage = 0;         // file_read_page/file_write_page
+const int kIoSiteBatch = 1;        // file_io_submit
+const int kIoSiteMeta = 2;         // file layout (expand, slot maps, stripes)
+const int kIoSiteDoubleWrite = 3;  // double-write area and restore from it
+const int kIoSiteLog = 4;          // log flush
+const int kIoSiteRecovery = 5;     // log reads (recovery, log description)
+const int kNumIoSites = 6;
+
+// latency bucket i counts calls taking [2^(i-1), 2^i) us (bucket 0 is less
+// than 1us, the last one takes everything above)
+const int kIoLatencyBuckets = 24;
+
+struct io_stat_t {
+  uint64_t count;
+  uint64_t bytes;
+  uint64_t total_ns;  // 0 unless timing is enabled
+  uint64_t latency[kIoLatencyBuckets];
+};
+
+// Get start time of an I/O call (0 if neither timing nor tracing is on)
+uint64_t io_stats_start();
+
+// Account an I/O call started at start (io_stats_start)
+// table_id is negative for the log (only counted per site)
+void io_stats_record(int op, int site, int64_t table_id, uint64_t offset,
+                     uint64_t bytes, uint64_t start);
+
+// Enable or disable latency histograms (disabled by default)
+void io_stats_set_timing(int enable);
+
+// Write a line per I/O call into path (NULL stops tracing)
+// return 0 on success
+int io_stats_set_trace(const char *path);
+
+// Snapshot stats of the op at the site (negative site sums all sites)
+void io_stats_snapshot(int site, int op, io_stat_t *dest);
+
+// Snapshot stats of the op on the table (all sites)
+void io_stats_table_snapshot(int64_t table_id, int op, io_stat_t *dest);
+
+// Upper bound (us) of the latency below which ratio of calls fall
+// return 0 if there is no timed call
+uint64_t io_stats_percentile(const io_stat_t *stat, double ratio);
+
+// Clear all stats
+void io_stats_reset();
+
+// Print non-zero stats per site and per table
+void io_stats_print(FILE *fp);
+
+const char *io_op_name(int op);
+const char *io_site_name(int site);
+
+#endif
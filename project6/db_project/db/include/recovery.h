@@ -19,14 +19,26 @@ struct log_record_t {
   uint16_t len;
 } __attribute__((packed));
 
+// change of a page made outside of transactions (e.g. page move)
+struct page_patch_t {
+  pagenum_t page_num;
+  uint16_t offset;
+  uint16_t len;
+  const byte *data;  // new image of [offset, offset + len)
+};
+
 // constants
 constexpr int32_t BEGIN_LOG = 0;
 constexpr int32_t UPDATE_LOG = 1;
 constexpr int32_t COMMIT_LOG = 2;
 constexpr int32_t ROLLBACK_LOG = 3;
 constexpr int32_t COMPENSATE_LOG = 4;
+constexpr int32_t PAGE_PATCH_LOG = 5;
 
 constexpr uint64_t INITIAL_LOG_BUFFER_SIZE = 1024 * 1024;
+// page patch log may carry a whole page image and pointers to the page
+constexpr uint32_t MAX_LOG_RECORD_SIZE =
+    sizeof(log_record_t) + 4 * kMaxPageSize;
 
 int init_recovery(int flag, int log_num, char *log_path, char *logmsg_path);
 
@@ -43,6 +55,21 @@ log_record_t *create_log_compensate(trx_t *trx, int64_t table_id,
                                     uint16_t len, byte *old_img, byte *new_img,
                                     uint64_t next_undo_seq);
 
+// create redo-only log of patches on pages of the table (no trx)
+// patches are redone together, so a change over several pages is atomic
+// page_id is the page the change is about (for description)
+log_record_t *create_log_page_patch(int64_t table_id, pagenum_t page_id,
+                                    const page_patch_t *patches, int n);
+
+// apply patches of the page patch log and set page_lsn of the pages
+// on redo, pages already having the change are skipped
+// space map changes are reflected in the space summary of the table
+// return 0 on success
+int apply_log_page_patch(log_record_t *rec, bool redo);
+
+// lsn of the last created log (0 if there is no log)
+uint64_t get_last_lsn();
+
 byte *get_old(log_record_t *rec);
 byte *get_new(log_record_t *rec);
 
@@ -50,6 +77,10 @@ int push_into_log_buffer(log_record_t *rec);
 
 int flush_log();
 
+// lsn up to which all logs are flushed (WAL rule of page writes, a page of
+// page_lsn above it should not be written before flush_log)
+uint64_t get_flushed_lsn();
+
 void descript_log_file(int n);
 
 #endif
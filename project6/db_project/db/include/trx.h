@@ -40,11 +40,20 @@ int trx_log_update(trx_t* trx, log_record_t* rec);
 int init_lock_table();
 int free_lock_table();
 
+// acquire a record lock on the pinned page(*page_ptr)
+// the page is unpinned and *page_ptr is set to NULL if the trx waits for the
+// lock (waited is set) or is aborted by a deadlock
 lock_t* lock_acquire(bpt_page_t** page_ptr, int64_t table_id, pagenum_t page_id,
                      int64_t key, int trx_id, int lock_mode, int* waited);
 int lock_release(lock_t* lock_obj);
 trx_t* get_trx(lock_t* lock);
 
+// check if records of the page are locked by running trxs (explicit locks in
+// the lock table or implicit locks on leaf slots)
+// locked pages cannot be moved since locks are bound to the page number
+bool lock_is_page_locked(bpt_page_t* page, int64_t table_id,
+                         pagenum_t page_id);
+
 // APIs for recovery
 void set_trx_counter(trx_id_t val);
 int add_active_trx(trx_id_t trx_id);
@@ -1,66 +1,393 @@
 #include "buffer_manager.h"
 
 #include <pthread.h>
+#include <sched.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <algorithm>
-#include <unordered_map>
-
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <new>
+#include <vector>
+
+#include "index_manager/compaction.h"
 #include "log.h"
 #include "recovery.h"
 
-struct frame_t {
-  page_t frame;
-  int64_t table_id;
-  pagenum_t page_num;
-  int8_t is_dirty;
-  pthread_mutex_t page_latch;
+struct buffer_partition_t;
+
+// references kept per frame by LRU-K
+const int kLRUK = 2;
+
+// frame metadata, page data is in page_arena (or large_page_arena)
+// frames are cache line aligned. the first line holds what replacement
+// sweeps and cleaners scan, the second one the page latch
+struct alignas(64) frame_t {
+  // replacement state, guarded by latch of the partition
   frame_t *next;
   frame_t *prev;
+  buffer_partition_t *partition;  // owner of the frame (fixed)
+  uint64_t history[kLRUK];  // last reference times, latest first (LRU-K)
+  // page held by the frame, set under latch of the partition but read
+  // without it by lookups of the page table (see frame_table_id)
+  std::atomic<int64_t> table_id;
+  std::atomic<pagenum_t> page_num;
+  uint8_t queue;  // queue of the partition the frame is linked in
+  int8_t is_dirty;
+  // set on reference and cleared by the sweep (CLOCK), set without latch
+  // by optimistic reads (other policies apply it as a hit on eviction)
+  std::atomic<uint8_t> referenced;
+  // set when the read-ahead passes the page, cleared by the walk reaching it
+  std::atomic<uint8_t> read_ahead;
+
+  // pin, held shared by readers and exclusive by writers and eviction
+  pthread_rwlock_t page_latch;
+  // bumped when page latch is locked and unlocked exclusively (odd while
+  // locked), optimistic reads are valid if it stays the same
+  std::atomic<uint64_t> version;
+
+  page_t *frame;  // page data (in page_arena for kPageSize pages)
+  uint64_t frame_size;  // page size of the loaded table
+  // swizzled pointers to frames of children per link (kMaxSwizzledLinks),
+  // taken on the first one and given back when the page is replaced
+  std::atomic<std::atomic<frame_t *> *> children;
 };
+static_assert(offsetof(frame_t, page_latch) == 64,
+              "replacement state of a frame should fit in a cache line");
 
 using frame_id_t = std::pair<int64_t, pagenum_t>;
-struct frame_map_hash {
-  template <class T1, class T2>
-  std::size_t operator()(const std::pair<T1, T2> &p) const {
-    return (p.first << 16) ^ (p.second);
-  }
+
+// page table of a partition, open addressing with linear probing
+// it has twice as many slots as the partition has frames (rounded up to a
+// power of two), so it is never rehashed and inserts allocate nothing.
+// inserts and erases are serialized by latch of the partition, lookups
+// take no latch. an erase moves later entries of the cluster back into
+// the hole, so a lookup which misses retries if version changed meanwhile
+// (it is odd while entries are moved)
+struct page_table_t {
+  std::atomic<frame_t *> *slots = NULL;
+  uint64_t mask = 0;
+  std::atomic<uint64_t> version{0};
+};
+
+// doubly linked queue of frames (most recent at head)
+struct frame_queue_t {
+  frame_t *head = NULL, *tail = NULL;
+  uint32_t size = 0;
+};
+
+// queues of a partition, policies other than 2Q only use the main queue
+const int kMainQueue = 0;  // LRU (Am of 2Q)
+const int kInQueue = 1;    // FIFO of pages referenced once (A1in of 2Q)
+const int kNumQueues = 2;
+
+// buffer pool partition
+// a page is only cached in the partition chosen by hashing its id, and each
+// partition has its own frames, replacement state and page table, so hits
+// and misses of pages in different partitions do not contend. latch guards
+// the replacement state and the page table, and is held while a frame is
+// evicted and loaded
+struct buffer_partition_t {
+  pthread_mutex_t latch = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t wait_for_free_frame = PTHREAD_COND_INITIALIZER;
+  page_table_t page_table;
+  // frames in use, the first ones of the max_frames frames of the partition
+  // (it is resized by buffer_resize)
+  uint32_t num_frames = 0;
+  uint32_t max_frames = 0;
+  frame_queue_t queues[kNumQueues];
+  uint64_t clock = 0;  // reference count of the partition (LRU-K)
+  frame_t *first_frame = NULL;  // frames of the partition are contiguous
+  uint32_t hand = 0;            // next frame swept (CLOCK)
+  // pages evicted from A1in of 2Q, oldest first. an entry is live if its
+  // sequence matches the one in ghost_seqs
+  std::deque<std::pair<frame_id_t, uint64_t>> ghosts;
+  std::map<frame_id_t, uint64_t> ghost_seqs;
+  uint64_t ghost_seq = 0;
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+  // children in the partition reached through swizzled pointers or not
+  std::atomic<uint64_t> swizzle_hits{0};
+  std::atomic<uint64_t> swizzle_misses{0};
+};
+
+// page replacement policy
+// callbacks are called with latch of the partition held, except touch
+struct replacement_policy_t {
+  // frame is referenced, hit is false if the page is just loaded into it
+  void (*access)(frame_t *frame, bool hit);
+  // frame is referenced by a hit, called with only its page latch held
+  // (NULL if hits need latch of the partition)
+  void (*touch)(frame_t *frame);
+  // pick a frame to evict, it is returned with its page latch locked
+  // return NULL if every frame is pinned
+  frame_t *(*victim)(buffer_partition_t *partition);
+  // page of the frame is not worth caching (freed or dropped), evict it first
+  void (*demote)(frame_t *frame);
+  // page of the victim is evicted (it is written back if dirty), called
+  // before the frame is reset (NULL if nothing is kept of evicted pages)
+  void (*evicted)(frame_t *frame);
+  // collect up to n frames to be evicted next, the first one first
+  void (*evict_order)(buffer_partition_t *partition, int n,
+                      std::vector<frame_t *> *frames);
 };
-using frame_map_t = std::unordered_map<frame_id_t, frame_t *, frame_map_hash>;
-frame_map_t frame_map;
-frame_t **frame_cache = NULL;
-uint32_t cache_size = 0;
-frame_t *frames = NULL, *head = NULL, *tail = NULL;
 
+// partitions hold at least kMinPartitionFrames frames, so a small pool stays
+// in one partition (a thread pins a few pages of a partition at once)
+const int kMaxBufferPartitions = 64;
+const int kMinPartitionFrames = 64;
+// partitions are shrunk down to kMinResizedPartitionFrames frames at least
+const int kMinResizedPartitionFrames = 16;
+// shrink waits for the pin of a frame to be removed for the interval, and
+// gives up after the retries (the pin may be held by a long transaction)
+const int kResizeRetryUs = 1000;
+const int kResizeRetries = 1000;
+
+buffer_partition_t *partitions = NULL;
+int num_partitions = 0;
+int replacement_policy = kReplaceLRU;  // for pools initialized afterwards
+const replacement_policy_t *policy = NULL;
+frame_t *frames = NULL;
+int num_frames = 0;  // frames allocated, the pool may grow up to it
+int max_frames_setting = 0;  // for pools initialized afterwards (0 for none)
+// page data of frames, mapped on huge pages if possible (see map_page_arena)
+page_t *page_arena = NULL;
+uint64_t page_arena_size = 0;
+int page_arena_kind = kArenaPages;
+const uint64_t kHugePageSize = 2 * 1024 * 1024;
+// pages larger than kPageSize are held in a slot of kMaxPageSize per frame
+// in a range reserved with the pool (only slots in use are touched), so the
+// frame of a page is found from its address without any latch
+byte *large_page_arena = NULL;
+uint64_t large_page_arena_size = 0;
+
+// pointer swizzling
+// a swizzled pointer is never written into the page, so nothing is
+// unswizzled before write-back. it goes stale when either frame is
+// replaced, so it is only followed while the frame it points to holds the
+// page linked by the parent, and is swizzled again otherwise
+const int kMaxSwizzledLinks = 256;  // links of an internal page of kPageSize
+int swizzling_setting = false;      // for pools initialized afterwards
+int swizzling = false;
+// pointers given back by replaced frames, reused by the next parents.
+// optimistic readers may still follow them, so they are only freed with
+// the pool (followers check the frame holds the page anyway)
+std::vector<std::atomic<frame_t *> *> spare_children;
+pthread_mutex_t spare_children_latch = PTHREAD_MUTEX_INITIALIZER;
+
+// serializes init/free of the pool with whole-pool operations
 pthread_mutex_t buffer_manager_latch = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t frame_map_latch = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t wait_for_free_frame = PTHREAD_COND_INITIALIZER;
 
-// load page into buffer
-// return loaded frame ptr (NULL on failed)
-frame_t *buffer_load_page(int64_t table_id, pagenum_t pagenum);
+// page cleaners
+// cleaner i writes dirty frames at the eviction end of partitions i,
+// i + num_cleaners, ... ahead of time, so misses rarely write a victim.
+// they run until nothing is left to clean, then sleep for the interval or
+// until a miss has to write a dirty victim. stopping is guarded by
+// cleaner_latch
+const int kCleanerIntervalMs = 10;
+int num_cleaners_setting = 0;  // for pools initialized afterwards
+int clean_target_setting = 0;
+std::vector<pthread_t> cleaners;
+int clean_target = 0;  // frames at the eviction end kept clean
+bool cleaners_stopping = false;
+pthread_mutex_t cleaner_latch = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cleaner_wakeup = PTHREAD_COND_INITIALIZER;
+
+// read-ahead
+// walks report their steps to a stream of the thread. two steps along the
+// chain start the read-ahead, and a window of pages from the next page is
+// requested whenever half of the last one is passed. the read-ahead thread
+// loads them into clean frames only (it neither writes nor waits for a
+// frame), and stops at a page latched exclusively
+const int kMinReadAheadWindow = 4;
+const int kMaxReadAheadRequests = 64;
+int max_read_ahead_setting = 0;  // for pools initialized afterwards
+int max_read_ahead = 0;
+
+struct read_ahead_request_t {
+  int64_t table_id;
+  pagenum_t pagenum;
+  int num_pages;
+  buffer_next_page_t next;
+};
 
-// evict page (clock policy)
-// return evicted page's frame ptr (to load page into that position)
+struct read_ahead_stream_t {
+  int64_t table_id = -1;
+  pagenum_t expected = 0;  // next page of the last step
+  int window = 0;
+  int ahead = 0;  // pages of the last window not reached yet
+  // steps passed by the read-ahead or not since the last window
+  int hits = 0, misses = 0;
+};
+thread_local read_ahead_stream_t read_ahead_stream;
+
+std::deque<read_ahead_request_t> read_ahead_requests;
+pthread_t read_ahead_thread;
+bool read_ahead_running = false;
+bool read_ahead_stopping = false;
+pthread_mutex_t read_ahead_latch = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t read_ahead_wakeup = PTHREAD_COND_INITIALIZER;
+
+// map page arena of size bytes (rounded up to huge pages)
+// explicit huge pages are used if there are reserved ones, otherwise the
+// arena is aligned to a huge page and transparent huge pages are advised
 // return NULL on failed
-frame_t *buffer_evict_frame();
+page_t *map_page_arena(uint64_t size);
+// unmap page arena and large page arena
+void unmap_page_arena();
+
+// get hash of the page id (mixing both of table id and page number)
+uint64_t page_hash(int64_t table_id, pagenum_t pagenum);
+
+// get partition of the page
+buffer_partition_t *page_partition(int64_t table_id, pagenum_t pagenum);
+
+// allocate slots of the page table for num_frames frames
+// return 0 on success
+int page_table_init(page_table_t *table, uint32_t num_frames);
+void page_table_free(page_table_t *table);
+
+// find frame of the page in the page table (without latch)
+// return NULL if the page is not in it
+frame_t *page_table_find(page_table_t *table, int64_t table_id,
+                         pagenum_t pagenum);
+
+// add the frame (holding its page) to the page table or remove it
+// latch of the partition should be held
+void page_table_insert(page_table_t *table, frame_t *frame);
+void page_table_erase(page_table_t *table, frame_t *frame);
+
+// load page into buffer
+// latch of the partition should be held
+// speculative loads (read-ahead) only take a clean frame without waiting
+// return loaded frame ptr with its page latch held (NULL on failed)
+frame_t *buffer_load_page(int64_t table_id, pagenum_t pagenum,
+                          bool speculative = false);
+
+// evict page of the partition (picked by the replacement policy)
+// latch of the partition should be held
+// return evicted page's frame ptr with its page latch held (to load page
+// into that position), NULL on failed (or if the victim of a speculative
+// eviction is dirty or every frame is pinned)
+frame_t *buffer_evict_frame(buffer_partition_t *partition,
+                            bool speculative = false);
 
 // find specific frame in buffer
 // return NULL on failed
 frame_t *find_frame(int64_t table_id, pagenum_t pagenum);
 
-// make given node a head of the LRU list
-void set_LRU_head(frame_t *node);
+// get page held by the frame (table id is negative for a free frame)
+// they are read without latch, so the page may be replaced meanwhile
+int64_t frame_table_id(const frame_t *frame);
+pagenum_t frame_page_num(const frame_t *frame);
+
+// set page held by the frame
+// latch of the partition should be held
+void set_frame_page(frame_t *frame, int64_t table_id, pagenum_t pagenum);
 
-// make given node a tail of the LRU list
-void set_LRU_tail(frame_t *node);
+// make given node a head of the queue of its partition
+// node is moved from the queue it is linked in
+void set_LRU_head(frame_t *node, int queue = kMainQueue);
+
+// make given node a tail of the queue of its partition
+void set_LRU_tail(frame_t *node, int queue = kMainQueue);
+
+// remove the frame from the page table of its partition
+void erase_frame(frame_t *frame);
+
+// lock page latch of the frame in shared or exclusive mode
+// return 0 on success
+int latch_frame(frame_t *frame, int shared);
+
+// lock page latch of the frame if it is not latched (exclusively)
+// return 0 on success
+int try_latch_frame(frame_t *frame, int shared = false);
+
+// unlock page latch of the frame (both modes)
+// return 0 on success
+int unlatch_frame(frame_t *frame);
+
+// set reference bit of the frame (without any latch)
+void mark_referenced(frame_t *frame);
+
+// get page of the frame to read it optimistically if it holds the page
+// return NULL if it does not or cannot be read so
+const page_t *read_frame_optimistic(frame_t *frame, int64_t table_id,
+                                    pagenum_t pagenum, uint64_t *version);
+
+// get swizzled pointers of the frame (allocated if there is none)
+// return NULL on failed
+std::atomic<frame_t *> *frame_children(frame_t *frame);
+
+// give swizzled pointers of the frame back (its page is replaced)
+void release_children(frame_t *frame);
 
 // get frame ptr and update LRU list
 frame_t *get_frame(int64_t table_id, pagenum_t pagenum);
 
+// get frame of the page ptr (gotten by buffer_get_page_ptr)
+frame_t *page_to_frame(page_t *page);
+
+// check if the page ptr is a frame (not a page of read-only mapped table)
+bool is_frame_page(const page_t *page);
+
+// make page data of the (evicted) frame page_size bytes
+// return 0 on success
+int resize_frame(frame_t *frame, uint64_t page_size);
+
+// expand file twice and extend space maps to the new pages
+// header page is latched, so only one thread grows the file
+// return 0 on success
+int buffer_grow_space_maps(int64_t table_id);
+
+// write back all dirty frames in a batch
+// writes are submitted at once (asynchronously if io_uring is available)
+// latches of all partitions should be held
+// return 0 on success
+int write_back_dirty_frames();
+
+// latch all partitions (in order) and unlatch them
+void latch_all_partitions();
+void unlatch_all_partitions();
+
+// get page_lsn of the page in the frame
+uint64_t frame_page_lsn(const frame_t *frame);
+
+// write back page of the dirty frame (after its logs)
+// return 0 on success
+int write_back_frame(frame_t *frame);
+
+// add frames to the partition or remove them (evicting their pages) until
+// it has num_frames frames, latch of the partition is held by a frame
+// return 0 on success
+int grow_partition(buffer_partition_t *partition, uint32_t num_frames);
+int shrink_partition(buffer_partition_t *partition, uint32_t num_frames);
+
+// write dirty frames among the ones to be evicted next in the partition
+// return number of written frames
+int clean_partition(buffer_partition_t *partition);
+
+// start and stop page cleaners of the pool
+void start_cleaners();
+void stop_cleaners();
+
+// load pages of the chain from the page of the request
+void read_ahead_chain(const read_ahead_request_t &req);
+
+// start and stop read-ahead thread of the pool
+void start_read_ahead();
+void stop_read_ahead();
+
 // internal api functions
 // to preserve interface , Disk Space Manager uses this functions internally
-void __buffer_read_page(int64_t table_id, pagenum_t pagenum, page_t *dest) {
+// whole page is copied unless size is given (header pages)
+void __buffer_read_page(int64_t table_id, pagenum_t pagenum, page_t *dest,
+                        uint64_t size = 0) {
   if (table_id < 0 || dest == NULL) {
     LOG_ERR(3, "invalid parameters");
     return;
@@ -72,11 +399,11 @@ void __buffer_read_page(int64_t table_id, pagenum_t pagenum, page_t *dest) {
     return;
   }
 
-  memcpy(dest, page_ptr, sizeof(page_t));
+  memcpy(dest, page_ptr, size != 0 ? size : file_page_size(table_id));
 }
 
 void __buffer_write_page(int64_t table_id, pagenum_t pagenum,
-                         const page_t *src) {
+                         const page_t *src, uint64_t size = 0) {
   if (table_id < 0 || src == NULL) {
     LOG_ERR(3, "invalid parameters");
     return;
@@ -88,7 +415,7 @@ void __buffer_write_page(int64_t table_id, pagenum_t pagenum,
              pagenum);
     return;
   }
-  memcpy(&frame->frame, src, sizeof(page_t));
+  memcpy(frame->frame, src, size != 0 ? size : frame->frame_size);
   frame->is_dirty = true;
 }
 
@@ -97,6 +424,7 @@ void __unpin(int64_t table_id, pagenum_t pagenum) {
     LOG_ERR(3, "invalid parameters");
     return;
   }
+  if (file_is_read_only(table_id)) return;  // mapped pages are not pinned
 
   auto *frame = find_frame(table_id, pagenum);
   if (frame == NULL) {
@@ -104,111 +432,302 @@ void __unpin(int64_t table_id, pagenum_t pagenum) {
              pagenum);
     return;
   }
-  if (pthread_mutex_unlock(&frame->page_latch)) {
+  if (unlatch_frame(frame)) {
     LOG_ERR(3, "failed to unlock page latch");
     return;
   }
-  pthread_cond_signal(&wait_for_free_frame);
+  pthread_cond_signal(&frame->partition->wait_for_free_frame);
 }
 
-frame_t *buffer_load_page(int64_t table_id, pagenum_t pagenum) {
+page_t *map_page_arena(uint64_t size) {
+  page_arena_size = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  void *arena = mmap(NULL, page_arena_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (arena != MAP_FAILED) {
+    page_arena_kind = kArenaHugePages;
+    return (page_t *)arena;
+  }
+
+  // map a huge page more to align the arena, and cut off both ends
+  auto mapped_size = page_arena_size + kHugePageSize;
+  auto *mapped = (byte *)mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) return NULL;
+  auto *aligned = (byte *)(((uintptr_t)mapped + kHugePageSize - 1) &
+                           ~(uintptr_t)(kHugePageSize - 1));
+  if (aligned > mapped) munmap(mapped, aligned - mapped);
+  auto *end = aligned + page_arena_size;
+  if (end < mapped + mapped_size) munmap(end, mapped + mapped_size - end);
+  // failure is harmless, the arena is on normal pages then
+  page_arena_kind = madvise(aligned, page_arena_size, MADV_HUGEPAGE) == 0
+                        ? kArenaTransparentHugePages
+                        : kArenaPages;
+  return (page_t *)aligned;
+}
+
+void unmap_page_arena() {
+  if (page_arena != NULL && munmap(page_arena, page_arena_size) < 0) {
+    LOG_WARN("failed to unmap page arena, %s", strerror(errno));
+  }
+  page_arena = NULL;
+  page_arena_size = 0;
+  page_arena_kind = kArenaPages;
+  if (large_page_arena != NULL &&
+      munmap(large_page_arena, large_page_arena_size) < 0) {
+    LOG_WARN("failed to unmap large page arena, %s", strerror(errno));
+  }
+  large_page_arena = NULL;
+  large_page_arena_size = 0;
+}
+
+uint64_t page_hash(int64_t table_id, pagenum_t pagenum) {
+  uint64_t h = (uint64_t)table_id * 0x9e3779b97f4a7c15ULL ^ pagenum;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+buffer_partition_t *page_partition(int64_t table_id, pagenum_t pagenum) {
+  // consecutive pages of a table spread over partitions
+  return &partitions[page_hash(table_id, pagenum) % num_partitions];
+}
+
+// get home slot of the page in the page table
+// high bits of the hash are used, low ones pick the partition
+uint64_t page_table_slot(const page_table_t *table, int64_t table_id,
+                         pagenum_t pagenum) {
+  return (page_hash(table_id, pagenum) >> 16) & table->mask;
+}
+
+int page_table_init(page_table_t *table, uint32_t num_frames) {
+  uint64_t num_slots = 1;
+  while (num_slots < 2ULL * num_frames) num_slots <<= 1;
+  table->slots = new (std::nothrow) std::atomic<frame_t *>[num_slots];
+  if (table->slots == NULL) return 1;
+  for (uint64_t i = 0; i < num_slots; ++i)
+    table->slots[i].store(NULL, std::memory_order_relaxed);
+  table->mask = num_slots - 1;
+  table->version.store(0, std::memory_order_relaxed);
+  return 0;
+}
+
+void page_table_free(page_table_t *table) {
+  delete[] table->slots;
+  table->slots = NULL;
+  table->mask = 0;
+}
+
+frame_t *page_table_find(page_table_t *table, int64_t table_id,
+                         pagenum_t pagenum) {
+  auto home = page_table_slot(table, table_id, pagenum);
+  while (true) {
+    auto version = table->version.load(std::memory_order_acquire);
+    if ((version & 1) == 0) {
+      // frames are half of the slots at most, so the probe ends at an
+      // empty slot
+      for (auto i = home;; i = (i + 1) & table->mask) {
+        auto *frame = table->slots[i].load(std::memory_order_acquire);
+        if (frame == NULL) break;
+        if (frame_table_id(frame) == table_id &&
+            frame_page_num(frame) == pagenum)
+          return frame;
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (table->version.load(std::memory_order_relaxed) == version)
+        return NULL;
+    }
+    sched_yield();
+  }
+}
+
+void page_table_insert(page_table_t *table, frame_t *frame) {
+  auto i = page_table_slot(table, frame_table_id(frame), frame_page_num(frame));
+  while (table->slots[i].load(std::memory_order_relaxed) != NULL)
+    i = (i + 1) & table->mask;
+  table->slots[i].store(frame, std::memory_order_release);
+}
+
+void page_table_erase(page_table_t *table, frame_t *frame) {
+  auto hole =
+      page_table_slot(table, frame_table_id(frame), frame_page_num(frame));
+  while (true) {
+    auto *entry = table->slots[hole].load(std::memory_order_relaxed);
+    if (entry == frame) break;
+    if (entry == NULL) return;  // free frames are not in it
+    hole = (hole + 1) & table->mask;
+  }
+
+  table->version.fetch_add(1, std::memory_order_acq_rel);
+  // move back entries of the cluster whose home is not between the hole
+  // and them (the hole would cut them off from their home)
+  for (auto i = (hole + 1) & table->mask;; i = (i + 1) & table->mask) {
+    auto *moved = table->slots[i].load(std::memory_order_relaxed);
+    if (moved == NULL) break;
+    auto home =
+        page_table_slot(table, frame_table_id(moved), frame_page_num(moved));
+    if (((i - home) & table->mask) < ((i - hole) & table->mask)) continue;
+    table->slots[hole].store(moved, std::memory_order_release);
+    hole = i;
+  }
+  table->slots[hole].store(NULL, std::memory_order_release);
+  table->version.fetch_add(1, std::memory_order_release);
+}
+
+frame_t *buffer_load_page(int64_t table_id, pagenum_t pagenum,
+                          bool speculative) {
   if (table_id < 0) {
     LOG_ERR(3, "invalid parameters");
     return NULL;
   }
 
-  // buffer_manager_latch is already locked in buffer_get_page_ptr
-  frame_t *frame = buffer_evict_frame();
+  // latch of the partition is already locked in buffer_get_page_ptr
+  auto *partition = page_partition(table_id, pagenum);
+  frame_t *frame = buffer_evict_frame(partition, speculative);
+  if (frame == NULL && speculative) return NULL;
   if (frame == NULL) {
     LOG_ERR(3, "failed to evict frame");
     return NULL;
   }
-  frame->table_id = table_id;
-  frame->page_num = pagenum;
-  file_read_page(table_id, pagenum, &frame->frame);
-
-  // push to frame_map
-  auto frame_id = std::make_pair(table_id, pagenum);
-  pthread_mutex_lock(&frame_map_latch);
-  frame_map.emplace(frame_id, frame);
-  auto hash_key = frame_map.hash_function()(frame_id);
-  frame_cache[hash_key % cache_size] = frame;
-  pthread_mutex_unlock(&frame_map_latch);
+  if (resize_frame(frame, file_page_size(table_id))) {
+    LOG_ERR(3, "failed to allocate page of %llu bytes",
+            file_page_size(table_id));
+    return NULL;
+  }
+  set_frame_page(frame, table_id, pagenum);
+  file_read_page(table_id, pagenum, frame->frame);
+
+  page_table_insert(&partition->page_table, frame);
   return frame;
 }
 
-frame_t *buffer_evict_frame() {
+void erase_frame(frame_t *frame) {
+  page_table_erase(&frame->partition->page_table, frame);
+}
+
+frame_t *buffer_evict_frame(buffer_partition_t *partition,
+                            bool speculative) {
   // find evict page
-  // buffer_manager_latch is already locked in buffer_get_page_ptr
+  // latch of the partition is already locked in buffer_get_page_ptr
   frame_t *iter = NULL;
   while (iter == NULL) {
-    iter = tail;
-    while (iter != NULL) {
-      if (pthread_mutex_trylock(&iter->page_latch) == 0)
-        break;
-      else
-        iter = iter->prev;
-    }
+    iter = policy->victim(partition);
     if (iter == NULL) {
-      pthread_cond_wait(&wait_for_free_frame, &buffer_manager_latch);
+      if (speculative) return NULL;
+      pthread_cond_wait(&partition->wait_for_free_frame, &partition->latch);
     }
   }
+  if (speculative && iter->is_dirty) {
+    unlatch_frame(iter);
+    return NULL;
+  }
 
   // flush if dirty flag set
   if (iter->is_dirty) {
-    // flush all logs
-    if (flush_log()) {
-      LOG_ERR(3, "failed to flush logs");
-      return NULL;
-    }
-
-    file_write_page(iter->table_id, iter->page_num, &iter->frame);
+    // page cleaners are behind
+    if (!cleaners.empty()) pthread_cond_signal(&cleaner_wakeup);
+    if (write_back_frame(iter)) return NULL;
   }
+  if (policy->evicted != NULL) policy->evicted(iter);
 
-  // remove from frame_map
-  auto frame_id = std::make_pair(iter->table_id, iter->page_num);
-  pthread_mutex_lock(&frame_map_latch);
-  frame_map.erase(frame_id);
-  auto hash_key = frame_map.hash_function()(frame_id);
-  auto *cached_frame = frame_cache[hash_key % cache_size];
-  if (cached_frame != NULL && cached_frame->table_id == frame_id.first &&
-      cached_frame->page_num == frame_id.second)
-    frame_cache[hash_key % cache_size] = NULL;
-  pthread_mutex_unlock(&frame_map_latch);
+  // remove from page table
+  erase_frame(iter);
 
   // reset frame data
-  iter->table_id = -1;
-  iter->page_num = 0;
+  // page latch is kept until the new page is loaded, hits served without
+  // latch of the partition check the page of the frame under it
+  set_frame_page(iter, -1, 0);
   iter->is_dirty = false;
-  pthread_mutex_unlock(&iter->page_latch);
+  iter->referenced.store(0, std::memory_order_relaxed);
+  iter->read_ahead.store(0, std::memory_order_relaxed);
+  release_children(iter);
   return iter;
 }
 
-page_t *buffer_get_page_ptr(int64_t table_id, pagenum_t pagenum) {
+int latch_frame(frame_t *frame, int shared) {
+  if (shared) return pthread_rwlock_rdlock(&frame->page_latch);
+  if (pthread_rwlock_wrlock(&frame->page_latch)) return 1;
+  frame->version.fetch_add(1, std::memory_order_acq_rel);
+  return 0;
+}
+
+int try_latch_frame(frame_t *frame, int shared) {
+  if (shared) return pthread_rwlock_tryrdlock(&frame->page_latch);
+  if (pthread_rwlock_trywrlock(&frame->page_latch)) return 1;
+  frame->version.fetch_add(1, std::memory_order_acq_rel);
+  return 0;
+}
+
+int unlatch_frame(frame_t *frame) {
+  // only an exclusive holder sees an odd version, shared holders exclude it
+  if (frame->version.load(std::memory_order_relaxed) & 1)
+    frame->version.fetch_add(1, std::memory_order_release);
+  return pthread_rwlock_unlock(&frame->page_latch);
+}
+
+void mark_referenced(frame_t *frame) {
+  // skip the store on hot frames, their cache line stays shared
+  if (frame->referenced.load(std::memory_order_relaxed) == 0)
+    frame->referenced.store(1, std::memory_order_relaxed);
+}
+
+page_t *buffer_get_page_ptr(int64_t table_id, pagenum_t pagenum, int shared) {
   if (table_id < 0) {
     LOG_ERR(3, "invalid parameters");
     return NULL;
   }
 
-  pthread_mutex_lock(&buffer_manager_latch);
+  // read-only tables are served from their mapping without frame and latch
+  auto *mapped_page = file_mapped_page(table_id, pagenum);
+  if (mapped_page != NULL) return (page_t *)mapped_page;
+  if (file_is_read_only(table_id)) return NULL;
+
+  auto *partition = page_partition(table_id, pagenum);
+  if (policy->touch != NULL) {
+    // hit without latch of the partition, the frame may be replaced until
+    // its page latch is held, so its page is checked again
+    auto *frame = find_frame(table_id, pagenum);
+    if (frame != NULL) {
+      if (latch_frame(frame, shared)) {
+        LOG_ERR(3, "failed to lock page latch");
+        return NULL;
+      }
+      if (frame_table_id(frame) == table_id &&
+          frame_page_num(frame) == pagenum) {
+        partition->hits.fetch_add(1, std::memory_order_relaxed);
+        policy->touch(frame);
+        return frame->frame;
+      }
+      unlatch_frame(frame);
+      pthread_cond_signal(&partition->wait_for_free_frame);
+    }
+  }
+
+  pthread_mutex_lock(&partition->latch);
   auto result = find_frame(table_id, pagenum);
+  auto hit = result != NULL;
   if (result == NULL) {
     result = buffer_load_page(table_id, pagenum);
     if (result == NULL) {
-      pthread_mutex_unlock(&buffer_manager_latch);
+      pthread_mutex_unlock(&partition->latch);
       LOG_ERR(3, "failed to load page");
       return NULL;
     }
   }
 
-  set_LRU_head(result);
-  if (pthread_mutex_lock(&result->page_latch)) {
+  (hit ? partition->hits : partition->misses)
+      .fetch_add(1, std::memory_order_relaxed);
+  policy->access(result, hit);
+  // loaded frame is already latched exclusively, it cannot be evicted while
+  // latch of the partition is held, so it is latched again in shared mode
+  if (!hit && shared) unlatch_frame(result);
+  if ((hit || shared) && latch_frame(result, shared)) {
     LOG_ERR(3, "failed to lock page latch");
     return NULL;
   }
-  pthread_mutex_unlock(&buffer_manager_latch);
+  pthread_mutex_unlock(&partition->latch);
 
-  return &result->frame;
+  return result->frame;
 }
 
 void set_dirty(page_t *page) {
@@ -216,95 +735,549 @@ void set_dirty(page_t *page) {
     LOG_ERR(3, "invalid parameters");
     return;
   }
+  if (!is_frame_page(page)) {
+    LOG_WARN("cannot modify a page of read-only table");
+    return;
+  }
 
-  frame_t *frame = (frame_t *)page;
+  frame_t *frame = page_to_frame(page);
   frame->is_dirty = true;
 }
 
+frame_t *page_to_frame(page_t *page) {
+  if (page >= page_arena && page < page_arena + num_frames)
+    return &frames[page - page_arena];
+  auto *data = (byte *)page;
+  if (data >= large_page_arena &&
+      data < large_page_arena + large_page_arena_size)
+    return &frames[(data - large_page_arena) / kMaxPageSize];
+  return NULL;
+}
+
+bool is_frame_page(const page_t *page) {
+  auto *data = (const byte *)page;
+  return (page >= page_arena && page < page_arena + num_frames) ||
+         (data >= large_page_arena &&
+          data < large_page_arena + large_page_arena_size);
+}
+
+int resize_frame(frame_t *frame, uint64_t page_size) {
+  if (frame->frame_size == page_size) return 0;
+
+  auto *slot = large_page_arena + (frame - frames) * kMaxPageSize;
+  if (page_size == kPageSize) {
+    // give page data of the slot back
+    madvise(slot, kMaxPageSize, MADV_DONTNEED);
+    frame->frame = &page_arena[frame - frames];
+  } else {
+    frame->frame = (page_t *)slot;
+  }
+  frame->frame_size = page_size;
+  return 0;
+}
+
 frame_t *find_frame(int64_t table_id, pagenum_t pagenum) {
   if (table_id < 0) {
     LOG_ERR(3, "invalid parameters");
     return NULL;
   }
 
-  auto frame_id = std::make_pair(table_id, pagenum);
-  pthread_mutex_lock(&frame_map_latch);
-  // check cache
-  auto hash_key = frame_map.hash_function()(frame_id);
-  auto *cached_frame = frame_cache[hash_key % cache_size];
-  if (cached_frame != NULL && cached_frame->table_id == frame_id.first &&
-      cached_frame->page_num == frame_id.second) {
-    pthread_mutex_unlock(&frame_map_latch);
-    return cached_frame;
-  }
+  auto *partition = page_partition(table_id, pagenum);
+  return page_table_find(&partition->page_table, table_id, pagenum);
+}
 
-  auto search = frame_map.find(frame_id);
-  if (search != frame_map.end()) {
-    frame_cache[hash_key % cache_size] = search->second;
-    pthread_mutex_unlock(&frame_map_latch);
-    return search->second;
-  } else {
-    pthread_mutex_unlock(&frame_map_latch);
-    return NULL;
-  }
+int64_t frame_table_id(const frame_t *frame) {
+  return frame->table_id.load(std::memory_order_relaxed);
+}
+
+pagenum_t frame_page_num(const frame_t *frame) {
+  return frame->page_num.load(std::memory_order_relaxed);
+}
+
+void set_frame_page(frame_t *frame, int64_t table_id, pagenum_t pagenum) {
+  frame->table_id.store(table_id, std::memory_order_relaxed);
+  frame->page_num.store(pagenum, std::memory_order_relaxed);
+}
+
+// unlink the frame from its queue
+void unlink_frame(frame_t *node) {
+  auto &queue = node->partition->queues[node->queue];
+  if (node->prev != NULL)
+    node->prev->next = node->next;
+  else
+    queue.head = node->next;
+  if (node->next != NULL)
+    node->next->prev = node->prev;
+  else
+    queue.tail = node->prev;
+  node->next = node->prev = NULL;
+  --queue.size;
 }
 
-void set_LRU_head(frame_t *node) {
+void set_LRU_head(frame_t *node, int queue) {
   if (node == NULL) {
     LOG_ERR(3, "invalid parameters");
     return;
   }
 
-  // buffer_manager_latch is already locked in buffer_get_page_ptr
-  if (node->prev != NULL) {    // node is not a head
-    if (node->next == NULL) {  // node is a tail
-      tail = node->prev;
-      tail->next = NULL;
-
-      head->prev = node;
-      node->next = head;
-      node->prev = NULL;
-      head = node;
-    } else {  // result is not a head and result is not a tail
-      node->prev->next = node->next;
-      node->next->prev = node->prev;
-
-      head->prev = node;
-      node->next = head;
-      node->prev = NULL;
-      head = node;
-    }
-  }
-  // if node is head, then do nothing
+  // latch of the partition is already locked in buffer_get_page_ptr
+  auto &q = node->partition->queues[queue];
+  if (node->queue == queue && q.head == node) return;
+  unlink_frame(node);
+  node->queue = queue;
+  node->next = q.head;
+  if (q.head != NULL) q.head->prev = node;
+  q.head = node;
+  if (q.tail == NULL) q.tail = node;
+  ++q.size;
 }
 
-void set_LRU_tail(frame_t *node) {
+void set_LRU_tail(frame_t *node, int queue) {
   if (node == NULL) {
     LOG_ERR(3, "invalid parameters");
     return;
   }
 
-  // buffer_manager_latch is already locked in buffer_free_page
-  if (node->next != NULL) {    // node is not a tail
-    if (node->prev == NULL) {  // node is a head
-      head = node->next;
-      head->prev = NULL;
-
-      tail->next = node;
-      node->prev = tail;
-      node->next = NULL;
-      tail = node;
-    } else {  // node is not a tail and node is not a head
-      node->prev->next = node->next;
-      node->next->prev = node->prev;
-
-      tail->next = node;
-      node->prev = tail;
-      node->next = NULL;
-      tail = node;
+  // latch of the partition is already locked in buffer_free_page
+  auto &q = node->partition->queues[queue];
+  if (node->queue == queue && q.tail == node) return;
+  unlink_frame(node);
+  node->queue = queue;
+  node->prev = q.tail;
+  if (q.tail != NULL) q.tail->next = node;
+  q.tail = node;
+  if (q.head == NULL) q.head = node;
+  ++q.size;
+}
+
+// apply the hit of optimistic reads on the frame (its reference bit) to
+// the policy, which moves the frame
+// return true if there was one
+bool apply_deferred_hit(frame_t *frame) {
+  if (frame->referenced.load(std::memory_order_relaxed) == 0) return false;
+  frame->referenced.store(0, std::memory_order_relaxed);
+  policy->access(frame, true);
+  return true;
+}
+
+// latch the least recent frame of the queue which is not pinned
+// return NULL if there is no such frame
+frame_t *latch_queue_victim(buffer_partition_t *partition, int queue) {
+  for (auto *iter = partition->queues[queue].tail; iter != NULL;) {
+    auto *prev = iter->prev;
+    if (!apply_deferred_hit(iter) && try_latch_frame(iter) == 0) return iter;
+    iter = prev;
+  }
+  return NULL;
+}
+
+// LRU
+// a hit moves the frame to the head, the tail is evicted
+void lru_access(frame_t *frame, bool) { set_LRU_head(frame); }
+
+frame_t *lru_victim(buffer_partition_t *partition) {
+  return latch_queue_victim(partition, kMainQueue);
+}
+
+void lru_demote(frame_t *frame) {
+  frame->referenced.store(0, std::memory_order_relaxed);
+  set_LRU_tail(frame);
+}
+
+// LRU-K
+// the frame whose K-th last reference is the oldest is evicted, frames
+// referenced less than K times go first (in LRU order). one scan over a
+// table only references its pages once, so it does not push out pages
+// referenced again. history of evicted pages is not retained
+void lru_k_access(frame_t *frame, bool hit) {
+  auto *partition = frame->partition;
+  if (hit) {
+    for (int i = kLRUK - 1; i > 0; --i)
+      frame->history[i] = frame->history[i - 1];
+  } else {
+    memset(frame->history, 0, sizeof(frame->history));
+  }
+  frame->history[0] = ++partition->clock;
+  set_LRU_head(frame);
+}
+
+frame_t *lru_k_victim(buffer_partition_t *partition) {
+  frame_t *victim = NULL;
+  for (auto *iter = partition->queues[kMainQueue].tail, *prev = iter;
+       iter != NULL; iter = prev) {
+    prev = iter->prev;
+    if (apply_deferred_hit(iter)) continue;
+    if (victim != NULL &&
+        iter->history[kLRUK - 1] >= victim->history[kLRUK - 1])
+      continue;
+    if (try_latch_frame(iter)) continue;
+    if (victim != NULL) unlatch_frame(victim);
+    victim = iter;
+    // least recent one of the frames referenced less than K times
+    if (victim->history[kLRUK - 1] == 0) break;
+  }
+  return victim;
+}
+
+void lru_k_demote(frame_t *frame) {
+  frame->referenced.store(0, std::memory_order_relaxed);
+  memset(frame->history, 0, sizeof(frame->history));
+  set_LRU_tail(frame);
+}
+
+// 2Q
+// loaded pages enter A1in (FIFO) and move to Am (LRU) when they are
+// referenced again, or loaded again while remembered in A1out (ghosts of
+// pages evicted from A1in), so pages referenced once by scans leave through
+// A1in. A1in is evicted while it is larger than a quarter of the partition
+void two_q_access(frame_t *frame, bool hit) {
+  auto *partition = frame->partition;
+  if (hit) {
+    set_LRU_head(frame, kMainQueue);
+    return;
+  }
+  auto ghost = partition->ghost_seqs.find(
+      std::make_pair(frame_table_id(frame), frame_page_num(frame)));
+  if (ghost != partition->ghost_seqs.end()) {
+    partition->ghost_seqs.erase(ghost);
+    set_LRU_head(frame, kMainQueue);
+  } else {
+    set_LRU_head(frame, kInQueue);
+  }
+}
+
+frame_t *two_q_victim(buffer_partition_t *partition) {
+  auto &in = partition->queues[kInQueue];
+  auto &main = partition->queues[kMainQueue];
+  // empty frames go first
+  int queue = kMainQueue;
+  if (in.tail != NULL && frame_table_id(in.tail) < 0)
+    queue = kInQueue;
+  else if (main.tail != NULL && frame_table_id(main.tail) < 0)
+    queue = kMainQueue;
+  else if (in.size > std::max(1u, partition->num_frames / 4))
+    queue = kInQueue;
+  auto *victim = latch_queue_victim(partition, queue);
+  if (victim == NULL) victim = latch_queue_victim(partition, 1 - queue);
+  return victim;
+}
+
+void two_q_demote(frame_t *frame) {
+  frame->referenced.store(0, std::memory_order_relaxed);
+  set_LRU_tail(frame, frame->queue);
+}
+
+// a victim may still be kept (dirty one of a speculative load), so pages
+// are remembered in A1out once they are evicted
+void two_q_evicted(frame_t *frame) {
+  auto *partition = frame->partition;
+  if (frame->queue != kInQueue || frame_table_id(frame) < 0) return;
+
+  // remember the page in A1out, which holds half of the partition
+  auto frame_id = std::make_pair(frame_table_id(frame), frame_page_num(frame));
+  partition->ghost_seqs[frame_id] = ++partition->ghost_seq;
+  partition->ghosts.emplace_back(frame_id, partition->ghost_seq);
+  while (partition->ghosts.size() > std::max(1u, partition->num_frames / 2)) {
+    auto &oldest = partition->ghosts.front();
+    auto search = partition->ghost_seqs.find(oldest.first);
+    if (search != partition->ghost_seqs.end() &&
+        search->second == oldest.second)
+      partition->ghost_seqs.erase(search);
+    partition->ghosts.pop_front();
+  }
+}
+
+// CLOCK
+// a hit only sets the reference bit of the frame, so it needs no latch of
+// the partition and writes no shared list. the hand sweeps the frames of the
+// partition, clearing set bits, and evicts the first one not referenced
+void clock_access(frame_t *frame, bool) {
+  frame->referenced.store(1, std::memory_order_relaxed);
+}
+
+void clock_touch(frame_t *frame) { mark_referenced(frame); }
+
+frame_t *clock_victim(buffer_partition_t *partition) {
+  // two rounds clear every bit, frames still latched after them are pinned
+  for (uint32_t i = 0; i < 2 * partition->num_frames; ++i) {
+    auto *iter = &partition->first_frame[partition->hand];
+    partition->hand = (partition->hand + 1) % partition->num_frames;
+    if (iter->referenced.load(std::memory_order_relaxed)) {
+      iter->referenced.store(0, std::memory_order_relaxed);
+      continue;
+    }
+    if (try_latch_frame(iter) == 0) return iter;
+  }
+  return NULL;
+}
+
+void clock_demote(frame_t *frame) {
+  frame->referenced.store(0, std::memory_order_relaxed);
+}
+
+// frames from the tail of the queue
+void queue_evict_order(buffer_partition_t *partition, int queue, int n,
+                       std::vector<frame_t *> *frames) {
+  for (auto *iter = partition->queues[queue].tail;
+       iter != NULL && (int)frames->size() < n; iter = iter->prev)
+    frames->push_back(iter);
+}
+
+// LRU-K evicts from the tail as well, frames referenced once go first
+void lru_evict_order(buffer_partition_t *partition, int n,
+                     std::vector<frame_t *> *frames) {
+  queue_evict_order(partition, kMainQueue, n, frames);
+}
+
+// half from A1in, which is evicted first while it is large
+void two_q_evict_order(buffer_partition_t *partition, int n,
+                       std::vector<frame_t *> *frames) {
+  queue_evict_order(partition, kInQueue, n / 2, frames);
+  queue_evict_order(partition, kMainQueue, n, frames);
+}
+
+// frames from the hand
+void clock_evict_order(buffer_partition_t *partition, int n,
+                       std::vector<frame_t *> *frames) {
+  n = std::min<int>(n, partition->num_frames);
+  for (int i = 0; i < n; ++i) {
+    frames->push_back(
+        &partition->first_frame[(partition->hand + i) % partition->num_frames]);
+  }
+}
+
+const replacement_policy_t kReplacementPolicies[] = {
+    {lru_access, NULL, lru_victim, lru_demote, NULL, lru_evict_order},
+    {lru_k_access, NULL, lru_k_victim, lru_k_demote, NULL, lru_evict_order},
+    {two_q_access, NULL, two_q_victim, two_q_demote, two_q_evicted,
+     two_q_evict_order},
+    {clock_access, clock_touch, clock_victim, clock_demote, NULL,
+     clock_evict_order},
+};
+
+uint64_t frame_page_lsn(const frame_t *frame) {
+  uint64_t lsn;
+  memcpy(&lsn, frame->frame->data + kPageLsnOffset, sizeof(lsn));
+  return lsn;
+}
+
+int write_back_frame(frame_t *frame) {
+  // flush logs of the page first
+  if (frame_page_lsn(frame) > get_flushed_lsn() && flush_log()) {
+    LOG_ERR(3, "failed to flush logs");
+    return 1;
+  }
+  file_write_page(frame_table_id(frame), frame_page_num(frame), frame->frame);
+  return 0;
+}
+
+int clean_partition(buffer_partition_t *partition) {
+  std::vector<frame_t *> candidates, dirty_frames;
+  pthread_mutex_lock(&partition->latch);
+  policy->evict_order(partition, clean_target, &candidates);
+  for (auto *frame : candidates) {
+    if (frame->is_dirty && frame_table_id(frame) >= 0)
+      dirty_frames.push_back(frame);
+  }
+  pthread_mutex_unlock(&partition->latch);
+  if (dirty_frames.empty()) return 0;
+
+  // images are copied under shared latch and written without any latch,
+  // so writers are only kept off while a page is copied
+  byte *images = NULL;
+  if (posix_memalign((void **)&images, kPageSize,
+                     dirty_frames.size() * kMaxPageSize)) {
+    LOG_WARN("failed to allocate images of dirty frames");
+    return 0;
+  }
+  std::vector<file_io_request_t> reqs;
+  std::vector<frame_t *> written_frames;
+  std::vector<uint64_t> versions;
+  uint64_t max_page_lsn = 0, offset = 0;
+  for (auto *frame : dirty_frames) {
+    if (try_latch_frame(frame, true)) continue;
+    if (!frame->is_dirty || frame_table_id(frame) < 0) {
+      unlatch_frame(frame);
+      continue;
+    }
+    file_io_request_t req;
+    memset(&req, 0, sizeof(file_io_request_t));
+    req.table_id = frame_table_id(frame);
+    req.pagenum = frame_page_num(frame);
+    req.page = (page_t *)(images + offset);
+    req.is_write = true;
+    memcpy(req.page, frame->frame, frame->frame_size);
+    offset += frame->frame_size;
+    // exclusive pins bump the version, so it tells if the page is
+    // modified (or replaced) after the copy
+    versions.push_back(frame->version.load(std::memory_order_relaxed));
+    unlatch_frame(frame);
+    uint64_t page_lsn;
+    memcpy(&page_lsn, req.page->data + kPageLsnOffset, sizeof(page_lsn));
+    max_page_lsn = std::max(max_page_lsn, page_lsn);
+    reqs.push_back(req);
+    written_frames.push_back(frame);
+  }
+  if (reqs.empty()) {
+    free(images);
+    return 0;
+  }
+
+  // WAL, logs of the pages are flushed first
+  if (max_page_lsn > get_flushed_lsn() && flush_log()) {
+    free(images);
+    LOG_ERR(3, "failed to flush logs");
+    return 0;
+  }
+  // batched writes are synced by the double-write area or file_sync_all
+  if (file_io_submit(reqs.data(), reqs.size()) ||
+      file_io_wait(reqs.data(), reqs.size())) {
+    free(images);
+    LOG_ERR(3, "failed to write back dirty frames");
+    return 0;
+  }
+  free(images);
+
+  // frames modified after the copy stay dirty
+  int num_cleaned = 0;
+  for (size_t i = 0; i < written_frames.size(); ++i) {
+    auto *frame = written_frames[i];
+    if (try_latch_frame(frame, true)) continue;
+    if (frame->version.load(std::memory_order_relaxed) == versions[i]) {
+      frame->is_dirty = false;
+      ++num_cleaned;
+    }
+    unlatch_frame(frame);
+  }
+  pthread_cond_broadcast(&partition->wait_for_free_frame);
+  return num_cleaned;
+}
+
+void *cleaner_thread(void *arg) {
+  auto cleaner_id = (int)(intptr_t)arg;
+  int num_cleaners = cleaners.size();
+  pthread_mutex_lock(&cleaner_latch);
+  while (!cleaners_stopping) {
+    pthread_mutex_unlock(&cleaner_latch);
+    int num_cleaned = 0;
+    for (int p = cleaner_id; p < num_partitions; p += num_cleaners)
+      num_cleaned += clean_partition(&partitions[p]);
+    pthread_mutex_lock(&cleaner_latch);
+    if (num_cleaned > 0 || cleaners_stopping) continue;
+
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += kCleanerIntervalMs * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&cleaner_wakeup, &cleaner_latch, &deadline);
+  }
+  pthread_mutex_unlock(&cleaner_latch);
+  return NULL;
+}
+
+void start_cleaners() {
+  pthread_mutex_lock(&cleaner_latch);
+  cleaners_stopping = false;
+  clean_target = clean_target_setting;
+  cleaners.resize(num_cleaners_setting);
+  pthread_mutex_unlock(&cleaner_latch);
+  for (int i = 0; i < (int)cleaners.size(); ++i) {
+    if (pthread_create(&cleaners[i], NULL, cleaner_thread,
+                       (void *)(intptr_t)i)) {
+      LOG_ERR(3, "failed to create page cleaner, %s", strerror(errno));
+      return;
+    }
+  }
+}
+
+void stop_cleaners() {
+  pthread_mutex_lock(&cleaner_latch);
+  cleaners_stopping = true;
+  pthread_cond_broadcast(&cleaner_wakeup);
+  pthread_mutex_unlock(&cleaner_latch);
+  for (auto &cleaner : cleaners) pthread_join(cleaner, NULL);
+  cleaners.clear();
+}
+
+void read_ahead_chain(const read_ahead_request_t &req) {
+  // compaction truncates the table under exclusive table latch, so the
+  // size checked below holds while the pages are loaded
+  latch_table_shared(req.table_id);
+  auto page_size = file_page_size(req.table_id);
+  auto pagenum = req.pagenum;
+  for (int i = 0; i < req.num_pages && pagenum != 0; ++i) {
+    auto *partition = page_partition(req.table_id, pagenum);
+    pthread_mutex_lock(&partition->latch);
+    auto *frame = find_frame(req.table_id, pagenum);
+    if (frame != NULL) {
+      // pages of the chain are only read, writers are not waited for
+      if (try_latch_frame(frame, true)) {
+        pthread_mutex_unlock(&partition->latch);
+        break;
+      }
+    } else {
+      // link of a stale page may point beyond the file
+      if (pagenum >= file_size(req.table_id) / page_size) {
+        pthread_mutex_unlock(&partition->latch);
+        break;
+      }
+      frame = buffer_load_page(req.table_id, pagenum, true);
+      if (frame == NULL) {
+        pthread_mutex_unlock(&partition->latch);
+        break;
+      }
+      policy->access(frame, false);
+    }
+    pthread_mutex_unlock(&partition->latch);
+
+    frame->read_ahead.store(1, std::memory_order_relaxed);
+    pagenum = req.next(frame->frame);
+    unlatch_frame(frame);
+    pthread_cond_signal(&partition->wait_for_free_frame);
+  }
+  unlatch_table(req.table_id);
+}
+
+void *read_ahead_thread_func(void *) {
+  pthread_mutex_lock(&read_ahead_latch);
+  while (!read_ahead_stopping) {
+    if (read_ahead_requests.empty()) {
+      pthread_cond_wait(&read_ahead_wakeup, &read_ahead_latch);
+      continue;
     }
+    auto req = read_ahead_requests.front();
+    read_ahead_requests.pop_front();
+    pthread_mutex_unlock(&read_ahead_latch);
+    read_ahead_chain(req);
+    pthread_mutex_lock(&read_ahead_latch);
   }
-  // if node is tail, then do nothing
+  pthread_mutex_unlock(&read_ahead_latch);
+  return NULL;
+}
+
+void start_read_ahead() {
+  // a window takes a quarter of the pool at most
+  max_read_ahead = std::min(max_read_ahead_setting, num_frames / 4);
+  if (max_read_ahead == 0) return;
+  read_ahead_stopping = false;
+  if (pthread_create(&read_ahead_thread, NULL, read_ahead_thread_func, NULL)) {
+    LOG_ERR(3, "failed to create read-ahead thread, %s", strerror(errno));
+    return;
+  }
+  read_ahead_running = true;
+}
+
+void stop_read_ahead() {
+  if (!read_ahead_running) return;
+  pthread_mutex_lock(&read_ahead_latch);
+  read_ahead_stopping = true;
+  read_ahead_requests.clear();
+  pthread_cond_signal(&read_ahead_wakeup);
+  pthread_mutex_unlock(&read_ahead_latch);
+  pthread_join(read_ahead_thread, NULL);
+  read_ahead_running = false;
+  max_read_ahead = 0;
 }
 
 int init_buffer_manager(int num_buf) {
@@ -312,116 +1285,300 @@ int init_buffer_manager(int num_buf) {
     LOG_ERR(3, "invalid parameters");
     return 1;
   }
+  // writers (and eviction) are not starved by readers of hot pages
+  pthread_rwlockattr_t latch_attr;
+  pthread_rwlockattr_init(&latch_attr);
+  pthread_rwlockattr_setkind_np(&latch_attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
 
   pthread_mutex_lock(&buffer_manager_latch);
-  frames = (frame_t *)malloc(num_buf * sizeof(frame_t));
-  if (frames == NULL) {
+  // frames (and page data) up to the max size are allocated at once, the
+  // page data of ones not in use is not touched
+  int max_num_buf = std::max(num_buf, max_frames_setting);
+  if (posix_memalign((void **)&frames, alignof(frame_t),
+                     max_num_buf * sizeof(frame_t))) {
     LOG_ERR(3, "failed to allocate buffer frames");
     return 1;
   }
-
-  head = frames;
-  tail = &frames[num_buf - 1];
+  page_arena = map_page_arena((uint64_t)max_num_buf * kPageSize);
+  if (page_arena == NULL) {
+    LOG_ERR(3, "failed to map page arena, %s", strerror(errno));
+    return 1;
+  }
+  large_page_arena_size = (uint64_t)max_num_buf * kMaxPageSize;
+  large_page_arena =
+      (byte *)mmap(NULL, large_page_arena_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (large_page_arena == MAP_FAILED) {
+    large_page_arena = NULL;
+    LOG_ERR(3, "failed to map large page arena, %s", strerror(errno));
+    return 1;
+  }
+  num_frames = max_num_buf;
+  policy = &kReplacementPolicies[replacement_policy];
+  swizzling = swizzling_setting;
+  num_partitions = std::max(
+      1, std::min(kMaxBufferPartitions, num_buf / kMinPartitionFrames));
+  partitions = new buffer_partition_t[num_partitions];
 
   // initialize as empty frame and create list
-  for (int i = 0; i < num_buf; ++i) {
-    frames[i].table_id = -1;
-    frames[i].page_num = 0;
-    frames[i].is_dirty = false;
-    frames[i].page_latch = PTHREAD_MUTEX_INITIALIZER;
-    frames[i].next = i + 1 < num_buf ? &frames[i + 1] : NULL;
-    frames[i].prev = i - 1 < 0 ? NULL : &frames[i - 1];
-  }
-  pthread_mutex_lock(&frame_map_latch);
-  frame_map.clear();
-  cache_size = num_buf;
-  frame_cache = (frame_t **)malloc(sizeof(frame_t *) * cache_size);
-  memset(frame_cache, 0, sizeof(frame_t *) * cache_size);
-  pthread_mutex_unlock(&frame_map_latch);
+  // frames are dealt out to partitions in contiguous runs, of which the
+  // first ones are in use
+  for (int p = 0; p < num_partitions; ++p) {
+    auto &partition = partitions[p];
+    int first = (int64_t)max_num_buf * p / num_partitions;
+    int end = (int64_t)max_num_buf * (p + 1) / num_partitions;
+    int last = first + (int64_t)num_buf * (p + 1) / num_partitions -
+               (int64_t)num_buf * p / num_partitions;
+    auto &queue = partition.queues[kMainQueue];
+    queue.head = &frames[first];
+    queue.tail = &frames[last - 1];
+    queue.size = last - first;
+    for (int i = first; i < end; ++i) {
+      frames[i].frame = &page_arena[i];
+      frames[i].frame_size = kPageSize;
+      set_frame_page(&frames[i], -1, 0);
+      frames[i].is_dirty = false;
+      pthread_rwlock_init(&frames[i].page_latch, &latch_attr);
+      frames[i].partition = &partition;
+      frames[i].queue = kMainQueue;
+      memset(frames[i].history, 0, sizeof(frames[i].history));
+      frames[i].referenced.store(0, std::memory_order_relaxed);
+      frames[i].read_ahead.store(0, std::memory_order_relaxed);
+      frames[i].children.store(NULL, std::memory_order_relaxed);
+      frames[i].version.store(0, std::memory_order_relaxed);
+      frames[i].next = i + 1 < last ? &frames[i + 1] : NULL;
+      frames[i].prev = i - 1 < first || i >= last ? NULL : &frames[i - 1];
+    }
+    partition.first_frame = &frames[first];
+    partition.num_frames = last - first;
+    partition.max_frames = end - first;
+    if (page_table_init(&partition.page_table, partition.max_frames)) {
+      LOG_ERR(3, "failed to allocate page table");
+      return 1;
+    }
+  }
+  pthread_rwlockattr_destroy(&latch_attr);
+  start_cleaners();
+  start_read_ahead();
   pthread_mutex_unlock(&buffer_manager_latch);
   return 0;
 }
 
+void latch_all_partitions() {
+  for (int p = 0; p < num_partitions; ++p)
+    pthread_mutex_lock(&partitions[p].latch);
+}
+
+void unlatch_all_partitions() {
+  for (int p = num_partitions - 1; p >= 0; --p)
+    pthread_mutex_unlock(&partitions[p].latch);
+}
+
+int write_back_dirty_frames() {
+  std::vector<file_io_request_t> reqs;
+  for (int i = 0; i < num_frames; ++i) {
+    auto *iter = &frames[i];
+    if (!iter->is_dirty) continue;
+    file_io_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.table_id = frame_table_id(iter);
+    req.pagenum = frame_page_num(iter);
+    req.page = iter->frame;
+    req.is_write = true;
+    reqs.push_back(req);
+  }
+  if (file_io_submit(reqs.data(), reqs.size()) ||
+      file_io_wait(reqs.data(), reqs.size())) {
+    LOG_ERR(3, "failed to write back dirty frames");
+    return 1;
+  }
+  file_sync_all();
+  return 0;
+}
+
 int free_buffer_manager() {
   pthread_mutex_lock(&buffer_manager_latch);
+  stop_read_ahead();
+  stop_cleaners();
+  latch_all_partitions();
   // write all dirty frames
-  auto iter = head;
-  for (auto iter = head; iter != NULL; iter = iter->next) {
-    if (iter->is_dirty)
-      file_write_page(iter->table_id, iter->page_num, &iter->frame);
-    if (pthread_mutex_destroy(&iter->page_latch)) {
+  write_back_dirty_frames();
+  for (int i = 0; i < num_frames; ++i) {
+    if (pthread_rwlock_destroy(&frames[i].page_latch)) {
       LOG_WARN("failed to destroy page latch, %s", strerror(errno));
     }
+    delete[] frames[i].children.load(std::memory_order_relaxed);
   }
+  unlatch_all_partitions();
+  pthread_mutex_lock(&spare_children_latch);
+  for (auto *children : spare_children) delete[] children;
+  spare_children.clear();
+  pthread_mutex_unlock(&spare_children_latch);
 
   // free resources
   if (frames != NULL) free(frames);
-  pthread_mutex_lock(&frame_map_latch);
-  frame_map.clear();
-  if (frame_cache != NULL) free(frame_cache);
-  pthread_mutex_unlock(&frame_map_latch);
+  unmap_page_arena();
+  frames = NULL;
+  num_frames = 0;
+  for (int p = 0; p < num_partitions; ++p) {
+    auto &partition = partitions[p];
+    page_table_free(&partition.page_table);
+    pthread_mutex_destroy(&partition.latch);
+    pthread_cond_destroy(&partition.wait_for_free_frame);
+  }
+  delete[] partitions;
+  partitions = NULL;
+  num_partitions = 0;
   pthread_mutex_unlock(&buffer_manager_latch);
-
-  pthread_mutex_destroy(&frame_map_latch);
-  pthread_mutex_destroy(&buffer_manager_latch);
-  pthread_cond_destroy(&wait_for_free_frame);
   return 0;
 }
 
-pagenum_t buffer_alloc_page(int64_t table_id) {
-  if (table_id < 0) {
-    LOG_ERR(3, "invalid parameters");
-    return 0;
+// space map callbacks of buffer_grow_space_maps
+space_map_page_t *pin_space_map(int64_t table_id, uint64_t group,
+                                 bool is_new) {
+  auto *space_map = buffer_get_page_ptr<space_map_page_t>(
+      table_id, space_map_pagenum(group));
+  if (is_new) {
+    // group may be cut off by compaction before, so page patch logs on
+    // the old space map should not be redone on the new one
+    space_map_init(space_map, group);
+    space_map->space_map.page_lsn = get_last_lsn();
   }
+  return space_map;
+}
 
+void unpin_space_map(int64_t, uint64_t, space_map_page_t *space_map) {
+  set_dirty(space_map);
+  unpin(space_map);
+}
+
+int buffer_grow_space_maps(int64_t table_id) {
   auto *header_page =
       buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
-  if (header_page->header.first_free_page == 0) {
-    pagenum_t start = 0, end = 0;
-    uint64_t num_new_pages = 0;
-    if (file_expand_twice(table_id, &start, &end, &num_new_pages) ||
-        start == 0) {
-      unpin(header_page);
-      LOG_ERR(3, "failed to expand file");
-      return 0;
-    }
-    // connect expanded list into header page
-    header_page->header.first_free_page = start;
-    header_page->header.num_of_pages += num_new_pages;
+  // someone may grow the file or free a page while waiting for the latch
+  if (file_find_free_space_map(table_id, 0) >= 0) {
+    unpin(header_page);
+    return 0;
   }
 
-  auto result = header_page->header.first_free_page;
-  auto *allocated_page = buffer_get_page_ptr<page_node_t>(table_id, result);
-  header_page->header.first_free_page = allocated_page->next_free_page;
-  unpin(allocated_page);
-
+  auto num_of_pages =
+      file_grow_space_maps(table_id, header_page->header.num_of_pages,
+                           pin_space_map, unpin_space_map);
+  if (num_of_pages == 0) {
+    unpin(header_page);
+    return 1;
+  }
+  header_page->header.num_of_pages = num_of_pages;
   set_dirty(header_page);
   unpin(header_page);
-  return result;
+  return 0;
+}
+
+pagenum_t buffer_alloc_page(int64_t table_id, pagenum_t hint) {
+  if (table_id < 0) {
+    LOG_ERR(3, "invalid parameters");
+    return 0;
+  }
+  if (file_is_read_only(table_id)) {
+    LOG_WARN("cannot allocate a page of read-only table %lld", table_id);
+    return 0;
+  }
+
+  // only the space map page of the chosen group is latched, so allocations
+  // in different groups do not block each other
+  while (true) {
+    auto group = file_find_free_space_map(table_id, space_map_group(hint));
+    if (group < 0) {
+      if (buffer_grow_space_maps(table_id)) {
+        LOG_ERR(3, "failed to expand file");
+        return 0;
+      }
+      continue;
+    }
+
+    auto *space_map = buffer_get_page_ptr<space_map_page_t>(
+        table_id, space_map_pagenum(group));
+    auto pagenum = file_take_free_page(table_id, space_map, group, hint);
+    if (pagenum == 0) {  // someone took the last free page of the group
+      unpin(space_map);
+      continue;
+    }
+    set_dirty(space_map);
+    unpin(space_map);
+    return pagenum;
+  }
 }
 
 void buffer_free_page(int64_t table_id, pagenum_t pagenum) {
-  if (table_id < 0 || pagenum < 1) {
+  auto group = space_map_group(pagenum);
+  if (table_id < 0 || pagenum < 1 || pagenum == space_map_pagenum(group)) {
     LOG_ERR(3, "invalid parameters");
     return;
   }
+  if (file_is_read_only(table_id)) {
+    LOG_WARN("cannot free a page of read-only table %lld", table_id);
+    return;
+  }
 
-  auto *header_page =
-      buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
-  auto *page_node = buffer_get_page_ptr<page_node_t>(table_id, pagenum);
+  auto *space_map = buffer_get_page_ptr<space_map_page_t>(
+      table_id, space_map_pagenum(group));
+  if (!file_give_back_page(table_id, space_map, pagenum)) {
+    unpin(space_map);
+    LOG_WARN("page %llu of table %lld is not in use", pagenum, table_id);
+    return;
+  }
+  set_dirty(space_map);
+  unpin(space_map);
 
-  page_node->next_free_page = header_page->header.first_free_page;
-  header_page->header.first_free_page = pagenum;
+  auto *partition = page_partition(table_id, pagenum);
+  pthread_mutex_lock(&partition->latch);
+  auto freed_frame = find_frame(table_id, pagenum);
+  if (freed_frame != NULL) policy->demote(freed_frame);
+  pthread_mutex_unlock(&partition->latch);
+}
 
-  set_dirty(header_page);
-  set_dirty(page_node);
-  unpin(header_page);
-  unpin(page_node);
+int buffer_discard_pages(int64_t table_id, pagenum_t first_pagenum) {
+  if (table_id < 0) {
+    LOG_ERR(3, "invalid parameters");
+    return 1;
+  }
 
   pthread_mutex_lock(&buffer_manager_latch);
-  auto freed_frame = find_frame(table_id, pagenum);
-  if (freed_frame != NULL) set_LRU_tail(freed_frame);
+  latch_all_partitions();
+  // pages of the cut off tail are free, but someone may still read one
+  std::vector<frame_t *> discarded;
+  int result = 0;
+  for (int i = 0; i < num_frames; ++i) {
+    auto *iter = &frames[i];
+    if (frame_table_id(iter) != table_id ||
+        frame_page_num(iter) < first_pagenum)
+      continue;
+    if (try_latch_frame(iter)) {
+      result = 1;
+      break;
+    }
+    discarded.push_back(iter);
+  }
+
+  for (auto *frame : discarded) {
+    if (result == 0) {
+      erase_frame(frame);
+      set_frame_page(frame, -1, 0);
+      frame->is_dirty = false;
+      frame->read_ahead.store(0, std::memory_order_relaxed);
+      release_children(frame);
+      policy->demote(frame);
+    }
+    unlatch_frame(frame);
+  }
+  unlatch_all_partitions();
   pthread_mutex_unlock(&buffer_manager_latch);
+  if (result == 0) {
+    for (int p = 0; p < num_partitions; ++p)
+      pthread_cond_broadcast(&partitions[p].wait_for_free_frame);
+  }
+  return result;
 }
 
 void buffer_read_page(int64_t table_id, pagenum_t pagenum, page_t *dest) {
@@ -439,7 +1596,8 @@ void buffer_read_header_page(int64_t table_id, header_page_t *dest) {
     return;
   }
 
-  __buffer_read_page(table_id, kHeaderPagenum, (page_t *)dest);
+  __buffer_read_page(table_id, kHeaderPagenum, (page_t *)dest,
+                     sizeof(header_page_t));
 }
 
 void buffer_write_page(int64_t table_id, pagenum_t pagenum, const page_t *src) {
@@ -457,7 +1615,8 @@ void buffer_write_header_page(int64_t table_id, const header_page_t *src) {
     return;
   }
 
-  __buffer_write_page(table_id, kHeaderPagenum, (page_t *)src);
+  __buffer_write_page(table_id, kHeaderPagenum, (page_t *)src,
+                      sizeof(header_page_t));
 }
 
 void unpin(int64_t table_id, pagenum_t pagenum) {
@@ -474,13 +1633,14 @@ void unpin(page_t *page) {
     LOG_ERR(3, "invalid parameters");
     return;
   }
+  if (!is_frame_page(page)) return;  // mapped pages are not pinned
 
-  frame_t *frame = (frame_t *)page;
-  if (pthread_mutex_unlock(&frame->page_latch)) {
+  frame_t *frame = page_to_frame(page);
+  if (unlatch_frame(frame)) {
     LOG_ERR(3, "failed to unlock page latch");
     return;
   }
-  pthread_cond_signal(&wait_for_free_frame);
+  pthread_cond_signal(&frame->partition->wait_for_free_frame);
 }
 
 void unpin_header(int64_t table_id) {
@@ -494,25 +1654,373 @@ void unpin_header(int64_t table_id) {
 
 int count_free_frames() {
   pthread_mutex_lock(&buffer_manager_latch);
+  latch_all_partitions();
   int result = 0;
-  for (auto iter = head; iter != NULL; iter = iter->next) {
-    if (pthread_mutex_trylock(&iter->page_latch) == 0) {
-      ++result;
-      pthread_mutex_unlock(&iter->page_latch);
+  for (int p = 0; p < num_partitions; ++p) {
+    for (uint32_t i = 0; i < partitions[p].num_frames; ++i) {
+      auto *frame = &partitions[p].first_frame[i];
+      if (try_latch_frame(frame) == 0) {
+        ++result;
+        unlatch_frame(frame);
+      }
     }
   }
+  unlatch_all_partitions();
   pthread_mutex_unlock(&buffer_manager_latch);
   return result;
 }
 
-int buffer_flush_all_frames() {
+int buffer_num_partitions() { return num_partitions; }
+
+int buffer_page_arena_kind() { return page_arena_kind; }
+
+const page_t *read_frame_optimistic(frame_t *frame, int64_t table_id,
+                                    pagenum_t pagenum, uint64_t *version) {
+  *version = frame->version.load(std::memory_order_acquire);
+  // the frame may be replaced after it is found, its page is checked after
+  // the version is taken. data of large pages is given back when the frame
+  // holds a page of kPageSize again, so only pages in page_arena are read
+  if ((*version & 1) || frame_table_id(frame) != table_id ||
+      frame_page_num(frame) != pagenum || frame->frame_size != kPageSize)
+    return NULL;
+  mark_referenced(frame);
+  return &page_arena[frame - frames];
+}
+
+const page_t *buffer_read_optimistic(int64_t table_id, pagenum_t pagenum,
+                                     uint64_t *version) {
+  if (table_id < 0 || version == NULL) {
+    LOG_ERR(3, "invalid parameters");
+    return NULL;
+  }
+  if (file_is_read_only(table_id)) return NULL;
+
+  auto *frame = find_frame(table_id, pagenum);
+  if (frame == NULL) return NULL;
+  return read_frame_optimistic(frame, table_id, pagenum, version);
+}
+
+std::atomic<frame_t *> *frame_children(frame_t *frame) {
+  auto *children = frame->children.load(std::memory_order_acquire);
+  if (children != NULL) return children;
+  pthread_mutex_lock(&spare_children_latch);
+  if (!spare_children.empty()) {
+    children = spare_children.back();
+    spare_children.pop_back();
+  }
+  pthread_mutex_unlock(&spare_children_latch);
+  if (children == NULL) {
+    children = new (std::nothrow) std::atomic<frame_t *>[kMaxSwizzledLinks];
+    if (children == NULL) return NULL;
+    for (int i = 0; i < kMaxSwizzledLinks; ++i)
+      children[i].store(NULL, std::memory_order_relaxed);
+  }
+  // readers of the parent race to swizzle its first link
+  std::atomic<frame_t *> *expected = NULL;
+  if (!frame->children.compare_exchange_strong(expected, children,
+                                               std::memory_order_acq_rel)) {
+    pthread_mutex_lock(&spare_children_latch);
+    spare_children.push_back(children);
+    pthread_mutex_unlock(&spare_children_latch);
+    return expected;
+  }
+  return children;
+}
+
+void release_children(frame_t *frame) {
+  auto *children = frame->children.exchange(NULL, std::memory_order_acq_rel);
+  if (children == NULL) return;
+  for (int i = 0; i < kMaxSwizzledLinks; ++i)
+    children[i].store(NULL, std::memory_order_relaxed);
+  pthread_mutex_lock(&spare_children_latch);
+  spare_children.push_back(children);
+  pthread_mutex_unlock(&spare_children_latch);
+}
+
+const page_t *buffer_read_child_optimistic(const page_t *parent, int link,
+                                           int64_t table_id,
+                                           pagenum_t pagenum,
+                                           uint64_t *version) {
+  if (!swizzling || parent < page_arena || parent >= page_arena + num_frames ||
+      link < 0 || link >= kMaxSwizzledLinks)
+    return buffer_read_optimistic(table_id, pagenum, version);
+  if (table_id < 0 || version == NULL) {
+    LOG_ERR(3, "invalid parameters");
+    return NULL;
+  }
+
+  auto *children = frame_children(&frames[parent - page_arena]);
+  if (children == NULL)
+    return buffer_read_optimistic(table_id, pagenum, version);
+  auto *frame = children[link].load(std::memory_order_relaxed);
+  if (frame != NULL && frame_table_id(frame) == table_id &&
+      frame_page_num(frame) == pagenum) {
+    frame->partition->swizzle_hits.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    // stale or not swizzled yet, swizzle the cached child
+    if (file_is_read_only(table_id)) return NULL;
+    frame = find_frame(table_id, pagenum);
+    if (frame == NULL) return NULL;
+    children[link].store(frame, std::memory_order_relaxed);
+    frame->partition->swizzle_misses.fetch_add(1, std::memory_order_relaxed);
+  }
+  return read_frame_optimistic(frame, table_id, pagenum, version);
+}
+
+bool buffer_validate_page(const page_t *page, uint64_t version) {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return frames[page - page_arena].version.load(std::memory_order_relaxed) ==
+         version;
+}
+
+int buffer_set_replacement_policy(int policy_id) {
+  if (policy_id < 0 || policy_id >= kNumReplacementPolicies) {
+    LOG_WARN("invalid replacement policy %d", policy_id);
+    return 1;
+  }
+  replacement_policy = policy_id;
+  return 0;
+}
+
+int buffer_set_page_cleaners(int num_cleaners, int clean_target) {
+  if (num_cleaners < 0 || clean_target < 0) {
+    LOG_WARN("invalid page cleaner setting (%d cleaners, %d frames)",
+             num_cleaners, clean_target);
+    return 1;
+  }
+  num_cleaners_setting = num_cleaners;
+  clean_target_setting = clean_target;
+  return 0;
+}
+
+void buffer_read_ahead(page_t *page, buffer_next_page_t next) {
+  if (page == NULL || next == NULL) {
+    LOG_ERR(3, "invalid parameters");
+    return;
+  }
+  if (max_read_ahead == 0 || !is_frame_page(page)) return;
+
+  auto *frame = page_to_frame(page);
+  auto &stream = read_ahead_stream;
+  auto passed = frame->read_ahead.exchange(0, std::memory_order_relaxed);
+  auto next_pagenum = next(page);
+  if (frame_table_id(frame) != stream.table_id ||
+      frame_page_num(frame) != stream.expected) {
+    // another walk, read ahead from its next step
+    stream = read_ahead_stream_t();
+    stream.table_id = frame_table_id(frame);
+    stream.expected = next_pagenum;
+    stream.window = std::min(kMinReadAheadWindow, max_read_ahead);
+    return;
+  }
+  stream.expected = next_pagenum;
+  if (stream.ahead > 0) {
+    --stream.ahead;
+    ++(passed ? stream.hits : stream.misses);
+  }
+  if (next_pagenum == 0 || stream.ahead > stream.window / 2)
+    return;
+
+  // adapt the window to the hit rate of the last one
+  if (stream.hits + stream.misses > 0) {
+    if (stream.misses == 0)
+      stream.window = std::min(stream.window * 2, max_read_ahead);
+    else if (stream.hits < stream.misses)
+      stream.window = std::max(stream.window / 2,
+                               std::min(kMinReadAheadWindow, max_read_ahead));
+  }
+  stream.hits = stream.misses = 0;
+  stream.ahead = stream.window;
+
+  pthread_mutex_lock(&read_ahead_latch);
+  if ((int)read_ahead_requests.size() < kMaxReadAheadRequests) {
+    read_ahead_requests.push_back(
+        {frame_table_id(frame), next_pagenum, stream.window, next});
+    pthread_cond_signal(&read_ahead_wakeup);
+  }
+  pthread_mutex_unlock(&read_ahead_latch);
+}
+
+int grow_partition(buffer_partition_t *partition, uint32_t num_frames) {
+  while (true) {
+    pthread_mutex_lock(&partition->latch);
+    if (partition->num_frames >= num_frames) break;
+    // new frame is free, it is taken by the next miss
+    auto *frame = &partition->first_frame[partition->num_frames++];
+    auto &queue = partition->queues[kMainQueue];
+    frame->queue = kMainQueue;
+    frame->next = NULL;
+    frame->prev = queue.tail;
+    if (queue.tail != NULL)
+      queue.tail->next = frame;
+    else
+      queue.head = frame;
+    queue.tail = frame;
+    ++queue.size;
+    pthread_mutex_unlock(&partition->latch);
+    pthread_cond_signal(&partition->wait_for_free_frame);
+  }
+  pthread_mutex_unlock(&partition->latch);
+  return 0;
+}
+
+int shrink_partition(buffer_partition_t *partition, uint32_t num_frames) {
+  pthread_mutex_lock(&partition->latch);
+  auto old_num_frames = partition->num_frames;
+  int result = 0, retries = 0;
+  while (partition->num_frames > num_frames) {
+    // the last frame in use is removed, after its pin is released
+    auto *frame = &partition->first_frame[partition->num_frames - 1];
+    if (try_latch_frame(frame)) {
+      if (++retries > kResizeRetries) {
+        LOG_WARN("page %llu of table %lld is pinned, partition is shrunk to "
+                 "%u frames",
+                 frame_page_num(frame), frame_table_id(frame),
+                 partition->num_frames);
+        result = 1;
+        break;
+      }
+      pthread_mutex_unlock(&partition->latch);
+      usleep(kResizeRetryUs);
+      pthread_mutex_lock(&partition->latch);
+      continue;
+    }
+    retries = 0;
+    if (frame->is_dirty && write_back_frame(frame)) {
+      unlatch_frame(frame);
+      result = 1;
+      break;
+    }
+    erase_frame(frame);
+    unlink_frame(frame);
+    set_frame_page(frame, -1, 0);
+    frame->is_dirty = false;
+    frame->referenced.store(0, std::memory_order_relaxed);
+    frame->read_ahead.store(0, std::memory_order_relaxed);
+    memset(frame->history, 0, sizeof(frame->history));
+    release_children(frame);
+    resize_frame(frame, kPageSize);
+    --partition->num_frames;
+    if (partition->hand >= partition->num_frames) partition->hand = 0;
+    unlatch_frame(frame);
+
+    // frames are removed one by one, hits and misses go in between
+    pthread_mutex_unlock(&partition->latch);
+    pthread_mutex_lock(&partition->latch);
+  }
+  auto new_num_frames = partition->num_frames;
+  pthread_mutex_unlock(&partition->latch);
+
+  // give page data of removed frames back (optimistic readers of them see
+  // zero pages, which fail validation)
+  if (old_num_frames > new_num_frames) {
+    auto *removed =
+        &page_arena[partition->first_frame - frames + new_num_frames];
+    madvise(removed, (old_num_frames - new_num_frames) * kPageSize,
+            MADV_DONTNEED);
+  }
+  return result;
+}
+
+int buffer_resize(int num_buf) {
   pthread_mutex_lock(&buffer_manager_latch);
-  auto iter = head;
-  for (auto iter = head; iter != NULL; iter = iter->next) {
-    if (iter->is_dirty)
-      file_write_page(iter->table_id, iter->page_num, &iter->frame, false);
+  if (num_buf > num_frames ||
+      num_buf < num_partitions * kMinResizedPartitionFrames) {
+    LOG_WARN("cannot resize buffer pool to %d frames (%d to %d)", num_buf,
+             num_partitions * kMinResizedPartitionFrames, num_frames);
+    pthread_mutex_unlock(&buffer_manager_latch);
+    return 1;
+  }
+  // frames are dealt out to partitions the same way as in init
+  int result = 0;
+  for (int p = 0; p < num_partitions && result == 0; ++p) {
+    uint32_t partition_frames = (int64_t)num_buf * (p + 1) / num_partitions -
+                                (int64_t)num_buf * p / num_partitions;
+    if (partition_frames > partitions[p].num_frames)
+      result = grow_partition(&partitions[p], partition_frames);
+    else
+      result = shrink_partition(&partitions[p], partition_frames);
+  }
+  pthread_mutex_unlock(&buffer_manager_latch);
+  return result;
+}
+
+int buffer_pool_size() {
+  pthread_mutex_lock(&buffer_manager_latch);
+  int result = 0;
+  for (int p = 0; p < num_partitions; ++p) {
+    pthread_mutex_lock(&partitions[p].latch);
+    result += partitions[p].num_frames;
+    pthread_mutex_unlock(&partitions[p].latch);
   }
-  file_sync_all();
   pthread_mutex_unlock(&buffer_manager_latch);
+  return result;
+}
+
+int buffer_set_max_frames(int max_num_buf) {
+  if (max_num_buf < 0) {
+    LOG_WARN("invalid max buffer pool size %d", max_num_buf);
+    return 1;
+  }
+  max_frames_setting = max_num_buf;
+  return 0;
+}
+
+int buffer_set_pointer_swizzling(int enabled) {
+  swizzling_setting = enabled;
   return 0;
+}
+
+int buffer_set_read_ahead(int max_window) {
+  if (max_window < 0) {
+    LOG_WARN("invalid read-ahead window %d", max_window);
+    return 1;
+  }
+  max_read_ahead_setting = max_window;
+  return 0;
+}
+
+void buffer_get_hit_stats(uint64_t *hits, uint64_t *misses) {
+  pthread_mutex_lock(&buffer_manager_latch);
+  uint64_t num_hits = 0, num_misses = 0;
+  for (int p = 0; p < num_partitions; ++p) {
+    num_hits += partitions[p].hits.load(std::memory_order_relaxed);
+    num_misses += partitions[p].misses.load(std::memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&buffer_manager_latch);
+  if (hits != NULL) *hits = num_hits;
+  if (misses != NULL) *misses = num_misses;
+}
+
+void buffer_get_swizzle_stats(uint64_t *hits, uint64_t *misses) {
+  pthread_mutex_lock(&buffer_manager_latch);
+  uint64_t num_hits = 0, num_misses = 0;
+  for (int p = 0; p < num_partitions; ++p) {
+    auto &partition = partitions[p];
+    num_hits += partition.swizzle_hits.load(std::memory_order_relaxed);
+    num_misses += partition.swizzle_misses.load(std::memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&buffer_manager_latch);
+  if (hits != NULL) *hits = num_hits;
+  if (misses != NULL) *misses = num_misses;
+}
+
+void buffer_reset_hit_stats() {
+  pthread_mutex_lock(&buffer_manager_latch);
+  for (int p = 0; p < num_partitions; ++p) {
+    partitions[p].hits.store(0, std::memory_order_relaxed);
+    partitions[p].misses.store(0, std::memory_order_relaxed);
+    partitions[p].swizzle_hits.store(0, std::memory_order_relaxed);
+    partitions[p].swizzle_misses.store(0, std::memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&buffer_manager_latch);
+}
+
+int buffer_flush_all_frames() {
+  pthread_mutex_lock(&buffer_manager_latch);
+  latch_all_partitions();
+  auto result = write_back_dirty_frames();
+  unlatch_all_partitions();
+  pthread_mutex_unlock(&buffer_manager_latch);
+  return result;
 }
\ No newline at end of file
@@ -2,8 +2,11 @@
 
 #include <unistd.h>
 
+#include <string>
+
 #include "buffer_manager.h"
 #include "disk_space_manager/file.h"
+#include "index_manager/compaction.h"
 #include "recovery.h"
 #include "trx.h"
 
@@ -11,6 +14,10 @@ int init_db(int num_buf, int flag, int log_num, char *log_path,
             char *logmsg_path) {
   if (init_lock_table()) return 1;
   if (init_buffer_manager(num_buf)) return 1;
+  // torn pages are restored before redo reads them
+  if (log_path != NULL &&
+      file_open_double_write((std::string(log_path) + ".dw").c_str()))
+    return 1;
   if (init_recovery(flag, log_num, log_path, logmsg_path)) return 1;
 
   // flush frames, logs
@@ -20,9 +27,11 @@ int init_db(int num_buf, int flag, int log_num, char *log_path,
 }
 
 int shutdown_db() {
+  stop_all_compactions();
   free_recovery();
   free_buffer_manager();
   free_lock_table();
   file_close_table_files();
+  file_close_double_write();
   return 0;
 }
\ No newline at end of file
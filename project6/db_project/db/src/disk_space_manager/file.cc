@@ -1,57 +1,902 @@
 #include "disk_space_manager/file.h"
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define DB_HAS_IO_URING
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
-#include <unordered_map>
+#include <vector>
 
+#include "disk_space_manager/page_checksum.h"
+#include "disk_space_manager/page_codec.h"
+#include "io_stats.h"
 #include "log.h"
 
-std::map<std::string, int> table_map;
-std::unordered_map<int64_t, int> table_id_map;
+// compressed page slots
+// pages of a compressed table are packed into slots of 1K or 2K (compressed)
+// or 4K (raw) carved out of blocks of the file, a block holds slots of one
+// class. block 0 is the header page (stored raw), block 1 is the directory
+// listing mapping blocks, and a mapping block holds slot entries of
+// kSlotEntriesPerBlock pages. entries are loaded on open and free slots are
+// rebuilt from them, so nothing else is persisted
+const uint64_t kSlotDirectoryMagic = 0x544f4c53504d4f43;  // "COMPSLOT"
+const uint64_t kSlotDirectoryBlock = 1;
+const uint64_t kSlotDirectoryHeaderSize = 64;
+const uint64_t kSlotEntriesPerBlock = kPageSize / sizeof(uint32_t);
+const uint64_t kMaxMappingBlocks =
+    (kPageSize - kSlotDirectoryHeaderSize) / sizeof(uint32_t);
+const uint64_t kMaxSlotBlocks = 1ULL << 28;  // block bits of a slot entry
+// slot classes (slot size is 512 << class), 0 means no slot
+const uint32_t kSlotClass1K = 1;
+const uint32_t kSlotClass2K = 2;
+const uint32_t kSlotClassRaw = 3;
+const uint8_t kBlockFree = 0;
+const uint8_t kBlockMeta = 4;  // header, directory and mapping blocks
+
+union slot_directory_t {
+  page_t page;
+  struct {
+    uint64_t magic;      // kSlotDirectoryMagic
+    uint64_t num_pages;  // size of the table in pages
+    uint64_t num_mapping_blocks;
+    byte padding[kSlotDirectoryHeaderSize - 24];
+    uint32_t mapping_blocks[kMaxMappingBlocks];
+  } directory;
+};
+
+// in-memory slot map of a compressed table
+// slot entry is block << 4 | slot index << 2 | slot class (0 for no slot)
+struct slot_map_t {
+  pthread_mutex_t latch = PTHREAD_MUTEX_INITIALIZER;
+  uint64_t num_pages = 0;
+  std::vector<uint32_t> entries;  // of all pages covered by mapping blocks
+  std::vector<uint32_t> mapping_blocks;
+  std::vector<uint8_t> block_class;  // kBlock* or slot class of each block
+  std::vector<uint8_t> block_slots;  // used slots of each block (bitmask)
+  std::set<uint64_t> free_blocks;
+  std::set<uint64_t> partial_blocks[kSlotClassRaw + 1];  // having free slots
+};
+
+// double-write area
+// pages of a batch are written at once as a header block (header and
+// entries) followed by page images in the order of entries
+const uint64_t kDoubleWriteMagic = 0x45544952574c4244;  // "DBLWRITE"
+
+struct double_write_header_t {
+  uint64_t magic;          // kDoubleWriteMagic
+  uint64_t num_pages;
+  uint64_t images_offset;  // size of the header block (kPageSize aligned)
+  uint32_t checksum;       // of the header block
+  uint32_t __reserved;
+};
+
+struct double_write_entry_t {
+  int64_t table_id;
+  pagenum_t pagenum;
+  uint64_t offset;  // of the image in the area
+  uint64_t size;
+};
+
+struct double_write_t {
+  pthread_mutex_t latch = PTHREAD_MUTEX_INITIALIZER;  // one batch at a time
+  std::atomic<int> fd{-1};
+  std::string path;
+  byte* buffer = NULL;  // batch being written (kPageSize aligned)
+  uint64_t capacity = 0;
+  // pages left in the area on open, restored on open of their tables
+  std::vector<double_write_entry_t> pending;
+};
+
+// table descriptor registry
+// descriptors are indexed by table id, so looking up the fd of an opened
+// table is a single atomic load. table_registry_latch only guards
+// opening/closing tables and the pathname map.
+struct table_desc_t {
+  std::atomic<int> fd{-1};
+  std::string path;
+  bool direct = false;  // opened with O_DIRECT
+  uint64_t page_size = kPageSize;
+  std::unique_ptr<slot_map_t> slots;  // of compressed table (header flag)
+  // striped table (header flag). stripe_fds[0] is the table file, it is set
+  // as soon as the file is opened and used for I/O while fd is published
+  // only once the table is set up
+  int num_stripes = 1;
+  uint64_t stripe_pages = 0;
+  int stripe_fds[kMaxStripes] = {-1};
+  // page writes since the last sync
+  std::atomic<uint64_t> num_unsynced_writes{0};
+  // images of data pages written in deferred mode (with checksum) until the
+  // sync point of the table (see stage_page), num_staged is read without
+  // the latch to skip it
+  pthread_mutex_t staged_latch = PTHREAD_MUTEX_INITIALIZER;
+  std::map<pagenum_t, std::vector<byte>> staged;
+  std::atomic<uint64_t> num_staged{0};
+  std::atomic<const page_t*> map{nullptr};  // read-only mapping of the file
+  uint64_t num_mapped_pages = 0;
+
+  // space map summary, number of free pages of each group
+  std::unique_ptr<std::atomic<uint32_t>[]> free_pages;
+  std::atomic<uint64_t> num_space_maps{0};
+  // serializes file_alloc_page/file_free_page (buffer layer uses page latches)
+  pthread_mutex_t space_latch = PTHREAD_MUTEX_INITIALIZER;
+};
+
+// extent is preferred for a new run of pages if it has this many free pages
+const int kMinFreePagesInExtent = kPagesPerExtent / 2;
+
+table_desc_t tables[kMaxNumTables];
+bool direct_io_enabled = false;
+bool compression_enabled = false;
+std::atomic<bool> deferred_sync_enabled{false};
+uint64_t new_table_page_size = kPageSize;
+// striping of tables created afterwards
+int striping_num_stripes = 1;
+uint64_t striping_stripe_pages = 0;
+std::vector<std::string> striping_dirs;
+double_write_t double_write;
+
+// bounce buffer for direct I/O on unaligned pages
+alignas(kPageSize) thread_local byte bounce_page[kMaxPageSize];
+// compressed image of a page slot
+alignas(kPageSize) thread_local page_t compress_page;
+// written image of a page (with checksum)
+alignas(kPageSize) thread_local byte checksum_page[kMaxPageSize];
+std::map<std::string, int64_t> table_map;
+pthread_rwlock_t table_registry_latch = PTHREAD_RWLOCK_INITIALIZER;
 
 uint64_t pagenum2offset(pagenum_t pagenum) { return pagenum * kPageSize; }
+bool is_valid_page_size(uint64_t page_size) {
+  return page_size >= kPageSize && page_size <= kMaxPageSize &&
+         (page_size & (page_size - 1)) == 0;
+}
 pagenum_t offset2pagenum(uint64_t offset) { return offset / kPageSize; }
 
+// get fd of the opened table (negative if it is not opened)
+int table_fd(int64_t table_id) {
+  if (table_id < 0 || table_id >= kMaxNumTables) return -1;
+  return tables[table_id].fd.load(std::memory_order_acquire);
+}
+
+// pread whole count bytes, bytes beyond the end of file are filled with zero
+// the read is accounted to the table at the site (io_stats)
+// return 0 on success
+int pread_full(int fd, void* buf, size_t count, off_t offset, int64_t table_id,
+               int site) {
+  auto start = io_stats_start();
+  size_t done = 0;
+  while (done < count) {
+    auto res = pread(fd, (byte*)buf + done, count - done, offset + done);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (res == 0) {
+      memset((byte*)buf + done, 0, count - done);
+      break;
+    }
+    done += res;
+  }
+  io_stats_record(kIoOpRead, site, table_id, offset, done, start);
+  return 0;
+}
+
+// pwrite whole count bytes (accounted as pread_full)
+// return 0 on success
+int pwrite_full(int fd, const void* buf, size_t count, off_t offset,
+                int64_t table_id, int site) {
+  auto start = io_stats_start();
+  size_t done = 0;
+  while (done < count) {
+    auto res = pwrite(fd, (const byte*)buf + done, count - done, offset + done);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    done += res;
+  }
+  io_stats_record(kIoOpWrite, site, table_id, offset, count, start);
+  return 0;
+}
+
+// fdatasync the file (accounted as pread_full)
+// return 0 on success (negative with errno on failed)
+int sync_fd(int fd, int64_t table_id, int site) {
+  auto start = io_stats_start();
+  auto res = fdatasync(fd);
+  io_stats_record(kIoOpSync, site, table_id, 0, 0, start);
+  return res;
+}
+
+// number of pages of the stripe among the first num_pages pages of the table
+uint64_t stripe_num_pages(const table_desc_t& table, int stripe,
+                          uint64_t num_pages) {
+  auto round = table.stripe_pages * table.num_stripes;
+  auto rest = num_pages % round;
+  auto begin = table.stripe_pages * stripe;
+  auto num_pages_in_round =
+      rest <= begin ? 0 : std::min(rest - begin, table.stripe_pages);
+  return num_pages / round * table.stripe_pages + num_pages_in_round;
+}
+
+// locate the page in the stripe files of the table
+// return fd of the stripe holding the page, offset is set to its offset
+int page_location(int64_t table_id, pagenum_t pagenum, uint64_t* offset) {
+  auto& table = tables[table_id];
+  if (table.num_stripes <= 1) {
+    *offset = pagenum * table.page_size;
+    return table.stripe_fds[0];
+  }
+  auto run = pagenum / table.stripe_pages;
+  *offset = (run / table.num_stripes * table.stripe_pages +
+             pagenum % table.stripe_pages) *
+            table.page_size;
+  return table.stripe_fds[run % table.num_stripes];
+}
+
+// get the mapping of the read-only table (NULL if it is not mapped)
+const page_t* table_map_ptr(int64_t table_id) {
+  if (table_id < 0 || table_id >= kMaxNumTables) return NULL;
+  return tables[table_id].map.load(std::memory_order_acquire);
+}
+
+// check if the page can be used for direct I/O without bouncing
+bool is_page_aligned(const page_t* page) {
+  return ((uintptr_t)page & (kPageSize - 1)) == 0;
+}
+
+uint32_t slot_entry(uint64_t block, uint32_t idx, uint32_t cls) {
+  return (uint32_t)(block << 4 | idx << 2 | cls);
+}
+uint64_t slot_block(uint32_t entry) { return entry >> 4; }
+uint32_t slot_index(uint32_t entry) { return entry >> 2 & 3; }
+uint32_t slot_class(uint32_t entry) { return entry & 3; }
+uint64_t slot_size(uint32_t cls) { return 512ULL << cls; }
+uint32_t slots_per_block(uint32_t cls) { return kPageSize / slot_size(cls); }
+uint64_t slot_offset(uint32_t entry) {
+  return pagenum2offset(slot_block(entry)) +
+         slot_index(entry) * slot_size(slot_class(entry));
+}
+
+// change class of the block, keeping the free block set
+void set_block_class(slot_map_t& map, uint64_t block, uint8_t cls) {
+  if (map.block_class[block] == kBlockFree) map.free_blocks.erase(block);
+  if (cls == kBlockFree) map.free_blocks.insert(block);
+  map.block_class[block] = cls;
+}
+
+// find a free block, the file is extended by a block if there is none
+// (the block is not written yet, the file grows on write)
+// return block (0 if the file cannot grow)
+uint64_t find_free_block(slot_map_t& map) {
+  if (!map.free_blocks.empty()) return *map.free_blocks.begin();
+  auto block = map.block_class.size();
+  if (block >= kMaxSlotBlocks) return 0;
+  map.block_class.push_back(kBlockMeta);
+  map.block_slots.push_back(0);
+  set_block_class(map, block, kBlockFree);
+  return block;
+}
+
+// mark the slot of the entry in use
+// return false if it is used or its block is of other class
+bool use_slot(slot_map_t& map, uint32_t entry) {
+  auto block = slot_block(entry);
+  auto cls = slot_class(entry);
+  auto bit = 1u << slot_index(entry);
+  if (cls == 0 || block >= map.block_class.size() ||
+      slot_index(entry) >= slots_per_block(cls))
+    return false;
+  if (map.block_class[block] != cls) {
+    if (map.block_class[block] != kBlockFree) return false;
+    set_block_class(map, block, cls);
+  }
+  if (map.block_slots[block] & bit) return false;
+  map.block_slots[block] |= bit;
+  if (map.block_slots[block] == (1u << slots_per_block(cls)) - 1)
+    map.partial_blocks[cls].erase(block);
+  else
+    map.partial_blocks[cls].insert(block);
+  return true;
+}
+
+// mark the slot of the entry free
+void release_slot(slot_map_t& map, uint32_t entry) {
+  auto block = slot_block(entry);
+  auto cls = slot_class(entry);
+  map.block_slots[block] &= ~(1u << slot_index(entry));
+  if (map.block_slots[block] == 0) {
+    map.partial_blocks[cls].erase(block);
+    set_block_class(map, block, kBlockFree);
+  } else {
+    map.partial_blocks[cls].insert(block);
+  }
+}
+
+// take a free slot of the class, partially used blocks are filled first
+// return slot entry (0 if the file cannot grow)
+uint32_t alloc_slot(slot_map_t& map, uint32_t cls) {
+  uint64_t block;
+  if (!map.partial_blocks[cls].empty()) {
+    block = *map.partial_blocks[cls].begin();
+  } else {
+    block = find_free_block(map);
+    if (block == 0) return 0;
+  }
+  auto entry =
+      slot_entry(block, __builtin_ctz(~(uint32_t)map.block_slots[block]), cls);
+  use_slot(map, entry);
+  return entry;
+}
+
+// write the mapping block of the chunk (kSlotEntriesPerBlock pages)
+// return 0 on success
+int write_mapping_block(const slot_map_t& map, int64_t table_id,
+                        uint64_t chunk) {
+  alignas(kPageSize) page_t block;
+  memcpy(block.data, &map.entries[chunk * kSlotEntriesPerBlock], kPageSize);
+  return pwrite_full(tables[table_id].stripe_fds[0], &block, kPageSize,
+                     pagenum2offset(map.mapping_blocks[chunk]), table_id,
+                     kIoSiteMeta);
+}
+
+// return 0 on success
+int write_slot_directory(const slot_map_t& map, int64_t table_id) {
+  alignas(kPageSize) slot_directory_t dir;
+  memset(&dir, 0, sizeof(dir));
+  dir.directory.magic = kSlotDirectoryMagic;
+  dir.directory.num_pages = map.num_pages;
+  dir.directory.num_mapping_blocks = map.mapping_blocks.size();
+  std::copy(map.mapping_blocks.begin(), map.mapping_blocks.end(),
+            dir.directory.mapping_blocks);
+  return pwrite_full(tables[table_id].stripe_fds[0], &dir, kPageSize,
+                     pagenum2offset(kSlotDirectoryBlock), table_id,
+                     kIoSiteMeta);
+}
+
+// set up an empty slot map of a new compressed table
+// return 0 on success
+int init_slot_map(int64_t table_id) {
+  auto& table = tables[table_id];
+  auto* map = new slot_map_t;
+  map->block_class.assign(kSlotDirectoryBlock + 1, kBlockMeta);
+  map->block_slots.assign(kSlotDirectoryBlock + 1, 0);
+  table.slots.reset(map);
+  return write_slot_directory(*map, table_id);
+}
+
+// load slot map of the compressed table from its file and rebuild free
+// slots
+// return 0 on success
+int load_slot_map(int64_t table_id, int fd) {
+  auto& table = tables[table_id];
+  struct stat st;
+  alignas(kPageSize) slot_directory_t dir;
+  if (fstat(fd, &st) < 0 ||
+      pread_full(fd, &dir, kPageSize, pagenum2offset(kSlotDirectoryBlock),
+                 table_id, kIoSiteMeta))
+    return 1;
+  auto& d = dir.directory;
+  if (d.magic != kSlotDirectoryMagic ||
+      d.num_mapping_blocks > kMaxMappingBlocks ||
+      d.num_pages > d.num_mapping_blocks * kSlotEntriesPerBlock)
+    return 1;
+
+  std::unique_ptr<slot_map_t> map(new slot_map_t);
+  auto num_blocks = std::max((st.st_size + kPageSize - 1) / kPageSize,
+                             kSlotDirectoryBlock + 1);
+  map->block_class.assign(num_blocks, kBlockMeta);
+  map->block_slots.assign(num_blocks, 0);
+  for (uint64_t block = kSlotDirectoryBlock + 1; block < num_blocks; ++block)
+    set_block_class(*map, block, kBlockFree);
+
+  map->num_pages = d.num_pages;
+  map->entries.resize(d.num_mapping_blocks * kSlotEntriesPerBlock);
+  for (uint64_t chunk = 0; chunk < d.num_mapping_blocks; ++chunk) {
+    auto block = d.mapping_blocks[chunk];
+    if (block >= num_blocks || map->block_class[block] != kBlockFree ||
+        pread_full(fd, &map->entries[chunk * kSlotEntriesPerBlock], kPageSize,
+                   pagenum2offset(block), table_id, kIoSiteMeta))
+      return 1;
+    set_block_class(*map, block, kBlockMeta);
+    map->mapping_blocks.push_back(block);
+  }
+  for (uint64_t pagenum = 0; pagenum < map->entries.size(); ++pagenum) {
+    auto& entry = map->entries[pagenum];
+    // pages beyond the end may be left by a crash while truncating
+    if (pagenum >= map->num_pages) entry = 0;
+    if (entry != 0 && !use_slot(*map, entry)) return 1;
+  }
+  table.slots = std::move(map);
+  return 0;
+}
+
+// set size of the compressed table in pages
+// slots of cut off pages are freed after their entries are durable
+// return 0 on success
+int resize_slot_map(int64_t table_id, uint64_t num_pages) {
+  auto& map = *tables[table_id].slots;
+  auto fd = tables[table_id].stripe_fds[0];
+  pthread_mutex_lock(&map.latch);
+  auto num_chunks =
+      (num_pages + kSlotEntriesPerBlock - 1) / kSlotEntriesPerBlock;
+  if (num_chunks > kMaxMappingBlocks) {
+    pthread_mutex_unlock(&map.latch);
+    errno = EFBIG;
+    return -1;
+  }
+  // new mapping blocks are written before the directory refers to them
+  while (map.mapping_blocks.size() < num_chunks) {
+    auto block = find_free_block(map);
+    if (block == 0) {
+      pthread_mutex_unlock(&map.latch);
+      errno = EFBIG;
+      return -1;
+    }
+    set_block_class(map, block, kBlockMeta);
+    map.mapping_blocks.push_back(block);
+    map.entries.resize(map.mapping_blocks.size() * kSlotEntriesPerBlock);
+    if (write_mapping_block(map, table_id, map.mapping_blocks.size() - 1)) {
+      pthread_mutex_unlock(&map.latch);
+      return -1;
+    }
+  }
+
+  std::vector<uint32_t> released;
+  std::set<uint64_t> changed_chunks;
+  for (auto pagenum = num_pages; pagenum < map.num_pages; ++pagenum) {
+    auto& entry = map.entries[pagenum];
+    if (entry == 0) continue;
+    released.push_back(entry);
+    changed_chunks.insert(pagenum / kSlotEntriesPerBlock);
+    entry = 0;
+  }
+  for (auto chunk : changed_chunks) {
+    if (write_mapping_block(map, table_id, chunk)) {
+      pthread_mutex_unlock(&map.latch);
+      return -1;
+    }
+  }
+  map.num_pages = num_pages;
+  if (write_slot_directory(map, table_id) ||
+      sync_fd(fd, table_id, kIoSiteMeta) < 0) {
+    pthread_mutex_unlock(&map.latch);
+    return -1;
+  }
+  if (released.empty()) {
+    pthread_mutex_unlock(&map.latch);
+    return 0;
+  }
+
+  // give free blocks at the end back to the file system
+  for (auto entry : released) release_slot(map, entry);
+  auto num_blocks = map.block_class.size();
+  while (map.block_class[num_blocks - 1] == kBlockFree) {
+    map.free_blocks.erase(--num_blocks);
+  }
+  map.block_class.resize(num_blocks);
+  map.block_slots.resize(num_blocks);
+  auto res = ftruncate(fd, pagenum2offset(num_blocks));
+  pthread_mutex_unlock(&map.latch);
+  return res < 0 ? -1 : 0;
+}
+
+// read page from its slot, page never written is read as zero
+// return 0 on success (negative with errno on failed)
+int read_slot_page(int64_t table_id, pagenum_t pagenum, page_t* dest,
+                   int site) {
+  auto& map = *tables[table_id].slots;
+  auto fd = tables[table_id].stripe_fds[0];
+  pthread_mutex_lock(&map.latch);
+  uint32_t entry = pagenum < map.num_pages ? map.entries[pagenum] : 0;
+  pthread_mutex_unlock(&map.latch);
+  if (entry == 0) {
+    memset(dest, 0, sizeof(page_t));
+    return 0;
+  }
+
+  auto cls = slot_class(entry);
+  if (pread_full(fd, &compress_page, slot_size(cls), slot_offset(entry),
+                 table_id, site))
+    return -1;
+  if (cls == kSlotClassRaw) {
+    memcpy(dest, &compress_page, sizeof(page_t));
+    return 0;
+  }
+  uint16_t size;
+  memcpy(&size, compress_page.data, sizeof(size));
+  if (size > slot_size(cls) - sizeof(size) ||
+      page_decompress(compress_page.data + sizeof(size), size, dest->data,
+                      kPageSize) != (int64_t)kPageSize) {
+    errno = EIO;
+    return -1;
+  }
+  return 0;
+}
+
+// write page into a slot of the smallest class it fits in
+// the slot is overwritten in place if the class is not changed
+// return 0 on success (negative with errno on failed)
+int write_slot_page(int64_t table_id, pagenum_t pagenum, const page_t* src,
+                    int site) {
+  auto& map = *tables[table_id].slots;
+  auto fd = tables[table_id].stripe_fds[0];
+  uint16_t size = page_compress(src->data, kPageSize,
+                                compress_page.data + sizeof(size),
+                                slot_size(kSlotClass2K) - sizeof(size));
+  uint32_t cls = kSlotClassRaw;
+  if (size > 0) {
+    cls = size + sizeof(size) <= slot_size(kSlotClass1K) ? kSlotClass1K
+                                                         : kSlotClass2K;
+    memcpy(compress_page.data, &size, sizeof(size));
+    memset(compress_page.data + sizeof(size) + size, 0,
+           slot_size(cls) - sizeof(size) - size);
+  } else {
+    memcpy(&compress_page, src, sizeof(page_t));
+  }
+
+  pthread_mutex_lock(&map.latch);
+  if (pagenum >= map.num_pages) {
+    pthread_mutex_unlock(&map.latch);
+    errno = EINVAL;
+    return -1;
+  }
+  auto old_entry = map.entries[pagenum];
+  auto entry = old_entry;
+  if (slot_class(old_entry) != cls) entry = alloc_slot(map, cls);
+  pthread_mutex_unlock(&map.latch);
+  if (entry == 0) {
+    errno = EFBIG;
+    return -1;
+  }
+
+  auto res = pwrite_full(fd, &compress_page, slot_size(cls),
+                         slot_offset(entry), table_id, site);
+  if (entry == old_entry) return res;
+  // page moves to another slot. the new slot should be durable before the
+  // mapping refers to it, and the mapping before the old slot is reused
+  if (res == 0) res = sync_fd(fd, table_id, kIoSiteMeta);
+  pthread_mutex_lock(&map.latch);
+  if (res == 0) {
+    map.entries[pagenum] = entry;
+    res = write_mapping_block(map, table_id, pagenum / kSlotEntriesPerBlock);
+    if (res == 0) res = sync_fd(fd, table_id, kIoSiteMeta);
+  }
+  if (res == 0 && old_entry != 0) release_slot(map, old_entry);
+  if (res != 0 && map.entries[pagenum] != entry) release_slot(map, entry);
+  pthread_mutex_unlock(&map.latch);
+  return res < 0 ? -1 : 0;
+}
+
+// read page data of the opened table
+// size is the page size of the table, or kPageSize to read the head of the
+// page only (header and space map pages)
+// unaligned destination is bounced on direct I/O tables
+// I/O is accounted to the site (io_stats)
+// return 0 on success (negative with errno on failed)
+int read_page_data(int64_t table_id, pagenum_t pagenum, page_t* dest,
+                   uint64_t size, int site) {
+  auto& table = tables[table_id];
+  if (table.slots && pagenum != kHeaderPagenum)
+    return read_slot_page(table_id, pagenum, dest, site);
+  uint64_t offset;
+  auto fd = page_location(table_id, pagenum, &offset);
+  if (!table.direct || is_page_aligned(dest)) {
+    if (pread_full(fd, dest, size, offset, table_id, site)) return -1;
+  } else {
+    if (pread_full(fd, bounce_page, size, offset, table_id, site)) return -1;
+    memcpy(dest, bounce_page, size);
+  }
+  return 0;
+}
+
+// write page data of the opened table (size as read_page_data)
+// unaligned source is bounced on direct I/O tables
+// return 0 on success (negative with errno on failed)
+int write_page_data(int64_t table_id, pagenum_t pagenum, const page_t* src,
+                    uint64_t size, int site) {
+  auto& table = tables[table_id];
+  if (table.slots && pagenum != kHeaderPagenum)
+    return write_slot_page(table_id, pagenum, src, site);
+  uint64_t offset;
+  auto fd = page_location(table_id, pagenum, &offset);
+  if (!table.direct || is_page_aligned(src))
+    return pwrite_full(fd, src, size, offset, table_id, site);
+
+  memcpy(bounce_page, src, size);
+  return pwrite_full(fd, bounce_page, size, offset, table_id, site);
+}
+
+// open table file, O_DIRECT is used if direct I/O is enabled and allowed
+// (slots of compressed tables are smaller than a block of some devices)
+// return fd (negative on failed)
+int open_table_fd(const char* pathname, int create, bool allow_direct,
+                  bool* direct) {
+  int flags = O_RDWR | (create ? O_CREAT : 0);
+  *direct = direct_io_enabled && allow_direct;
+  if (*direct) {
+    auto fd = open(pathname, flags | O_DIRECT, S_IRUSR | S_IWUSR);
+    if (fd >= 0 || errno != EINVAL) return fd;
+    // file system does not support O_DIRECT
+    LOG_WARN("cannot open %s with O_DIRECT, fall back to buffered I/O",
+             pathname);
+    *direct = false;
+  }
+  return open(pathname, flags, S_IRUSR | S_IWUSR);
+}
+
+// close stripe files of the table other than the table file
+void close_stripes(table_desc_t& table) {
+  for (int stripe = 1; stripe < table.num_stripes; ++stripe) {
+    if (close(table.stripe_fds[stripe]) < 0) {
+      LOG_WARN("failed to close stripe %d of %s, errno: %s", stripe,
+               table.path.c_str(), strerror(errno));
+    }
+  }
+  table.num_stripes = 1;
+  table.stripe_pages = 0;
+}
+
+// close files of the table which failed to be set up
+void abandon_table(table_desc_t& table) {
+  table.slots.reset();
+  close_stripes(table);
+  if (table.stripe_fds[0] >= 0) close(table.stripe_fds[0]);
+  table.stripe_fds[0] = -1;
+}
+
+// open stripe files listed in the header, they are emptied if create is set
+// return 0 on success
+int open_stripes(table_desc_t& table, const header_page_t* header_page,
+                 int create) {
+  auto& header = header_page->header;
+  if (header.num_stripes < 2 || header.num_stripes > kMaxStripes ||
+      header.stripe_pages == 0)
+    return 1;
+  table.stripe_pages = header.stripe_pages;
+  for (uint32_t stripe = 1; stripe < header.num_stripes; ++stripe) {
+    auto* path = header.stripe_paths[stripe - 1];
+    bool direct;
+    auto fd = open_table_fd(path, create, table.direct, &direct);
+    if (fd < 0 || (create && ftruncate(fd, 0) < 0)) {
+      LOG_WARN("failed to open stripe %s, errno: %s", path, strerror(errno));
+      if (fd >= 0) close(fd);
+      close_stripes(table);
+      return 1;
+    }
+    table.stripe_fds[stripe] = fd;
+    table.num_stripes = stripe + 1;
+  }
+  return 0;
+}
+
+// check if the page is a header or space map page
+bool is_meta_page(pagenum_t pagenum) {
+  return pagenum == kHeaderPagenum ||
+         pagenum == space_map_pagenum(space_map_group(pagenum));
+}
+
+// get bytes of the page covered by its checksum
+// (header and space map pages only use their first kPageSize bytes)
+uint64_t checksum_size(int64_t table_id, pagenum_t pagenum) {
+  return is_meta_page(pagenum) ? kPageSize : tables[table_id].page_size;
+}
+
+// set checksum field of the page
+void set_page_checksum(int64_t table_id, pagenum_t pagenum, page_t* page) {
+  auto offset = page_checksum_offset(pagenum);
+  auto checksum =
+      page_checksum(page->data, checksum_size(table_id, pagenum), offset);
+  memcpy(page->data + offset, &checksum, sizeof(checksum));
+}
+
+// get checksum field of the page
+uint32_t stored_page_checksum(pagenum_t pagenum, const page_t* page) {
+  uint32_t checksum;
+  memcpy(&checksum, page->data + page_checksum_offset(pagenum),
+         sizeof(checksum));
+  return checksum;
+}
+
+// check if the page matches its checksum (pages without one always match)
+bool is_page_checksum_valid(int64_t table_id, pagenum_t pagenum,
+                            const page_t* page) {
+  auto checksum = stored_page_checksum(pagenum, page);
+  return checksum == 0 ||
+         checksum == page_checksum(page->data,
+                                   checksum_size(table_id, pagenum),
+                                   page_checksum_offset(pagenum));
+}
+
+// sync all stripes of the table if it is written since the last sync
+// syncs are accounted to the site (io_stats)
+// return 0 on success (negative with errno on failed)
+int sync_table(int64_t table_id, int site) {
+  auto& table = tables[table_id];
+  if (table.num_unsynced_writes.exchange(0) == 0) return 0;
+  for (int stripe = 0; stripe < table.num_stripes; ++stripe) {
+    if (sync_fd(table.stripe_fds[stripe], table_id, site) < 0) return -1;
+  }
+  return 0;
+}
+
+int double_write_requests(const std::vector<file_io_request_t*>& writes);
+
+// write pages staged in deferred mode and sync the table, through the
+// double-write area as a batch (in place if the area is closed meanwhile)
+// return 0 on success
+int write_staged_pages(int64_t table_id) {
+  auto& table = tables[table_id];
+  if (table.num_staged.load(std::memory_order_acquire) == 0) return 0;
+  pthread_mutex_lock(&table.staged_latch);
+  std::vector<file_io_request_t> reqs(table.staged.size());
+  std::vector<file_io_request_t*> writes;
+  int result = 0;
+  for (auto& staged : table.staged) {
+    auto& req = reqs[writes.size()];
+    memset(&req, 0, sizeof(req));
+    req.table_id = table_id;
+    req.pagenum = staged.first;
+    req.page = (page_t*)staged.second.data();
+    req.is_write = true;
+    writes.push_back(&req);
+    if (double_write.fd.load(std::memory_order_relaxed) < 0 &&
+        write_page_data(table_id, req.pagenum, req.page, staged.second.size(),
+                        kIoSitePage) < 0)
+      result = 1;
+  }
+  table.num_unsynced_writes.fetch_add(writes.size());
+  if (double_write.fd.load(std::memory_order_relaxed) < 0) {
+    if (sync_table(table_id, kIoSitePage) < 0) result = 1;
+  } else if (double_write_requests(writes)) {
+    result = 1;
+  }
+  for (auto* req : writes) {
+    if (req->result < 0) result = 1;
+  }
+  table.staged.clear();
+  table.num_staged.store(0, std::memory_order_release);
+  pthread_mutex_unlock(&table.staged_latch);
+  return result;
+}
+
+// keep image of the data page written in deferred mode until the sync
+// point of the table, when kDeferredSyncPages pages are staged or on
+// file_sync_all. they are written in place only after their images are
+// durable in the double-write area, so a crash never leaves them torn
+void stage_page(int64_t table_id, pagenum_t pagenum, const page_t* src,
+                uint64_t size) {
+  auto& table = tables[table_id];
+  pthread_mutex_lock(&table.staged_latch);
+  auto& image = table.staged[pagenum];
+  image.assign((const byte*)src, (const byte*)src + size);
+  set_page_checksum(table_id, pagenum, (page_t*)image.data());
+  auto num_staged = table.staged.size();
+  table.num_staged.store(num_staged, std::memory_order_release);
+  pthread_mutex_unlock(&table.staged_latch);
+  if (num_staged >= kDeferredSyncPages && write_staged_pages(table_id)) {
+    LOG_ERR(1, "cannot write staged pages of table %lld, errno: %s",
+            table_id, strerror(errno));
+  }
+}
+
+// drop the staged image of the page, it is written in place by others
+void unstage_page(int64_t table_id, pagenum_t pagenum) {
+  auto& table = tables[table_id];
+  if (table.num_staged.load(std::memory_order_acquire) == 0) return;
+  pthread_mutex_lock(&table.staged_latch);
+  table.staged.erase(pagenum);
+  table.num_staged.store(table.staged.size(), std::memory_order_release);
+  pthread_mutex_unlock(&table.staged_latch);
+}
+
+// read the staged image of the page (size bytes)
+// return true if the page is staged
+bool read_staged_page(int64_t table_id, pagenum_t pagenum, page_t* dest,
+                      uint64_t size) {
+  auto& table = tables[table_id];
+  if (table.num_staged.load(std::memory_order_acquire) == 0) return false;
+  pthread_mutex_lock(&table.staged_latch);
+  auto staged = table.staged.find(pagenum);
+  auto found = staged != table.staged.end();
+  if (found)
+    memcpy(dest, staged->second.data(),
+           std::min<uint64_t>(size, staged->second.size()));
+  pthread_mutex_unlock(&table.staged_latch);
+  return found;
+}
+
 // internal api functions
 // to preserve interface , Disk Space Manager uses this functions internally
-void __file_read_page(int64_t table_id, pagenum_t pagenum, page_t* dest) {
-  if (table_id < 0 || dest == NULL) {
+// pages are as large as the page size of the table, header and space map
+// pages are read/written with size kPageSize (they do not use more)
+void __file_read_page(int64_t table_id, pagenum_t pagenum, page_t* dest,
+                      uint64_t size = 0) {
+  if (table_id < 0 || table_id >= kMaxNumTables || dest == NULL) {
     LOG_ERR(1, "invalid parameters", pagenum);
     return;
   }
-  table_id = table_id_map[table_id];
-  if (lseek(table_id, pagenum2offset(pagenum), SEEK_SET) < 0) {
-    LOG_ERR(1, "cannot seek page %llu", pagenum);
+  // the table may be being set up, before its fd is published
+  if (tables[table_id].stripe_fds[0] < 0) {
+    LOG_ERR(1, "table %lld is not opened", table_id);
     return;
   }
-  if (read(table_id, dest, sizeof(page_t)) < 0) {
+  if (size == 0) size = tables[table_id].page_size;
+  if (read_staged_page(table_id, pagenum, dest, size)) return;
+  if (read_page_data(table_id, pagenum, dest, size, kIoSitePage) < 0) {
     LOG_ERR(1, "cannot read page %llu, errno: %s", pagenum, strerror(errno));
     return;
   }
+  if (!is_page_checksum_valid(table_id, pagenum, dest)) {
+    LOG_ERR(1, "checksum mismatch on page %llu of table %lld", pagenum,
+            table_id);
+  }
 }
 
 void __file_write_page(int64_t table_id, pagenum_t pagenum, const page_t* src,
-                       int sync = true) {
-  if (table_id < 0 || src == NULL) {
+                       int sync = true, uint64_t size = 0) {
+  if (table_id < 0 || table_id >= kMaxNumTables || src == NULL) {
     LOG_ERR(1, "invalid parameters", pagenum);
     return;
   }
-  table_id = table_id_map[table_id];
-  if (lseek(table_id, pagenum2offset(pagenum), SEEK_SET) < 0) {
-    LOG_ERR(1, "cannot seek page %llu", pagenum);
+  // the table may be being set up, before its fd is published
+  if (tables[table_id].stripe_fds[0] < 0) {
+    LOG_ERR(1, "table %lld is not opened", table_id);
+    return;
+  }
+  if (size == 0) size = tables[table_id].page_size;
+  // header and space map pages are not recovered by the log, they are
+  // synced as asked even in deferred mode
+  auto deferred = deferred_sync_enabled.load(std::memory_order_relaxed) &&
+                  !is_meta_page(pagenum);
+  if (deferred && double_write.fd.load(std::memory_order_relaxed) >= 0) {
+    stage_page(table_id, pagenum, src, size);
+    return;
+  }
+  unstage_page(table_id, pagenum);
+  memcpy(checksum_page, src, size);
+  set_page_checksum(table_id, pagenum, (page_t*)checksum_page);
+  if (write_page_data(table_id, pagenum, (page_t*)checksum_page, size,
+                      kIoSitePage) < 0) {
+    LOG_ERR(1, "cannot write page %llu, errno: %s", pagenum, strerror(errno));
+    return;
+  }
+  uint64_t offset;
+  auto page_fd = page_location(table_id, pagenum, &offset);
+  if (deferred) {
+    // failure is harmless, the page is written back by the sync anyway
+    sync_file_range(page_fd, offset, size, SYNC_FILE_RANGE_WRITE);
+    auto num_unsynced = tables[table_id].num_unsynced_writes.fetch_add(1) + 1;
+    if (num_unsynced >= kDeferredSyncPages &&
+        sync_table(table_id, kIoSitePage) < 0) {
+      LOG_ERR(1, "cannot sync table %lld, errno: %s", table_id,
+              strerror(errno));
+    }
     return;
   }
-  if (write(table_id, src, sizeof(page_t)) < 0) {
-    LOG_ERR(1, "cannot write page %llu", pagenum);
+  if (!sync) {
+    tables[table_id].num_unsynced_writes.fetch_add(1);
     return;
   }
-  if (sync && fsync(table_id) < 0) {
+  auto start = io_stats_start();
+  auto res = fsync(page_fd);
+  io_stats_record(kIoOpSync, kIoSitePage, table_id, offset, 0, start);
+  if (res < 0) {
     LOG_ERR(1, "cannot sync write page %llu, errno: %s", pagenum,
             strerror(errno));
   }
@@ -62,15 +907,7 @@ void __file_read_header_page(int64_t table_id, header_page_t* dest) {
     LOG_ERR(1, "invalid parameters");
     return;
   }
-  table_id = table_id_map[table_id];
-  if (lseek(table_id, pagenum2offset(kHeaderPagenum), SEEK_SET) < 0) {
-    LOG_ERR(1, "cannot seek header page");
-    return;
-  }
-  if (read(table_id, dest, sizeof(header_page_t)) < 0) {
-    LOG_ERR(1, "cannot read header page");
-    return;
-  }
+  __file_read_page(table_id, kHeaderPagenum, &dest->page, kPageSize);
 }
 
 void __file_write_header_page(int64_t table_id, const header_page_t* src,
@@ -79,19 +916,7 @@ void __file_write_header_page(int64_t table_id, const header_page_t* src,
     LOG_ERR(1, "invalid parameters");
     return;
   }
-  table_id = table_id_map[table_id];
-  if (lseek(table_id, pagenum2offset(kHeaderPagenum), SEEK_SET) < 0) {
-    LOG_ERR(1, "cannot seek header page");
-    return;
-  }
-  if (write(table_id, src, sizeof(header_page_t)) < 0) {
-    LOG_ERR(1, "cannot write header page");
-    return;
-  }
-  if (sync && fsync(table_id) < 0) {
-    LOG_ERR(1, "cannot sync write header page, errno: %s", strerror(errno));
-    return;
-  }
+  __file_write_page(table_id, kHeaderPagenum, &src->page, sync, kPageSize);
 }
 
 uint64_t __file_size(int64_t table_id) {
@@ -99,43 +924,278 @@ uint64_t __file_size(int64_t table_id) {
     LOG_ERR(1, "invalid parameters");
     return 0;
   }
-  table_id = table_id_map[table_id];
-  auto size = lseek(table_id, 0, SEEK_END);
-  if (size < 0) {
-    LOG_ERR(1, "cannot seek file end position");
-    return 0;
+  auto* slots = tables[table_id].slots.get();
+  if (slots != NULL) {
+    pthread_mutex_lock(&slots->latch);
+    auto num_pages = slots->num_pages;
+    pthread_mutex_unlock(&slots->latch);
+    return pagenum2offset(num_pages);
+  }
+  // stripes hold their own pages of the table, they sum up to its size
+  auto& table = tables[table_id];
+  uint64_t size = 0;
+  for (int stripe = 0; stripe < table.num_stripes; ++stripe) {
+    struct stat st;
+    if (fstat(table.stripe_fds[stripe], &st) < 0) {
+      LOG_ERR(1, "cannot stat table file, errno: %s", strerror(errno));
+      return 0;
+    }
+    size += st.st_size;
   }
   return size;
 }
 
-// utilities used in file.cc (not exported in file.h)
-// Expand file by size
-void expand(int64_t table_id, uint64_t size) {
-  if (size < 1LLU) return;
-  table_id = table_id_map[table_id];
-  if (lseek(table_id, size - 1, SEEK_END) < 0) {
-    LOG_ERR(1, "cannot seek file");
+// asynchronous I/O
+// each thread owns its io_uring instance, so submission and completion need
+// no latch. if io_uring cannot be set up, requests are served synchronously.
+std::atomic<bool> io_uring_enabled{true};
+
+#ifdef DB_HAS_IO_URING
+constexpr unsigned kIoRingEntries = 64;
+
+struct io_ring_t {
+  int fd = -1;
+  unsigned in_flight = 0;
+
+  // submission queue
+  void* sq_ptr = NULL;
+  size_t sq_size = 0;
+  std::atomic<unsigned>* sq_head;
+  std::atomic<unsigned>* sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned* sq_array;
+  io_uring_sqe* sqes = NULL;
+  size_t sqes_size = 0;
+
+  // completion queue
+  void* cq_ptr = NULL;
+  size_t cq_size = 0;
+  std::atomic<unsigned>* cq_head;
+  std::atomic<unsigned>* cq_tail;
+  unsigned cq_mask;
+  io_uring_cqe* cqes;
+
+  ~io_ring_t() { release(); }
+
+  void release() {
+    if (sqes != NULL) munmap(sqes, sqes_size);
+    if (cq_ptr != NULL && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+    if (sq_ptr != NULL) munmap(sq_ptr, sq_size);
+    if (fd >= 0) close(fd);
+    sqes = NULL;
+    cq_ptr = sq_ptr = NULL;
+    fd = -1;
+  }
+};
+
+thread_local io_ring_t io_ring;
+
+// setup io_uring instance of current thread
+// return 0 on success
+int setup_io_ring(io_ring_t& ring) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring.fd = syscall(__NR_io_uring_setup, kIoRingEntries, &params);
+  if (ring.fd < 0) return 1;
+
+  ring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    ring.sq_size = ring.cq_size = std::max(ring.sq_size, ring.cq_size);
+
+  ring.sq_ptr = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+  if (ring.sq_ptr == MAP_FAILED) {
+    ring.sq_ptr = NULL;
+    return 1;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring.cq_ptr = ring.sq_ptr;
+  } else {
+    ring.cq_ptr = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    if (ring.cq_ptr == MAP_FAILED) {
+      ring.cq_ptr = NULL;
+      return 1;
+    }
+  }
+  ring.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  ring.sqes = (io_uring_sqe*)mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, ring.fd,
+                                  IORING_OFF_SQES);
+  if (ring.sqes == MAP_FAILED) {
+    ring.sqes = NULL;
+    return 1;
+  }
+
+  auto* sq = (byte*)ring.sq_ptr;
+  ring.sq_head = (std::atomic<unsigned>*)(sq + params.sq_off.head);
+  ring.sq_tail = (std::atomic<unsigned>*)(sq + params.sq_off.tail);
+  ring.sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+  ring.sq_entries = params.sq_entries;
+  ring.sq_array = (unsigned*)(sq + params.sq_off.array);
+
+  auto* cq = (byte*)ring.cq_ptr;
+  ring.cq_head = (std::atomic<unsigned>*)(cq + params.cq_off.head);
+  ring.cq_tail = (std::atomic<unsigned>*)(cq + params.cq_off.tail);
+  ring.cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+  ring.cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+  return 0;
+}
+
+// get io_uring instance of current thread (NULL if io_uring is not usable)
+io_ring_t* get_io_ring() {
+  if (!io_uring_enabled.load(std::memory_order_relaxed)) return NULL;
+  if (io_ring.fd >= 0) return &io_ring;
+  if (setup_io_ring(io_ring)) {
+    LOG_WARN("io_uring is not available, fall back to synchronous I/O");
+    io_ring.release();
+    io_uring_enabled.store(false, std::memory_order_relaxed);
+    return NULL;
+  }
+  return &io_ring;
+}
+#endif
+
+// finish request and call its callback
+void complete_io(file_io_request_t* req, int result) {
+  req->result = result;
+  req->done = true;
+  if (req->callback != NULL) req->callback(req);
+}
+
+// serve request synchronously
+void sync_io(file_io_request_t* req) {
+  auto fd = table_fd(req->table_id);
+  if (fd < 0) {
+    complete_io(req, -EBADF);
     return;
   }
-  byte null_byte = 0;
-  if (write(table_id, &null_byte, 1) < 0) {
-    LOG_ERR(1, "cannot write null byte to expand file");
+  auto size = tables[req->table_id].page_size;
+  auto res =
+      req->is_write
+          ? write_page_data(req->table_id, req->pagenum, req->page, size,
+                            kIoSiteBatch)
+          : read_page_data(req->table_id, req->pagenum, req->page, size,
+                           kIoSiteBatch);
+  if (res < 0) {
+    complete_io(req, -errno);
     return;
   }
-  if (lseek(table_id, 0, SEEK_SET) < 0) {
-    LOG_WARN("cannot seek to reset");
+  if (!req->is_write &&
+      !is_page_checksum_valid(req->table_id, req->pagenum, req->page)) {
+    LOG_WARN("checksum mismatch on page %llu of table %lld", req->pagenum,
+             req->table_id);
+    complete_io(req, -EIO);
     return;
   }
-  if (fsync(table_id) < 0) {
+  complete_io(req, 0);
+}
+
+#ifdef DB_HAS_IO_URING
+// finish completed requests in the completion queue
+// return number of completed requests
+int reap_io_ring(io_ring_t& ring) {
+  int reaped = 0;
+  auto head = ring.cq_head->load(std::memory_order_relaxed);
+  auto tail = ring.cq_tail->load(std::memory_order_acquire);
+  while (head != tail) {
+    auto* cqe = &ring.cqes[head & ring.cq_mask];
+    auto* req = (file_io_request_t*)cqe->user_data;
+    auto res = cqe->res;
+    ++head;
+    ++reaped;
+    --ring.in_flight;
+
+    if (res >= 0 && res < (int)tables[req->table_id].page_size) {
+      // finish short transfer synchronously
+      sync_io(req);
+      continue;
+    }
+    if (res >= 0 && !req->is_write &&
+        !is_page_checksum_valid(req->table_id, req->pagenum, req->page)) {
+      LOG_WARN("checksum mismatch on page %llu of table %lld", req->pagenum,
+               req->table_id);
+      res = -EIO;
+    }
+    if (res >= 0) {
+      uint64_t offset;
+      page_location(req->table_id, req->pagenum, &offset);
+      io_stats_record(req->is_write ? kIoOpWrite : kIoOpRead, kIoSiteBatch,
+                      req->table_id, offset, res, req->io_start);
+    }
+    complete_io(req, res < 0 ? res : 0);
+  }
+  ring.cq_head->store(head, std::memory_order_release);
+  return reaped;
+}
+#endif
+
+// utilities used in file.cc (not exported in file.h)
+// Extend file of fd (a file of the table) up to new_end
+void extend_fd(int fd, uint64_t new_end, int64_t table_id) {
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    LOG_ERR(1, "cannot stat table file, errno: %s", strerror(errno));
+    return;
+  }
+  uint64_t file_end = st.st_size;
+  if (new_end <= file_end) return;
+  auto sparse = false;
+  auto start = io_stats_start();
+  if (fallocate(fd, 0, file_end, new_end - file_end) < 0) {
+    // some file systems do not support fallocate, extend it sparsely
+    if (errno != EOPNOTSUPP) {
+      LOG_ERR(1, "cannot expand file, errno: %s", strerror(errno));
+      return;
+    }
+    sparse = true;
+  }
+  if (sparse && ftruncate(fd, new_end) < 0) {
+    LOG_ERR(1, "cannot expand file, errno: %s", strerror(errno));
+    return;
+  }
+  io_stats_record(kIoOpExpand, kIoSiteMeta, table_id, file_end,
+                  new_end - file_end, start);
+  if (sync_fd(fd, table_id, kIoSiteMeta) < 0) {
     LOG_ERR(1, "cannot sync file after expand, errno: %s", strerror(errno));
     return;
   }
 }
 
-// Expand file by size and create page list
-void expand_and_create_pages(int64_t table_id, uint64_t size, pagenum_t* first,
-                             pagenum_t* last, uint64_t* num_new_pages) {
-  if (table_id < 0 || size % kPageSize != 0 || size < 1LLU) {
+// Expand file by size
+// space is reserved by fallocate, so it takes constant time
+// regardless of the size (compressed tables only cover new pages by mapping
+// blocks, slots take space as pages are written)
+void expand(int64_t table_id, uint64_t size) {
+  if (size < 1LLU) return;
+  auto& table = tables[table_id];
+  auto new_end = __file_size(table_id) + size;
+  if (table.slots) {
+    if (resize_slot_map(table_id, new_end / kPageSize) < 0) {
+      LOG_ERR(1, "cannot expand file, errno: %s", strerror(errno));
+    }
+    return;
+  }
+  if (table.num_stripes <= 1) {
+    extend_fd(table.stripe_fds[0], new_end, table_id);
+    return;
+  }
+  for (int stripe = 0; stripe < table.num_stripes; ++stripe) {
+    extend_fd(table.stripe_fds[stripe],
+              stripe_num_pages(table, stripe, new_end / table.page_size) *
+                  table.page_size,
+              table_id);
+  }
+}
+
+// Expand file by size and return the range of new pages
+// new pages are not initialized, they are used by raising high-water mark
+void expand_pages(int64_t table_id, uint64_t size, pagenum_t* first,
+                  pagenum_t* last, uint64_t* num_new_pages) {
+  if (table_id < 0 || size % tables[table_id].page_size != 0 ||
+      size < 1LLU) {
     LOG_ERR(1, "cannot expand database file, wrong parameter");
     return;
   }
@@ -144,54 +1204,117 @@ void expand_and_create_pages(int64_t table_id, uint64_t size, pagenum_t* first,
     return;
   }
 
-  // expand file
   auto start = __file_size(table_id);
   expand(table_id, size);
   auto end = __file_size(table_id);
 
-  // create page list
-  *num_new_pages = (end - start) / kPageSize;
+  auto page_size = tables[table_id].page_size;
+  *num_new_pages = (end - start) / page_size;
+  *first = start / page_size;
+  *last = end / page_size - 1;
+}
 
-  pagenum_t current_page_num;
-  page_node_t page_node;
-  for (int64_t i = 0; i < *num_new_pages - 1; ++i) {
-    current_page_num = offset2pagenum(start + i * kPageSize);
-    page_node.next_free_page = current_page_num + 1;
-    __file_write_page(table_id, current_page_num, &page_node.page, false);
-  }
-  current_page_num = page_node.next_free_page;
-  page_node.next_free_page = 0;
-  __file_write_page(table_id, current_page_num, &page_node.page);
+// restore torn pages of the table from the double-write area
+// header page is restored before it is read on open (header_only), others
+// after the table is set up. pages are taken if their image is whole and
+// the page in place is not (no checksum means it is not written since)
+void restore_torn_pages(int64_t table_id, bool header_only) {
+  auto& dw = double_write;
+  pthread_mutex_lock(&dw.latch);
+  for (auto& entry : dw.pending) {
+    if (entry.table_id != table_id ||
+        header_only != (entry.pagenum == kHeaderPagenum))
+      continue;
+    // pages cut off after the batch are not restored
+    if (!header_only &&
+        entry.pagenum * tables[table_id].page_size >= __file_size(table_id))
+      continue;
 
-  *first = offset2pagenum(start);
-  *last = current_page_num;
-}
+    std::vector<byte> image(entry.size), page(entry.size);
+    auto* image_page = (page_t*)image.data();
+    auto* in_place = (page_t*)page.data();
+    if (pread_full(dw.fd, image.data(), entry.size, entry.offset, table_id,
+                   kIoSiteDoubleWrite) < 0 ||
+        stored_page_checksum(entry.pagenum, image_page) == 0 ||
+        !is_page_checksum_valid(table_id, entry.pagenum, image_page))
+      continue;
+    if (read_page_data(table_id, entry.pagenum, in_place, entry.size,
+                       kIoSiteDoubleWrite) == 0 &&
+        stored_page_checksum(entry.pagenum, in_place) != 0 &&
+        is_page_checksum_valid(table_id, entry.pagenum, in_place))
+      continue;
 
-// Expand file by size and create page list and connect it to header
-void expand_and_create_pages(int64_t table_id, uint64_t size) {
-  if (table_id < 0 || size % kPageSize != 0 || size < 1LLU) {
-    LOG_ERR(1, "cannot expand database file, wrong parameter");
-    return;
+    uint64_t offset;
+    auto fd = page_location(table_id, entry.pagenum, &offset);
+    if (write_page_data(table_id, entry.pagenum, image_page, entry.size,
+                        kIoSiteDoubleWrite) < 0 ||
+        sync_fd(fd, table_id, kIoSiteDoubleWrite) < 0) {
+      LOG_ERR(1, "cannot restore page %llu of table %lld, errno: %s",
+              entry.pagenum, table_id, strerror(errno));
+    }
+    LOG_WARN("restored torn page %llu of table %lld from double-write area",
+             entry.pagenum, table_id);
   }
+  pthread_mutex_unlock(&dw.latch);
+}
 
-  // expand and create pages
-  pagenum_t first_page_num, last_page_num;
-  uint64_t num_new_pages;
-  expand_and_create_pages(table_id, size, &first_page_num, &last_page_num,
-                          &num_new_pages);
+// build in-memory space summary from space maps of the table
+// return 0 on success
+int load_space_summary(int64_t table_id) {
+  auto& table = tables[table_id];
+  if (!table.free_pages)
+    table.free_pages.reset(new std::atomic<uint32_t>[kMaxNumSpaceMaps]);
+  for (uint64_t i = 0; i < kMaxNumSpaceMaps; ++i) table.free_pages[i] = 0;
+  table.num_space_maps.store(0, std::memory_order_release);
 
-  // connect created list into header
   header_page_t header_page;
   __file_read_header_page(table_id, &header_page);
+  auto num_of_pages = header_page.header.num_of_pages;
+  if (num_of_pages < 2) return 1;
+  auto num_groups = space_map_group(num_of_pages - 1) + 1;
+  if (num_groups > kMaxNumSpaceMaps) return 1;
+  space_map_page_t space_map;
+  for (uint64_t group = 0; group < num_groups; ++group) {
+    __file_read_page(table_id, space_map_pagenum(group), &space_map.page,
+                     kPageSize);
+    file_update_space_summary(table_id, group,
+                              space_map.space_map.num_free_pages);
+  }
+  return 0;
+}
+
+// space map page being extended on disk (see grow_space_maps)
+thread_local space_map_page_t grown_space_map;
 
-  page_node_t page_node;
-  __file_read_page(table_id, last_page_num, &page_node.page);
-  page_node.next_free_page = header_page.header.first_free_page;
-  __file_write_page(table_id, last_page_num, &page_node.page);
+space_map_page_t* read_space_map(int64_t table_id, uint64_t group,
+                                 bool is_new) {
+  if (is_new)
+    space_map_init(&grown_space_map, group);
+  else
+    __file_read_page(table_id, space_map_pagenum(group), &grown_space_map.page,
+                     kPageSize);
+  return &grown_space_map;
+}
 
-  header_page.header.first_free_page = first_page_num;
-  header_page.header.num_of_pages += num_new_pages;
+void write_space_map(int64_t table_id, uint64_t group,
+                     space_map_page_t* map) {
+  __file_write_page(table_id, space_map_pagenum(group), &map->page, true,
+                    kPageSize);
+}
+
+// expand file twice and extend space maps to the new pages on disk
+// tables[table_id].space_latch should be held
+// return 0 on success
+int grow_space_maps(int64_t table_id) {
+  header_page_t header_page;
+  __file_read_header_page(table_id, &header_page);
+  auto num_of_pages =
+      file_grow_space_maps(table_id, header_page.header.num_of_pages,
+                           read_space_map, write_space_map);
+  if (num_of_pages == 0) return 1;
+  header_page.header.num_of_pages = num_of_pages;
   __file_write_header_page(table_id, &header_page);
+  return 0;
 }
 
 // API
@@ -203,63 +1326,261 @@ int64_t file_open_table_file(const char* pathname) {
     return -1;
   }
 
-  // if file is already opened, return its fd
+  // if file is already opened, return its table id
   auto path_str = std::string(pathname);
+  pthread_rwlock_rdlock(&table_registry_latch);
   auto table_id_found = table_map.find(path_str);
   if (table_id_found != table_map.end()) {
-    return table_id_found->second;
+    auto table_id = table_id_found->second;
+    pthread_rwlock_unlock(&table_registry_latch);
+    return table_id;
   }
+  pthread_rwlock_unlock(&table_registry_latch);
 
-  int table_id = 0;
-  int64_t target_table_id = 0;
-  if (sscanf(pathname, "DATA%lld", &target_table_id) != 1) {
+  int64_t table_id = 0;
+  if (sscanf(pathname, "DATA%lld", &table_id) != 1) {
     LOG_ERR(1, "invalid pathname");
     return -1;
   }
+  if (table_id < 0 || table_id >= kMaxNumTables) {
+    LOG_WARN("table id of %s is out of range [0, %lld)", pathname,
+             kMaxNumTables);
+    return -1;
+  }
+
+  pthread_rwlock_wrlock(&table_registry_latch);
+  // someone may open the file while waiting for the latch
+  table_id_found = table_map.find(path_str);
+  if (table_id_found != table_map.end()) {
+    pthread_rwlock_unlock(&table_registry_latch);
+    return table_id_found->second;
+  }
+  if (table_fd(table_id) >= 0) {
+    pthread_rwlock_unlock(&table_registry_latch);
+    LOG_WARN("table id %lld is already used by %s", table_id,
+             tables[table_id].path.c_str());
+    return -1;
+  }
+
+  int fd;
+  auto& table = tables[table_id];
   if (access(pathname, F_OK) != 0) {
-    table_id = open(pathname, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-    if (table_id < 0) {
+    fd = open_table_fd(pathname, true, !compression_enabled, &table.direct);
+    if (fd < 0) {
+      pthread_rwlock_unlock(&table_registry_latch);
       LOG_ERR(1, "failed to create and open %s, errno: %s", pathname,
               strerror(errno));
-      return table_id;
+      return fd;
     }
-    table_id_map[target_table_id] = table_id;
-    table_id = target_table_id;
-    expand(table_id, kPageSize);  // expand file for header page
+    table.stripe_fds[0] = fd;
+    // slots of compressed tables hold 4K pages
+    table.page_size = compression_enabled ? kPageSize : new_table_page_size;
 
-    // setup header page
+    // setup header page and the first space map
     header_page_t header_page;
     memset(header_page.page.data, 0, kPageSize);
-    header_page.header.first_free_page = 0;
-    header_page.header.num_of_pages = 1;
+    header_page.header.magic = kHeaderMagic;
+    header_page.header.num_of_pages = kDefaultFileSize / table.page_size;
     header_page.header.root_page_number = 0;
-    __file_write_header_page(table_id, &header_page);
+    header_page.header.page_size = table.page_size;
+    if (compression_enabled) {
+      header_page.header.flags |= kHeaderFlagCompressed;
+      if (init_slot_map(table_id)) {
+        LOG_ERR(1, "failed to set up slots of %s, errno: %s", pathname,
+                strerror(errno));
+      }
+    } else if (striping_num_stripes > 1) {
+      header_page.header.flags |= kHeaderFlagStriped;
+      header_page.header.num_stripes = striping_num_stripes;
+      header_page.header.stripe_pages = striping_stripe_pages;
+      for (int stripe = 1; stripe < striping_num_stripes; ++stripe) {
+        auto path = std::string(pathname) + "." + std::to_string(stripe);
+        if (!striping_dirs.empty())
+          path = striping_dirs[stripe - 1] + "/" + path;
+        if (path.size() >= kMaxStripePathLen) {
+          LOG_ERR(1, "stripe path %s is too long", path.c_str());
+        }
+        strcpy(header_page.header.stripe_paths[stripe - 1], path.c_str());
+      }
+      if (open_stripes(table, &header_page, true)) {
+        LOG_ERR(1, "failed to create stripes of %s", pathname);
+      }
+    }
+    expand(table_id, kDefaultFileSize);
 
-    expand_and_create_pages(table_id, kDefaultFileSize - kPageSize);
+    space_map_page_t space_map;
+    space_map_init(&space_map, 0);
+    space_map_extend(&space_map, header_page.header.num_of_pages);
+    __file_write_page(table_id, space_map_pagenum(0), &space_map.page, true,
+                      kPageSize);
+    __file_write_header_page(table_id, &header_page);
   } else {
-    table_id = open(pathname, O_RDWR);
-    if (table_id < 0) {
+    fd = open_table_fd(pathname, false, true, &table.direct);
+    if (fd < 0) {
+      pthread_rwlock_unlock(&table_registry_latch);
       LOG_ERR(1, "failed to open %s, errno: %s", pathname, strerror(errno));
-      return table_id;
+      return fd;
+    }
+    table.stripe_fds[0] = fd;
+
+    // files of free page list format have no space map at page 1
+    restore_torn_pages(table_id, true);
+    header_page_t header_page;
+    __file_read_header_page(table_id, &header_page);
+    if (header_page.header.magic != kHeaderMagic) {
+      abandon_table(table);
+      pthread_rwlock_unlock(&table_registry_latch);
+      LOG_WARN("%s is not a table file of space map format", pathname);
+      return -1;
+    }
+    // files created before page size was recorded have 4K pages
+    table.page_size = header_page.header.page_size;
+    if (table.page_size == 0) table.page_size = kPageSize;
+    if (!is_valid_page_size(table.page_size)) {
+      abandon_table(table);
+      pthread_rwlock_unlock(&table_registry_latch);
+      LOG_WARN("%s has invalid page size %llu", pathname, table.page_size);
+      return -1;
+    }
+    if (header_page.header.flags & kHeaderFlagCompressed) {
+      if (table.direct) {
+        close(fd);
+        fd = open_table_fd(pathname, false, false, &table.direct);
+        table.stripe_fds[0] = fd;
+      }
+      if (fd < 0 || load_slot_map(table_id, fd)) {
+        abandon_table(table);
+        pthread_rwlock_unlock(&table_registry_latch);
+        LOG_WARN("failed to load slots of %s", pathname);
+        return -1;
+      }
     }
-    table_id_map[target_table_id] = table_id;
-    table_id = target_table_id;
+    if ((header_page.header.flags & kHeaderFlagStriped) &&
+        open_stripes(table, &header_page, false)) {
+      abandon_table(table);
+      pthread_rwlock_unlock(&table_registry_latch);
+      LOG_WARN("failed to open stripes of %s", pathname);
+      return -1;
+    }
+    restore_torn_pages(table_id, false);
+  }
+  if (load_space_summary(table_id)) {
+    abandon_table(table);
+    pthread_rwlock_unlock(&table_registry_latch);
+    LOG_WARN("failed to load space maps of %s", pathname);
+    return -1;
   }
 
-  // store in descriptors map
+  // publish the table set up, and store in descriptors map
+  tables[table_id].fd.store(fd, std::memory_order_release);
+  tables[table_id].path = path_str;
   table_map[path_str] = table_id;
+  pthread_rwlock_unlock(&table_registry_latch);
 
   return table_id;
 }
 
-int64_t file_open_table_file(int64_t table_id) {
-  auto find = table_id_map.find(table_id);
-  if (find == table_id_map.end()) {
-    char filename[128];
-    sprintf(filename, "DATA%lld", table_id);
-    return file_open_table_file(filename);
-  } else
+int64_t file_open_mapped_table_file(const char* pathname) {
+  if (pathname == NULL) {
+    LOG_ERR(1, "invalid parameters");
+    return -1;
+  }
+
+  int64_t table_id = 0;
+  if (sscanf(pathname, "DATA%lld", &table_id) != 1) {
+    LOG_ERR(1, "invalid pathname");
+    return -1;
+  }
+  if (table_id < 0 || table_id >= kMaxNumTables) {
+    LOG_WARN("table id of %s is out of range [0, %lld)", pathname,
+             kMaxNumTables);
+    return -1;
+  }
+
+  auto path_str = std::string(pathname);
+  pthread_rwlock_wrlock(&table_registry_latch);
+  auto table_id_found = table_map.find(path_str);
+  if (table_id_found != table_map.end()) {
+    table_id = table_id_found->second;
+    pthread_rwlock_unlock(&table_registry_latch);
+    if (table_map_ptr(table_id) == NULL) {
+      LOG_WARN("%s is already opened for writing", pathname);
+      return -1;
+    }
     return table_id;
+  }
+  if (table_fd(table_id) >= 0) {
+    pthread_rwlock_unlock(&table_registry_latch);
+    LOG_WARN("table id %lld is already used by %s", table_id,
+             tables[table_id].path.c_str());
+    return -1;
+  }
+
+  auto fd = open(pathname, O_RDONLY);
+  if (fd < 0) {
+    pthread_rwlock_unlock(&table_registry_latch);
+    LOG_WARN("failed to open %s, errno: %s", pathname, strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)kPageSize) {
+    close(fd);
+    pthread_rwlock_unlock(&table_registry_latch);
+    LOG_WARN("%s is not a table file", pathname);
+    return -1;
+  }
+  auto map_size = (uint64_t)st.st_size;
+  auto* map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    pthread_rwlock_unlock(&table_registry_latch);
+    LOG_WARN("failed to map %s, errno: %s", pathname, strerror(errno));
+    return -1;
+  }
+  auto* header_page = (const header_page_t*)map;
+  uint64_t page_size = header_page->header.page_size;
+  if (page_size == 0) page_size = kPageSize;
+  if (header_page->header.magic != kHeaderMagic ||
+      (header_page->header.flags &
+       (kHeaderFlagCompressed | kHeaderFlagStriped)) ||
+      !is_valid_page_size(page_size)) {
+    munmap(map, map_size);
+    close(fd);
+    pthread_rwlock_unlock(&table_registry_latch);
+    LOG_WARN("%s is not a table file of space map format, or compressed or "
+             "striped, it cannot be mapped",
+             pathname);
+    return -1;
+  }
+  auto num_pages = map_size / page_size;
+  // most accesses are point lookups walking down the tree, so kernel
+  // read-ahead only pollutes the page cache. scans prefetch leaves by
+  // themselves (file_prefetch_pages)
+  if (madvise(map, map_size, MADV_RANDOM) < 0) {
+    LOG_WARN("madvise failed on %s, errno: %s", pathname, strerror(errno));
+  }
+
+  auto& table = tables[table_id];
+  table.direct = false;
+  table.slots.reset();
+  table.page_size = page_size;
+  table.num_mapped_pages = num_pages;
+  table.map.store((const page_t*)map, std::memory_order_release);
+  table.stripe_fds[0] = fd;
+  table.fd.store(fd, std::memory_order_release);
+  table.path = path_str;
+  table_map[path_str] = table_id;
+  pthread_rwlock_unlock(&table_registry_latch);
+
+  return table_id;
+}
+
+int64_t file_open_table_file(int64_t table_id) {
+  if (table_fd(table_id) >= 0) return table_id;
+
+  char filename[128];
+  sprintf(filename, "DATA%lld", table_id);
+  return file_open_table_file(filename);
 }
 
 int file_expand_twice(int64_t table_id, pagenum_t* start, pagenum_t* end,
@@ -268,54 +1589,113 @@ int file_expand_twice(int64_t table_id, pagenum_t* start, pagenum_t* end,
     LOG_ERR(1, "file descriptor cannot be a negative value");
     return 1;
   }
-  expand_and_create_pages(table_id, __file_size(table_id), start, end,
-                          num_new_pages);
+  expand_pages(table_id, __file_size(table_id), start, end, num_new_pages);
   return 0;
 }
 
-// Allocate an on-disk page from the free page list
-pagenum_t file_alloc_page(int64_t table_id) {
-  if (table_id < 0) {
+int file_truncate(int64_t table_id, uint64_t num_pages) {
+  auto fd = table_fd(table_id);
+  if (fd < 0 || num_pages < 2) {
+    LOG_ERR(1, "invalid parameters");
+    return 1;
+  }
+  if (table_map_ptr(table_id) != NULL) {
+    LOG_WARN("cannot truncate read-only table %lld", table_id);
+    return 1;
+  }
+  auto& table = tables[table_id];
+  if (write_staged_pages(table_id)) {
+    LOG_WARN("cannot write staged pages, errno: %s", strerror(errno));
+    return 1;
+  }
+  if (__file_size(table_id) <= num_pages * table.page_size) return 0;
+  if (tables[table_id].slots) {
+    if (resize_slot_map(table_id, num_pages) < 0) {
+      LOG_WARN("cannot truncate file, errno: %s", strerror(errno));
+      return 1;
+    }
+    return 0;
+  }
+  for (int stripe = 0; stripe < table.num_stripes; ++stripe) {
+    auto stripe_fd = fd;
+    auto stripe_size = num_pages * table.page_size;
+    if (table.num_stripes > 1) {
+      stripe_fd = table.stripe_fds[stripe];
+      stripe_size =
+          stripe_num_pages(table, stripe, num_pages) * table.page_size;
+    }
+    if (ftruncate(stripe_fd, stripe_size) < 0) {
+      LOG_WARN("cannot truncate file, errno: %s", strerror(errno));
+      return 1;
+    }
+    if (sync_fd(stripe_fd, table_id, kIoSiteMeta) < 0) {
+      LOG_WARN("cannot sync file after truncate, errno: %s", strerror(errno));
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Allocate an on-disk page
+pagenum_t file_alloc_page(int64_t table_id, pagenum_t hint) {
+  if (table_id < 0 || table_fd(table_id) < 0) {
     LOG_ERR(1, "file descriptor cannot be a negative value");
     return 0;
   }
+  if (table_map_ptr(table_id) != NULL) {
+    LOG_WARN("cannot allocate a page of read-only table %lld", table_id);
+    return 0;
+  }
 
-  header_page_t header_page;
-  __file_read_header_page(table_id, &header_page);
-  if (header_page.header.first_free_page == 0) {
-    expand_and_create_pages(table_id, __file_size(table_id));
-    __file_read_header_page(table_id, &header_page);
+  auto& table = tables[table_id];
+  pthread_mutex_lock(&table.space_latch);
+  auto group = file_find_free_space_map(table_id, space_map_group(hint));
+  if (group < 0) {
+    if (grow_space_maps(table_id)) {
+      pthread_mutex_unlock(&table.space_latch);
+      LOG_ERR(1, "expand database file failed due to some reason");
+      return 0;
+    }
+    group = file_find_free_space_map(table_id, space_map_group(hint));
   }
 
-  auto pagenum = header_page.header.first_free_page;
+  space_map_page_t space_map;
+  __file_read_page(table_id, space_map_pagenum(group), &space_map.page,
+                   kPageSize);
+  auto pagenum = file_take_free_page(table_id, &space_map, group, hint);
   if (pagenum == 0) {
-    LOG_ERR(1, "expand database file failed due to some reason");
+    pthread_mutex_unlock(&table.space_latch);
+    LOG_ERR(1, "space map %lld of table %lld is corrupted", group, table_id);
     return 0;
   }
-
-  page_node_t allocated_page;
-  __file_read_page(table_id, pagenum, &allocated_page.page);
-  header_page.header.first_free_page = allocated_page.next_free_page;
-  __file_write_header_page(table_id, &header_page);
-
+  __file_write_page(table_id, space_map_pagenum(group), &space_map.page, true,
+                    kPageSize);
+  pthread_mutex_unlock(&table.space_latch);
   return pagenum;
 }
 
-// Free an on-disk page to the free page list
+// Free an on-disk page
 void file_free_page(int64_t table_id, pagenum_t pagenum) {
-  if (table_id < 0 || pagenum < 1) {
+  auto group = space_map_group(pagenum);
+  if (table_id < 0 || pagenum < 1 || table_fd(table_id) < 0 ||
+      pagenum == space_map_pagenum(group)) {
     LOG_ERR(1, "cannot free the page, wrong parameter");
     return;
   }
-  header_page_t header_page;
-  page_node_t page_node;
-  __file_read_header_page(table_id, &header_page);
-  __file_read_page(table_id, pagenum, &page_node.page);
 
-  page_node.next_free_page = header_page.header.first_free_page;
-  header_page.header.first_free_page = pagenum;
-  __file_write_header_page(table_id, &header_page);
-  __file_write_page(table_id, pagenum, &page_node.page);
+  auto& table = tables[table_id];
+  pthread_mutex_lock(&table.space_latch);
+  space_map_page_t space_map;
+  __file_read_page(table_id, space_map_pagenum(group), &space_map.page,
+                   kPageSize);
+  if (!file_give_back_page(table_id, &space_map, pagenum)) {
+    pthread_mutex_unlock(&table.space_latch);
+    LOG_WARN("page %llu of table %lld is not in use", pagenum, table_id);
+    return;
+  }
+  __file_write_page(table_id, space_map_pagenum(group), &space_map.page, true,
+                    kPageSize);
+  pthread_mutex_unlock(&table.space_latch);
 }
 
 // Read an on-disk page into the in-memory page structure(dest)
@@ -343,26 +1723,617 @@ void file_write_header_page(int64_t table_id, const header_page_t* src,
 uint64_t file_size(int64_t table_id) { return __file_size(table_id); }
 
 void file_sync_all() {
-  for (auto table_id : table_id_map) {
-    if (fsync(table_id.second) < 0) {
+  pthread_rwlock_rdlock(&table_registry_latch);
+  for (auto& table_pair : table_map) {
+    if (write_staged_pages(table_pair.second) ||
+        sync_table(table_pair.second, kIoSiteBatch) < 0) {
+      pthread_rwlock_unlock(&table_registry_latch);
       LOG_ERR(1, "cannot sync, %s", strerror(errno));
       return;
     }
   }
+  pthread_rwlock_unlock(&table_registry_latch);
 }
 
 // Stop referencing the database file
 void file_close_table_files() {
-  for (auto table_id_pair : table_map) {
-    auto table_id = table_id_map[table_id_pair.second];
-    if (table_id > 0) {
-      if (close(table_id) < 0) {
-        LOG_WARN("failed to close %s, errno: %s", table_id_pair.first.c_str(),
-                 strerror(errno));
-      }
+  pthread_rwlock_wrlock(&table_registry_latch);
+  for (auto& table_pair : table_map) {
+    auto& table = tables[table_pair.second];
+    if (write_staged_pages(table_pair.second)) {
+      LOG_WARN("failed to write staged pages of %s, errno: %s",
+               table_pair.first.c_str(), strerror(errno));
+    }
+    auto fd = table.fd.exchange(-1, std::memory_order_acq_rel);
+    if (fd >= 0 && close(fd) < 0) {
+      LOG_WARN("failed to close %s, errno: %s", table_pair.first.c_str(),
+               strerror(errno));
     }
+    auto* map = table.map.exchange(nullptr, std::memory_order_acq_rel);
+    if (map != NULL) {
+      munmap((void*)map, table.num_mapped_pages * table.page_size);
+    }
+    table.num_mapped_pages = 0;
+    table.slots.reset();
+    close_stripes(table);
+    table.stripe_fds[0] = -1;
+    table.path.clear();
   }
   table_map.clear();
-  table_id_map.clear();
+  pthread_rwlock_unlock(&table_registry_latch);
   sync();
-}
\ No newline at end of file
+}
+
+// submit requests which are not done yet
+// return 0 on success
+int submit_requests(file_io_request_t* reqs, int n) {
+#ifdef DB_HAS_IO_URING
+  auto* ring = get_io_ring();
+  if (ring != NULL) {
+    int i = 0;
+    while (i < n) {
+      // wait for free submission entries
+      while (ring->in_flight >= ring->sq_entries) file_io_reap(true);
+
+      unsigned to_submit = 0;
+      auto tail = ring->sq_tail->load(std::memory_order_relaxed);
+      while (i < n && ring->in_flight < ring->sq_entries) {
+        auto& req = reqs[i++];
+        if (req.done) continue;
+        uint64_t offset = 0;
+        auto fd = table_fd(req.table_id);
+        auto& table = tables[req.table_id];
+        if (fd >= 0) fd = page_location(req.table_id, req.pagenum, &offset);
+        if (fd < 0 || table.slots ||
+            (table.direct && !is_page_aligned(req.page))) {
+          // unaligned page of direct I/O table needs bouncing, pages of
+          // compressed table are (de)compressed on the calling thread
+          sync_io(&req);
+          continue;
+        }
+        auto idx = tail & ring->sq_mask;
+        auto* sqe = &ring->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = req.is_write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)req.page;
+        sqe->len = table.page_size;
+        sqe->off = offset;
+        sqe->user_data = (uint64_t)&req;
+        req.io_start = io_stats_start();
+        ring->sq_array[idx] = idx;
+        ++tail;
+        ++to_submit;
+        ++ring->in_flight;
+      }
+      ring->sq_tail->store(tail, std::memory_order_release);
+
+      while (to_submit > 0) {
+        auto res = syscall(__NR_io_uring_enter, ring->fd, to_submit, 0, 0,
+                           NULL, 0);
+        if (res < 0) {
+          if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+            reap_io_ring(*ring);
+            continue;
+          }
+          LOG_ERR(1, "failed to submit I/O, errno: %s", strerror(errno));
+          return 1;
+        }
+        to_submit -= res;
+      }
+    }
+    return 0;
+  }
+#endif
+
+  for (int i = 0; i < n; ++i) {
+    if (!reqs[i].done) sync_io(&reqs[i]);
+  }
+  return 0;
+}
+
+// write pages of the requests through the double-write area
+// the area is written and synced, then the pages in place (from their
+// images in the area) and their tables are synced, so the area can be
+// reused by the next batch. requests are done on return
+// return 0 on success
+int double_write_requests(const std::vector<file_io_request_t*>& writes) {
+  auto& dw = double_write;
+  pthread_mutex_lock(&dw.latch);
+  uint64_t header_size = sizeof(double_write_header_t) +
+                         writes.size() * sizeof(double_write_entry_t);
+  auto images_offset = (header_size + kPageSize - 1) / kPageSize * kPageSize;
+  uint64_t total_size = images_offset;
+  for (auto* req : writes) total_size += tables[req->table_id].page_size;
+  if (total_size > dw.capacity) {
+    byte* buffer = NULL;
+    if (posix_memalign((void**)&buffer, kPageSize, total_size)) {
+      pthread_mutex_unlock(&dw.latch);
+      LOG_ERR(1, "failed to allocate double-write buffer");
+      return 1;
+    }
+    free(dw.buffer);
+    dw.buffer = buffer;
+    dw.capacity = total_size;
+  }
+
+  memset(dw.buffer, 0, images_offset);
+  auto* header = (double_write_header_t*)dw.buffer;
+  auto* entries = (double_write_entry_t*)(header + 1);
+  std::vector<file_io_request_t> in_place(writes.size());
+  auto offset = images_offset;
+  for (size_t i = 0; i < writes.size(); ++i) {
+    auto* req = writes[i];
+    auto size = tables[req->table_id].page_size;
+    auto* image = (page_t*)(dw.buffer + offset);
+    memcpy(image, req->page, size);
+    set_page_checksum(req->table_id, req->pagenum, image);
+    entries[i] = {req->table_id, req->pagenum, offset, size};
+
+    memset(&in_place[i], 0, sizeof(file_io_request_t));
+    in_place[i].table_id = req->table_id;
+    in_place[i].pagenum = req->pagenum;
+    in_place[i].page = image;
+    in_place[i].is_write = true;
+    offset += size;
+  }
+  header->magic = kDoubleWriteMagic;
+  header->num_pages = writes.size();
+  header->images_offset = images_offset;
+  header->checksum = page_checksum(dw.buffer, images_offset,
+                                   offsetof(double_write_header_t, checksum));
+
+  if (pwrite_full(dw.fd, dw.buffer, total_size, 0, -1,
+                  kIoSiteDoubleWrite) < 0 ||
+      sync_fd(dw.fd, -1, kIoSiteDoubleWrite) < 0) {
+    pthread_mutex_unlock(&dw.latch);
+    LOG_ERR(1, "cannot write double-write area, errno: %s", strerror(errno));
+    return 1;
+  }
+  if (submit_requests(in_place.data(), in_place.size())) {
+    pthread_mutex_unlock(&dw.latch);
+    return 1;
+  }
+  file_io_wait(in_place.data(), in_place.size());
+  int result = 0;
+  for (auto* req : writes) {
+    if (table_fd(req->table_id) >= 0 &&
+        sync_table(req->table_id, kIoSiteDoubleWrite) < 0)
+      result = -errno;
+  }
+  pthread_mutex_unlock(&dw.latch);
+
+  for (size_t i = 0; i < writes.size(); ++i) {
+    complete_io(writes[i],
+                in_place[i].result < 0 ? in_place[i].result : result);
+  }
+  return 0;
+}
+
+int file_io_submit(file_io_request_t* reqs, int n) {
+  if ((reqs == NULL && n > 0) || n < 0) {
+    LOG_ERR(1, "invalid parameters");
+    return 1;
+  }
+  std::vector<file_io_request_t*> writes;
+  auto double_write_on = double_write.fd.load(std::memory_order_relaxed) >= 0;
+  for (int i = 0; i < n; ++i) {
+    reqs[i].done = false;
+    reqs[i].result = 0;
+    if (table_fd(reqs[i].table_id) < 0) continue;
+    if (!reqs[i].is_write) {
+      if (read_staged_page(reqs[i].table_id, reqs[i].pagenum, reqs[i].page,
+                           tables[reqs[i].table_id].page_size))
+        complete_io(&reqs[i], 0);
+      continue;
+    }
+    unstage_page(reqs[i].table_id, reqs[i].pagenum);
+    // batched writes are synced by file_sync_all (or double write)
+    tables[reqs[i].table_id].num_unsynced_writes.fetch_add(1);
+    if (double_write_on)
+      writes.push_back(&reqs[i]);
+    else
+      set_page_checksum(reqs[i].table_id, reqs[i].pagenum, reqs[i].page);
+  }
+  if (!writes.empty() && double_write_requests(writes)) return 1;
+  return submit_requests(reqs, n);
+}
+
+int file_io_reap(int wait) {
+#ifdef DB_HAS_IO_URING
+  auto* ring = get_io_ring();
+  if (ring == NULL || ring->in_flight == 0) return 0;
+
+  auto reaped = reap_io_ring(*ring);
+  while (reaped == 0 && wait) {
+    auto res = syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+                       IORING_ENTER_GETEVENTS, NULL, 0);
+    if (res < 0 && errno != EINTR) {
+      LOG_ERR(1, "failed to wait for I/O, errno: %s", strerror(errno));
+      return -1;
+    }
+    reaped = reap_io_ring(*ring);
+  }
+  return reaped;
+#else
+  return 0;
+#endif
+}
+
+int file_io_wait(file_io_request_t* reqs, int n) {
+  if ((reqs == NULL && n > 0) || n < 0) {
+    LOG_ERR(1, "invalid parameters");
+    return 1;
+  }
+  int failed = 0;
+  for (int i = 0; i < n; ++i) {
+    while (!reqs[i].done) {
+      if (file_io_reap(true) < 0) return 1;
+    }
+    if (reqs[i].result < 0) failed = 1;
+  }
+  return failed;
+}
+
+int file_open_double_write(const char* path) {
+  auto& dw = double_write;
+  pthread_mutex_lock(&dw.latch);
+  // pages of the last batch are synced in place, so the old area is not
+  // needed any more
+  auto old_fd = dw.fd.exchange(-1);
+  if (old_fd >= 0) {
+    close(old_fd);
+    if (path == NULL || dw.path != path) unlink(dw.path.c_str());
+  }
+  dw.pending.clear();
+  if (path == NULL) {
+    pthread_mutex_unlock(&dw.latch);
+    return 0;
+  }
+
+  auto fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    pthread_mutex_unlock(&dw.latch);
+    LOG_WARN("failed to open double-write area %s, errno: %s", path,
+             strerror(errno));
+    return 1;
+  }
+  // the area is torn if the crash was in the middle of writing it, then
+  // pages in place are not written yet
+  double_write_header_t header;
+  if (!pread_full(fd, &header, sizeof(header), 0, -1, kIoSiteDoubleWrite) &&
+      header.magic == kDoubleWriteMagic &&
+      header.images_offset >=
+          sizeof(header) + header.num_pages * sizeof(double_write_entry_t)) {
+    std::vector<byte> block(header.images_offset);
+    if (pread_full(fd, block.data(), block.size(), 0, -1,
+                   kIoSiteDoubleWrite) == 0 &&
+        page_checksum(block.data(), block.size(),
+                      offsetof(double_write_header_t, checksum)) ==
+            header.checksum) {
+      auto* entries =
+          (double_write_entry_t*)(block.data() + sizeof(header));
+      dw.pending.assign(entries, entries + header.num_pages);
+    }
+  }
+  dw.fd.store(fd);
+  dw.path = path;
+  std::set<int64_t> table_ids;
+  for (auto& entry : dw.pending) table_ids.insert(entry.table_id);
+  pthread_mutex_unlock(&dw.latch);
+
+  // pages are restored on open
+  for (auto table_id : table_ids) {
+    char filename[128];
+    sprintf(filename, "DATA%lld", table_id);
+    if (table_id >= 0 && table_id < kMaxNumTables &&
+        access(filename, F_OK) == 0)
+      file_open_table_file(table_id);
+  }
+  pthread_mutex_lock(&dw.latch);
+  dw.pending.clear();
+  pthread_mutex_unlock(&dw.latch);
+  return 0;
+}
+
+void file_close_double_write() {
+  auto& dw = double_write;
+  pthread_mutex_lock(&dw.latch);
+  auto fd = dw.fd.exchange(-1);
+  if (fd >= 0) {
+    close(fd);
+    unlink(dw.path.c_str());
+  }
+  free(dw.buffer);
+  dw.buffer = NULL;
+  dw.capacity = 0;
+  dw.pending.clear();
+  pthread_mutex_unlock(&dw.latch);
+}
+
+void file_set_direct_io(int enable) { direct_io_enabled = enable; }
+
+void file_set_compression(int enable) { compression_enabled = enable; }
+
+int file_set_page_size(uint64_t page_size) {
+  if (!is_valid_page_size(page_size)) {
+    LOG_WARN("page size %llu is not a power of two in [%llu, %llu]",
+             page_size, kPageSize, kMaxPageSize);
+    return 1;
+  }
+  new_table_page_size = page_size;
+  return 0;
+}
+
+uint64_t file_page_size(int64_t table_id) {
+  if (table_fd(table_id) < 0) return kPageSize;
+  return tables[table_id].page_size;
+}
+
+void file_set_deferred_sync(int enable) {
+  deferred_sync_enabled.store(enable, std::memory_order_relaxed);
+}
+
+int file_set_striping(int num_stripes, uint64_t stripe_pages,
+                      const char* const* dirs) {
+  if (num_stripes < 1 || num_stripes > kMaxStripes ||
+      (num_stripes > 1 && stripe_pages == 0)) {
+    LOG_WARN("invalid striping, %d stripes of %llu pages", num_stripes,
+             stripe_pages);
+    return 1;
+  }
+  striping_dirs.clear();
+  for (int stripe = 1; dirs != NULL && stripe < num_stripes; ++stripe) {
+    if (dirs[stripe - 1] == NULL) {
+      LOG_WARN("directory of stripe %d is missing", stripe);
+      striping_dirs.clear();
+      return 1;
+    }
+    striping_dirs.push_back(dirs[stripe - 1]);
+  }
+  striping_num_stripes = num_stripes;
+  striping_stripe_pages = stripe_pages;
+  return 0;
+}
+
+int file_num_stripes(int64_t table_id) {
+  if (table_fd(table_id) < 0) return 1;
+  return tables[table_id].num_stripes;
+}
+
+int file_is_compressed(int64_t table_id) {
+  if (table_fd(table_id) < 0) return false;
+  return tables[table_id].slots != nullptr;
+}
+
+int file_is_direct_io(int64_t table_id) {
+  if (table_fd(table_id) < 0) return false;
+  return tables[table_id].direct;
+}
+
+const page_t* file_mapped_page(int64_t table_id, pagenum_t pagenum) {
+  auto* map = table_map_ptr(table_id);
+  if (map == NULL) return NULL;
+  // link of a stale page may point beyond the file
+  if (pagenum >= tables[table_id].num_mapped_pages) {
+    LOG_WARN("page %llu is out of the mapped table %lld", pagenum,
+             table_id);
+    return NULL;
+  }
+  return (const page_t*)((const byte*)map +
+                         pagenum * tables[table_id].page_size);
+}
+
+void file_prefetch_pages(int64_t table_id, pagenum_t pagenum, uint64_t n) {
+  auto* map = table_map_ptr(table_id);
+  if (map == NULL) return;
+  auto num_pages = tables[table_id].num_mapped_pages;
+  if (pagenum >= num_pages) return;
+  n = std::min(n, num_pages - pagenum);
+  // failure is harmless, the page will be faulted in on access
+  auto page_size = tables[table_id].page_size;
+  madvise((void*)((const byte*)map + pagenum * page_size), n * page_size,
+          MADV_WILLNEED);
+}
+
+// count free pages of the space map
+uint64_t count_free_pages(const space_map_page_t* map) {
+  auto num_pages = map->space_map.num_pages;
+  uint64_t num_used = 0;
+  for (uint64_t i = 0; i * 64 < num_pages; ++i) {
+    auto used = map->space_map.bitmap[i];
+    if (num_pages - i * 64 < 64) used &= (1ULL << (num_pages % 64)) - 1;
+    num_used += __builtin_popcountll(used);
+  }
+  return num_pages - num_used;
+}
+
+void space_map_init(space_map_page_t* map, uint64_t group) {
+  memset(map, 0, sizeof(space_map_page_t));
+  // header and space map pages are always in use
+  auto& bitmap = map->space_map.bitmap;
+  auto idx = space_map_pagenum(group) % kPagesPerSpaceMap;
+  bitmap[idx / 64] |= 1ULL << (idx % 64);
+  if (group == 0) bitmap[0] |= 1ULL << kHeaderPagenum;
+}
+
+uint64_t space_map_extend(space_map_page_t* map, uint64_t num_pages) {
+  auto old_num_free_pages = map->space_map.num_free_pages;
+  if (num_pages > kPagesPerSpaceMap) num_pages = kPagesPerSpaceMap;
+  if (num_pages <= map->space_map.num_pages) return 0;
+  map->space_map.num_pages = num_pages;
+  map->space_map.num_free_pages = count_free_pages(map);
+  return map->space_map.num_free_pages - old_num_free_pages;
+}
+
+// free pages of the extent as bits (pages beyond num_pages are excluded)
+uint64_t extent_free_bits(const space_map_page_t* map, uint64_t extent) {
+  auto num_pages = map->space_map.num_pages;
+  auto first = extent * kPagesPerExtent;
+  if (first >= num_pages) return 0;
+  auto free_bits = ~map->space_map.bitmap[extent];
+  if (num_pages - first < kPagesPerExtent)
+    free_bits &= (1ULL << (num_pages - first)) - 1;
+  return free_bits;
+}
+
+// mark the lowest free page of free_bits in use
+// return index of the page in the group
+int64_t take_free_page(space_map_page_t* map, uint64_t extent,
+                       uint64_t free_bits) {
+  auto bit = __builtin_ctzll(free_bits);
+  map->space_map.bitmap[extent] |= 1ULL << bit;
+  --map->space_map.num_free_pages;
+  return extent * kPagesPerExtent + bit;
+}
+
+int64_t space_map_alloc(space_map_page_t* map, uint64_t start) {
+  auto& sm = map->space_map;
+  if (sm.num_free_pages == 0) return -1;
+  if (start >= sm.num_pages) start = 0;
+  auto num_extents = (sm.num_pages + kPagesPerExtent - 1) / kPagesPerExtent;
+  auto start_extent = start / kPagesPerExtent;
+
+  // extent of start
+  auto free_bits = extent_free_bits(map, start_extent);
+  auto after_start = free_bits & (~0ULL << (start % kPagesPerExtent));
+  if (after_start != 0) return take_free_page(map, start_extent, after_start);
+  if (free_bits != 0) return take_free_page(map, start_extent, free_bits);
+
+  // an extent with room for the next pages placed near the new one
+  // (filling scattered holes would break up the sequence again)
+  // without hint, pages are packed from the front instead
+  for (uint64_t i = 1; start != 0 && i < num_extents; ++i) {
+    auto extent = (start_extent + i) % num_extents;
+    free_bits = extent_free_bits(map, extent);
+    if (__builtin_popcountll(free_bits) >= kMinFreePagesInExtent)
+      return take_free_page(map, extent, free_bits);
+  }
+
+  // any free page
+  for (uint64_t i = 1; i < num_extents; ++i) {
+    auto extent = (start_extent + i) % num_extents;
+    free_bits = extent_free_bits(map, extent);
+    if (free_bits != 0) return take_free_page(map, extent, free_bits);
+  }
+  return -1;
+}
+
+bool space_map_free(space_map_page_t* map, uint64_t idx) {
+  auto& sm = map->space_map;
+  if (idx >= sm.num_pages) return false;
+  auto mask = 1ULL << (idx % 64);
+  if ((sm.bitmap[idx / 64] & mask) == 0) return false;
+  sm.bitmap[idx / 64] &= ~mask;
+  ++sm.num_free_pages;
+  return true;
+}
+
+int64_t space_map_last_used(const space_map_page_t* map, uint64_t group) {
+  auto& sm = map->space_map;
+  auto num_pages = std::min(sm.num_pages, kPagesPerSpaceMap);
+  for (int64_t i = (num_pages + 63) / 64 - 1; i >= 0; --i) {
+    auto used = sm.bitmap[i];
+    if (num_pages - i * 64 < 64) used &= (1ULL << (num_pages % 64)) - 1;
+    // header and space map pages are the lowest ones of the group
+    if (i == 0) used &= group == 0 ? ~3ULL : ~1ULL;
+    if (used != 0) return i * 64 + 63 - __builtin_clzll(used);
+  }
+  return -1;
+}
+
+int64_t file_find_free_space_map(int64_t table_id, uint64_t hint_group) {
+  if (table_fd(table_id) < 0) return -1;
+  auto& table = tables[table_id];
+  auto num_groups = table.num_space_maps.load(std::memory_order_acquire);
+  if (num_groups == 0) return -1;
+  if (hint_group >= num_groups) hint_group = 0;
+  for (uint64_t i = 0; i < num_groups; ++i) {
+    auto group = (hint_group + i) % num_groups;
+    if (table.free_pages[group].load(std::memory_order_relaxed) > 0)
+      return group;
+  }
+  return -1;
+}
+
+uint64_t file_grow_space_maps(int64_t table_id, uint64_t num_of_pages,
+                              space_map_get_t get, space_map_put_t put) {
+  pagenum_t start, end;
+  uint64_t num_new_pages = 0;
+  if (file_expand_twice(table_id, &start, &end, &num_new_pages) ||
+      num_new_pages == 0)
+    return 0;
+  auto new_num_of_pages = num_of_pages + num_new_pages;
+  if (space_map_group(new_num_of_pages - 1) >= kMaxNumSpaceMaps) return 0;
+
+  for (auto group = space_map_group(num_of_pages - 1);
+       group <= space_map_group(new_num_of_pages - 1); ++group) {
+    auto group_start = group * kPagesPerSpaceMap;
+    auto* map = get(table_id, group, group_start >= num_of_pages);
+    auto added = space_map_extend(
+        map, std::min(kPagesPerSpaceMap, new_num_of_pages - group_start));
+    file_update_space_summary(table_id, group, added);
+    put(table_id, group, map);
+  }
+  return new_num_of_pages;
+}
+
+pagenum_t file_take_free_page(int64_t table_id, space_map_page_t* map,
+                              uint64_t group, pagenum_t hint) {
+  auto start =
+      space_map_group(hint) == group ? hint % kPagesPerSpaceMap : 0;
+  auto idx = space_map_alloc(map, start);
+  if (idx < 0) return 0;
+  file_update_space_summary(table_id, group, -1);
+  return group * kPagesPerSpaceMap + idx;
+}
+
+bool file_give_back_page(int64_t table_id, space_map_page_t* map,
+                         pagenum_t pagenum) {
+  if (!space_map_free(map, pagenum % kPagesPerSpaceMap)) return false;
+  file_update_space_summary(table_id, space_map_group(pagenum), 1);
+  return true;
+}
+
+void file_update_space_summary(int64_t table_id, uint64_t group,
+                               int64_t delta) {
+  if (table_id < 0 || table_id >= kMaxNumTables ||
+      group >= kMaxNumSpaceMaps || !tables[table_id].free_pages) {
+    LOG_ERR(1, "invalid parameters");
+    return;
+  }
+  auto& table = tables[table_id];
+  table.free_pages[group].fetch_add(delta, std::memory_order_relaxed);
+  if (group >= table.num_space_maps.load(std::memory_order_relaxed))
+    table.num_space_maps.store(group + 1, std::memory_order_release);
+}
+
+void file_truncate_space_summary(int64_t table_id, uint64_t num_groups) {
+  if (table_id < 0 || table_id >= kMaxNumTables ||
+      !tables[table_id].free_pages) {
+    LOG_ERR(1, "invalid parameters");
+    return;
+  }
+  auto& table = tables[table_id];
+  auto old_num_groups = table.num_space_maps.load(std::memory_order_acquire);
+  if (num_groups >= old_num_groups) return;
+  table.num_space_maps.store(num_groups, std::memory_order_release);
+  for (auto group = num_groups; group < old_num_groups; ++group)
+    table.free_pages[group].store(0, std::memory_order_relaxed);
+}
+
+int file_is_read_only(int64_t table_id) {
+  return table_map_ptr(table_id) != NULL;
+}
+
+int file_io_is_async() {
+#ifdef DB_HAS_IO_URING
+  return get_io_ring() != NULL;
+#else
+  return false;
+#endif
+}
+
+void file_io_set_async(int enable) {
+  io_uring_enabled.store(enable, std::memory_order_relaxed);
+}
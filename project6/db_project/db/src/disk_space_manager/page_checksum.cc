@@ -0,0 +1,116 @@
+#include "disk_space_manager/page_checksum.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+#include <cstring>
+
+// utilities used in page_checksum.cc (not exported in page_checksum.h)
+const uint32_t kCrc32cPolynomial = 0x82f63b78;  // reflected
+
+struct crc32c_table_t {
+  uint32_t entries[8][256];  // slicing-by-8
+
+  crc32c_table_t() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit)
+        crc = (crc >> 1) ^ (crc & 1 ? kCrc32cPolynomial : 0);
+      entries[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (int k = 1; k < 8; ++k) {
+        auto prev = entries[k - 1][i];
+        entries[k][i] = (prev >> 8) ^ entries[0][prev & 0xff];
+      }
+    }
+  }
+};
+
+const crc32c_table_t crc32c_table;
+
+uint32_t crc32c_software(uint32_t crc, const byte *data, uint64_t size) {
+  auto &t = crc32c_table.entries;
+  auto *p = (const uint8_t *)data;
+  while (size >= 8) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    v ^= crc;
+    crc = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^
+          t[4][(v >> 24) & 0xff] ^ t[3][(v >> 32) & 0xff] ^
+          t[2][(v >> 40) & 0xff] ^ t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+    p += 8;
+    size -= 8;
+  }
+  while (size-- > 0) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) uint32_t crc32c_hardware(
+    uint32_t crc, const byte *data, uint64_t size) {
+  auto *p = (const uint8_t *)data;
+  uint64_t crc64 = crc;
+  while (size >= 8) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    crc64 = __builtin_ia32_crc32di(crc64, v);
+    p += 8;
+    size -= 8;
+  }
+  crc = (uint32_t)crc64;
+  while (size-- > 0) crc = __builtin_ia32_crc32qi(crc, *p++);
+  return crc;
+}
+
+bool has_crc32c_instruction() {
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+  return ecx & bit_SSE4_2;
+}
+#elif defined(__aarch64__) && defined(__linux__)
+__attribute__((target("+crc"))) uint32_t crc32c_hardware(uint32_t crc,
+                                                         const byte *data,
+                                                         uint64_t size) {
+  auto *p = (const uint8_t *)data;
+  while (size >= 8) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    crc = __builtin_aarch64_crc32cx(crc, v);
+    p += 8;
+    size -= 8;
+  }
+  while (size-- > 0) crc = __builtin_aarch64_crc32cb(crc, *p++);
+  return crc;
+}
+
+bool has_crc32c_instruction() { return getauxval(AT_HWCAP) & HWCAP_CRC32; }
+#else
+uint32_t crc32c_hardware(uint32_t crc, const byte *data, uint64_t size) {
+  return crc32c_software(crc, data, size);
+}
+
+bool has_crc32c_instruction() { return false; }
+#endif
+
+const bool crc32c_instruction = has_crc32c_instruction();
+
+uint32_t crc32c(uint32_t crc, const byte *data, uint64_t size) {
+  if (data == NULL && size > 0) return crc;
+  crc = ~crc;
+  crc = crc32c_instruction ? crc32c_hardware(crc, data, size)
+                           : crc32c_software(crc, data, size);
+  return ~crc;
+}
+
+uint32_t page_checksum(const byte *page, uint64_t size, uint64_t offset) {
+  const byte zero[sizeof(uint32_t)] = {0};
+  auto crc = crc32c(0, page, offset);
+  crc = crc32c(crc, zero, sizeof(zero));
+  crc = crc32c(crc, page + offset + sizeof(zero),
+               size - offset - sizeof(zero));
+  return crc != 0 ? crc : 1;
+}
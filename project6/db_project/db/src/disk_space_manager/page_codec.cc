@@ -0,0 +1,146 @@
+#include "disk_space_manager/page_codec.h"
+
+#include <cstring>
+
+// utilities used in page_codec.cc (not exported in page_codec.h)
+const uint32_t kMinMatch = 4;
+const uint32_t kHashBits = 12;
+const uint32_t kMaxOffset = UINT16_MAX;
+// misses in a row before the search skips bytes (incompressible data)
+const uint32_t kSkipTrigger = 6;
+
+uint32_t codec_hash(const byte *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+// write extended length (255 per byte, the last one is less than 255)
+// return false if dst is full
+bool codec_put_length(byte *dst, uint32_t capacity, uint32_t *op,
+                      uint32_t len) {
+  while (true) {
+    if (*op >= capacity) return false;
+    if (len < 255) {
+      dst[(*op)++] = (byte)len;
+      return true;
+    }
+    dst[(*op)++] = (byte)255;
+    len -= 255;
+  }
+}
+
+// read extended length
+// return false if src ends
+bool codec_get_length(const byte *src, uint32_t size, uint32_t *ip,
+                      uint32_t *len) {
+  while (true) {
+    if (*ip >= size) return false;
+    auto v = (uint8_t)src[(*ip)++];
+    *len += v;
+    if (v < 255) return true;
+  }
+}
+
+// write a sequence, match_len 0 means the last sequence
+// return false if dst is full
+bool codec_put_sequence(byte *dst, uint32_t capacity, uint32_t *op,
+                        const byte *literals, uint32_t literal_len,
+                        uint32_t offset, uint32_t match_len) {
+  if (*op >= capacity) return false;
+  auto literal_code = literal_len < 15 ? literal_len : 15;
+  uint32_t match_code = 0;
+  if (match_len > 0)
+    match_code = match_len - kMinMatch < 15 ? match_len - kMinMatch : 15;
+  dst[(*op)++] = (byte)(literal_code << 4 | match_code);
+  if (literal_code == 15 &&
+      !codec_put_length(dst, capacity, op, literal_len - 15))
+    return false;
+
+  if (*op + literal_len > capacity) return false;
+  memcpy(dst + *op, literals, literal_len);
+  *op += literal_len;
+  if (match_len == 0) return true;
+
+  if (*op + 2 > capacity) return false;
+  dst[(*op)++] = (byte)(offset & 0xff);
+  dst[(*op)++] = (byte)(offset >> 8);
+  if (match_code == 15 &&
+      !codec_put_length(dst, capacity, op, match_len - kMinMatch - 15))
+    return false;
+  return true;
+}
+
+uint32_t page_compress(const byte *src, uint32_t src_size, byte *dst,
+                       uint32_t dst_capacity) {
+  if ((src == NULL && src_size > 0) || dst == NULL) return 0;
+
+  // positions + 1 of the last 4-byte sequences (0 for none)
+  uint32_t table[1 << kHashBits];
+  memset(table, 0, sizeof(table));
+
+  uint32_t ip = 0, anchor = 0, op = 0, misses = 0;
+  while (ip + kMinMatch <= src_size) {
+    auto h = codec_hash(src + ip);
+    auto candidate = table[h];
+    table[h] = ip + 1;
+    if (candidate == 0 || ip - (candidate - 1) > kMaxOffset ||
+        memcmp(src + candidate - 1, src + ip, kMinMatch) != 0) {
+      ip += 1 + (misses++ >> kSkipTrigger);
+      continue;
+    }
+    misses = 0;
+
+    auto match = candidate - 1;
+    auto match_len = kMinMatch;
+    while (ip + match_len < src_size &&
+           src[match + match_len] == src[ip + match_len])
+      ++match_len;
+    if (!codec_put_sequence(dst, dst_capacity, &op, src + anchor, ip - anchor,
+                            ip - match, match_len))
+      return 0;
+    ip += match_len;
+    anchor = ip;
+    // keep the end of the match findable
+    if (ip + 2 <= src_size) table[codec_hash(src + ip - 2)] = ip - 1;
+  }
+
+  if (!codec_put_sequence(dst, dst_capacity, &op, src + anchor,
+                          src_size - anchor, 0, 0))
+    return 0;
+  return op;
+}
+
+int64_t page_decompress(const byte *src, uint32_t src_size, byte *dst,
+                        uint32_t dst_capacity) {
+  if ((src == NULL && src_size > 0) || dst == NULL) return -1;
+
+  uint32_t ip = 0, op = 0;
+  while (ip < src_size) {
+    auto token = (uint8_t)src[ip++];
+    uint32_t literal_len = token >> 4;
+    if (literal_len == 15 &&
+        !codec_get_length(src, src_size, &ip, &literal_len))
+      return -1;
+    if (ip + literal_len > src_size || op + literal_len > dst_capacity)
+      return -1;
+    memcpy(dst + op, src + ip, literal_len);
+    ip += literal_len;
+    op += literal_len;
+    if (ip == src_size) break;  // the last sequence
+
+    if (ip + 2 > src_size) return -1;
+    uint32_t offset = (uint8_t)src[ip] | (uint32_t)(uint8_t)src[ip + 1] << 8;
+    ip += 2;
+    uint32_t match_len = token & 15;
+    if (match_len == 15 &&
+        !codec_get_length(src, src_size, &ip, &match_len))
+      return -1;
+    match_len += kMinMatch;
+    if (offset == 0 || offset > op || op + match_len > dst_capacity)
+      return -1;
+    // byte by byte, the match may overlap its output (runs)
+    for (uint32_t i = 0; i < match_len; ++i, ++op) dst[op] = dst[op - offset];
+  }
+  return op;
+}
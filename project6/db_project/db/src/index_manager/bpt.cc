@@ -1,7 +1,9 @@
 #include "index_manager/bpt.h"
 
 #include <algorithm>
+#include <cstddef>
 #include <cstring>
+#include <vector>
 
 #include "log.h"
 #include "recovery.h"
@@ -38,10 +40,16 @@ struct internal_slot_t {
   pagenum_t pagenum;
 };
 
-const uint64_t kMaxNumInternalPageEntries =
-    (kPageSize - kBptPageHeaderSize) / sizeof(internal_slot_t);
+// for kPageSize pages, it scales with the page size (merge_threshold)
 const uint64_t kMergeOrDistributeThreshold = 2500;
 
+// page image in the stack, large enough for any page size
+union bpt_scratch_page_t {
+  byte data[kMaxPageSize];
+  bpt_leaf_page_t leaf;
+  bpt_internal_page_t internal;
+};
+
 // function definitions
 void move_memory(byte *base, int64_t src_offset, int64_t delta, uint32_t size);
 
@@ -51,10 +59,23 @@ leaf_slot_t *leaf_slot_array(bpt_leaf_page_t *page);
 // get internal slots array pointer
 internal_slot_t *internal_slot_array(bpt_internal_page_t *page);
 
-void init_leaf_page_struct(bpt_leaf_page_t *page, pagenum_t parent_page);
+// get right sibling of the leaf page (0 if the page is not a leaf)
+pagenum_t leaf_right_sibling(const page_t *page);
+
+// get page size of the tree page
+uint64_t bpt_page_size(const bpt_header_t *header);
+
+// get max number of entries of the internal page
+uint64_t max_internal_entries(const bpt_internal_page_t *page);
+
+// get free space of the leaf page above which it is merged or redistributed
+uint64_t merge_threshold(const bpt_leaf_page_t *page);
+
+void init_leaf_page_struct(bpt_leaf_page_t *page, pagenum_t parent_page,
+                           uint64_t page_size);
 
 void init_internal_page_struct(bpt_internal_page_t *page,
-                               pagenum_t parent_page);
+                               pagenum_t parent_page, uint64_t page_size);
 
 // get neighbor pagenum
 // if given page is first child then return right sibling
@@ -86,6 +107,31 @@ pagenum_t insert_into_parent(int64_t table_id, pagenum_t root, pagenum_t parent,
 
 pagenum_t find_leaf(int64_t table_id, pagenum_t root, bpt_key_t key);
 
+// get the leaf before the given leaf in the leaf chain
+// (found through the parents, separator keys may be stale after deletion)
+// return 0 if it is the leftmost leaf
+pagenum_t find_left_leaf(int64_t table_id, pagenum_t root, pagenum_t pagenum,
+                         pagenum_t parent);
+
+// get index of the link to the child of the internal page to find the key
+// (0 for the first child, i + 1 for the child of slot i)
+int find_child_link(bpt_internal_page_t *page, uint64_t num_of_keys,
+                    bpt_key_t key);
+
+// get child of the internal page to find the key
+pagenum_t find_child(bpt_internal_page_t *page, uint64_t num_of_keys,
+                     bpt_key_t key);
+
+// read child of the internal page to find the key (or if it is a leaf)
+// without pinning the page, see buffer_read_child_optimistic
+// parent is the page read last (NULL if it is pinned) linking to the page by
+// link, page and child_link are set to the page and the link to the child
+// return false if the page cannot be read so or changed while read
+bool find_child_optimistic(int64_t table_id, const page_t *parent, int link,
+                           pagenum_t pagenum, bpt_key_t key,
+                           const page_t **page, int *child_link,
+                           pagenum_t *child, bool *is_leaf);
+
 // insert new slot into bpt leaf page
 // return true on success
 bool insert_into_leaf(bpt_leaf_page_t *page, bpt_key_t key, uint16_t size,
@@ -170,35 +216,58 @@ leaf_slot_t *leaf_slot_array(bpt_leaf_page_t *page) {
   return (leaf_slot_t *)(page->page.data + kBptPageHeaderSize);
 }
 
+pagenum_t leaf_right_sibling(const page_t *page) {
+  auto *leaf = (const bpt_leaf_page_t *)page;
+  if (!leaf->leaf_data.header.is_leaf) return 0;
+  return leaf->leaf_data.right_sibling;
+}
+
 internal_slot_t *internal_slot_array(bpt_internal_page_t *page) {
   if (page == NULL) return NULL;
   return (internal_slot_t *)(page->page.data + kBptPageHeaderSize);
 }
 
-void init_leaf_page_struct(bpt_leaf_page_t *page, pagenum_t parent_page) {
+uint64_t bpt_page_size(const bpt_header_t *header) {
+  return header->page_size != 0 ? header->page_size : kPageSize;
+}
+
+uint64_t max_internal_entries(const bpt_internal_page_t *page) {
+  return (bpt_page_size(&page->internal_data.header) - kBptPageHeaderSize) /
+         sizeof(internal_slot_t);
+}
+
+uint64_t merge_threshold(const bpt_leaf_page_t *page) {
+  return kMergeOrDistributeThreshold *
+         (bpt_page_size(&page->leaf_data.header) / kPageSize);
+}
+
+void init_leaf_page_struct(bpt_leaf_page_t *page, pagenum_t parent_page,
+                           uint64_t page_size) {
   if (page == NULL) {
     LOG_ERR(2, "invalid parameters");
     return;
   }
-  memset(page, 0, sizeof(bpt_leaf_page_t));
+  memset(page, 0, page_size);
   page->leaf_data.header.is_leaf = 1;
   page->leaf_data.header.num_of_keys = 0;
   page->leaf_data.header.parent_page = parent_page;
+  page->leaf_data.header.page_size = page_size;
   page->leaf_data.header.page_lsn = 0;
-  page->leaf_data.free_space = kPageSize - kBptPageHeaderSize;
+  page->leaf_data.free_space = page_size - kBptPageHeaderSize;
   page->leaf_data.right_sibling = 0;
 }
 
 void init_internal_page_struct(bpt_internal_page_t *page,
-                               pagenum_t parent_page) {
+                               pagenum_t parent_page, uint64_t page_size) {
   if (page == NULL) {
     LOG_ERR(2, "invalid parameters");
     return;
   }
-  memset(page, 0, sizeof(bpt_internal_page_t));
+  memset(page, 0, page_size);
   page->internal_data.header.is_leaf = 0;
   page->internal_data.header.num_of_keys = 0;
   page->internal_data.header.parent_page = parent_page;
+  page->internal_data.header.page_size = page_size;
   page->internal_data.header.page_lsn = 0;
   page->internal_data.first_child_page = 0;
 }
@@ -311,7 +380,7 @@ pagenum_t insert_into_new_root(int64_t table_id, pagenum_t left, bpt_key_t key,
     return 0;
   }
   auto *page = buffer_get_page_ptr<bpt_internal_page_t>(table_id, root);
-  init_internal_page_struct(page, 0);
+  init_internal_page_struct(page, 0, file_page_size(table_id));
 
   auto slots = internal_slot_array(page);
   slots[0] = {key, right};
@@ -353,7 +422,7 @@ pagenum_t insert_into_parent(int64_t table_id, pagenum_t root, pagenum_t parent,
   }
 
   // simple case : the new key fits into the node
-  if (parent_num_of_keys < kMaxNumInternalPageEntries) {
+  if (parent_num_of_keys < max_internal_entries(parent_page)) {
     if (!insert_into_internal(table_id, parent, parent_page, left_idx, key,
                               right)) {
       unpin(parent_page);
@@ -372,29 +441,113 @@ pagenum_t insert_into_parent(int64_t table_id, pagenum_t root, pagenum_t parent,
                                               left_idx, key, right);
 }
 
+int find_child_link(bpt_internal_page_t *page, uint64_t num_of_keys,
+                    bpt_key_t key) {
+  auto slots = internal_slot_array(page);
+  int idx = 0;
+  while (idx < num_of_keys && slots[idx].key <= key) ++idx;
+  return idx;
+}
+
+pagenum_t find_child(bpt_internal_page_t *page, uint64_t num_of_keys,
+                     bpt_key_t key) {
+  auto idx = find_child_link(page, num_of_keys, key);
+  if (idx == 0) return page->internal_data.first_child_page;
+  return internal_slot_array(page)[idx - 1].pagenum;
+}
+
+bool find_child_optimistic(int64_t table_id, const page_t *parent, int link,
+                           pagenum_t pagenum, bpt_key_t key,
+                           const page_t **page, int *child_link,
+                           pagenum_t *child, bool *is_leaf) {
+  uint64_t version;
+  auto *internal = (bpt_internal_page_t *)buffer_read_child_optimistic(
+      parent, link, table_id, pagenum, &version);
+  if (internal == NULL) return false;
+
+  *is_leaf = internal->internal_data.header.is_leaf;
+  uint64_t num_of_keys = internal->internal_data.header.num_of_keys;
+  // keys may be torn by a writer, bound them before reading slots
+  if (num_of_keys > (kPageSize - kBptPageHeaderSize) / sizeof(internal_slot_t))
+    return false;
+  if (!*is_leaf) {
+    *child_link = find_child_link(internal, num_of_keys, key);
+    *child = *child_link == 0
+                 ? internal->internal_data.first_child_page
+                 : internal_slot_array(internal)[*child_link - 1].pagenum;
+  }
+  *page = (const page_t *)internal;
+  return buffer_validate_page(*page, version);
+}
+
 pagenum_t find_leaf(int64_t table_id, pagenum_t root, bpt_key_t key) {
   if (root == 0) {
     return 0;
   }
 
+  // pages are read optimistically, or pinned shared if they are not cached
+  // or changed while read. a page read optimistically leads to its child
+  // through the link taken (swizzled)
   pagenum_t pagenum = root;
-  auto *page = buffer_get_page_ptr<bpt_internal_page_t>(table_id, pagenum);
+  const page_t *parent = NULL;
+  int link = 0;
+  while (true) {
+    pagenum_t child = 0;
+    bool is_leaf = false;
+    const page_t *page = NULL;
+    int child_link = 0;
+    if (!find_child_optimistic(table_id, parent, link, pagenum, key, &page,
+                               &child_link, &child, &is_leaf)) {
+      auto *pinned =
+          buffer_get_page_ptr<bpt_internal_page_t>(table_id, pagenum, true);
+      is_leaf = pinned->internal_data.header.is_leaf;
+      if (!is_leaf)
+        child =
+            find_child(pinned, pinned->internal_data.header.num_of_keys, key);
+      unpin((page_t *)pinned);
+      page = NULL;
+    }
+    if (is_leaf) return pagenum;
+    parent = page;
+    link = child_link;
+    pagenum = child;
+  }
+}
 
-  while (!page->internal_data.header.is_leaf) {
+pagenum_t find_left_leaf(int64_t table_id, pagenum_t root, pagenum_t pagenum,
+                         pagenum_t parent) {
+  // climb until the page is not the first child of its parent
+  pagenum_t left = 0;
+  while (pagenum != root && left == 0) {
+    auto *page = buffer_get_page_ptr<bpt_internal_page_t>(table_id, parent);
+    auto num_of_keys = page->internal_data.header.num_of_keys;
     auto slots = internal_slot_array(page);
+    for (int i = 0; i < num_of_keys; ++i) {
+      if (slots[i].pagenum != pagenum) continue;
+      left = i == 0 ? page->internal_data.first_child_page
+                    : slots[i - 1].pagenum;
+      break;
+    }
+    pagenum = parent;
+    parent = page->internal_data.header.parent_page;
+    unpin(page);
+  }
+  if (left == 0) return 0;
+
+  // rightmost leaf of the subtree on the left
+  while (true) {
+    auto *page = buffer_get_page_ptr<bpt_internal_page_t>(table_id, left);
+    if (page->internal_data.header.is_leaf) {
+      unpin(page);
+      return left;
+    }
     auto num_of_keys = page->internal_data.header.num_of_keys;
-    int idx = 0;
-    while (idx < num_of_keys && slots[idx].key <= key) ++idx;
-    auto old_pagenum = pagenum;
-    if (idx == 0)
-      pagenum = page->internal_data.first_child_page;
-    else
-      pagenum = slots[idx - 1].pagenum;
-    unpin((page_t *)page);
-    page = buffer_get_page_ptr<bpt_internal_page_t>(table_id, pagenum);
+    auto next = num_of_keys == 0
+                    ? page->internal_data.first_child_page
+                    : internal_slot_array(page)[num_of_keys - 1].pagenum;
+    unpin(page);
+    left = next;
   }
-  unpin((page_t *)page);
-  return pagenum;
 }
 
 bool insert_into_leaf(bpt_leaf_page_t *page, bpt_key_t key, uint16_t size,
@@ -424,7 +577,8 @@ bool insert_into_leaf(bpt_leaf_page_t *page, bpt_key_t key, uint16_t size,
   }
 
   // calculate slot data offset and move slot data
-  uint16_t offset = kPageSize;  // first slot offset
+  // first slot offset
+  uint16_t offset = bpt_page_size(&page->leaf_data.header);
   if (slotnum > 0) {
     offset = slots[slotnum - 1].offset;
   }
@@ -483,15 +637,17 @@ pagenum_t insert_into_leaf_after_splitting(int64_t table_id, pagenum_t root,
     return 0;
   }
 
-  // create new leaf page]
-  *sibling = buffer_alloc_page(table_id);
+  // create new leaf page next to the page, so the sibling chain stays
+  // sequential on disk
+  *sibling = buffer_alloc_page(table_id, pagenum + 1);
   if (*sibling == 0) {
     unpin(page);
     LOG_ERR(2, "failed to allocate new sibling page");
     return 0;
   }
   auto *new_page = buffer_get_page_ptr<bpt_leaf_page_t>(table_id, *sibling);
-  init_leaf_page_struct(new_page, parent_page);
+  auto page_size = bpt_page_size(&page->leaf_data.header);
+  init_leaf_page_struct(new_page, parent_page, page_size);
 
   // get slot arrays
   auto slots = leaf_slot_array(page);
@@ -521,7 +677,7 @@ pagenum_t insert_into_leaf_after_splitting(int64_t table_id, pagenum_t root,
 
   // find split point
   uint64_t space = 0, split = 0;
-  const uint64_t kThreshold = (kPageSize - kBptPageHeaderSize) / 2;
+  const uint64_t kThreshold = (page_size - kBptPageHeaderSize) / 2;
   for (split = 0; split < new_num_of_keys; ++split) {
     space += sizeof(leaf_slot_t) + temp_slots[split].size;
     if (space >= kThreshold) break;
@@ -529,12 +685,13 @@ pagenum_t insert_into_leaf_after_splitting(int64_t table_id, pagenum_t root,
 
   // split into two leaf page
   // create updated page (alter page)
-  bpt_leaf_page_t upd_page;
-  init_leaf_page_struct(&upd_page, parent_page);
+  bpt_scratch_page_t scratch;
+  auto &upd_page = scratch.leaf;
+  init_leaf_page_struct(&upd_page, parent_page, page_size);
   auto upd_slots = leaf_slot_array(&upd_page);
 
   // insert into updated page (alter page)
-  uint16_t data_offset = kPageSize;
+  uint16_t data_offset = page_size;
   for (int i = 0; i <= split; ++i) {
     upd_page.leaf_data.free_space -= sizeof(leaf_slot_t) + temp_slots[i].size;
     upd_page.leaf_data.header.num_of_keys += 1;
@@ -551,7 +708,7 @@ pagenum_t insert_into_leaf_after_splitting(int64_t table_id, pagenum_t root,
   }
 
   // insert into new page (sibling page)
-  data_offset = kPageSize;
+  data_offset = page_size;
   for (int i = split + 1, j = 0; i < new_num_of_keys; ++i, ++j) {
     new_page->leaf_data.free_space -= sizeof(leaf_slot_t) + temp_slots[i].size;
     new_page->leaf_data.header.num_of_keys += 1;
@@ -575,7 +732,7 @@ pagenum_t insert_into_leaf_after_splitting(int64_t table_id, pagenum_t root,
   new_page->leaf_data.right_sibling = page->leaf_data.right_sibling;
 
   // write
-  memcpy(page->page.data, upd_page.page.data, sizeof(upd_page));
+  memcpy(page->page.data, upd_page.page.data, page_size);
   set_dirty(page);
   set_dirty(new_page);
   unpin(page);
@@ -646,7 +803,7 @@ pagenum_t delete_from_leaf(int64_t table_id, pagenum_t root, pagenum_t pagenum,
 
   // if free space is less than threshold, do nothing
   auto free_space = page->leaf_data.free_space;
-  if (free_space < kMergeOrDistributeThreshold) {
+  if (free_space < merge_threshold(page)) {
     unpin(page);
     return root;
   }
@@ -671,7 +828,9 @@ pagenum_t delete_from_leaf(int64_t table_id, pagenum_t root, pagenum_t pagenum,
     return 0;
   }
 
-  uint64_t used_space = (kPageSize - kBptPageHeaderSize) - free_space;
+  uint64_t used_space =
+      (bpt_page_size(&page->leaf_data.header) - kBptPageHeaderSize) -
+      free_space;
 
   // if there is enough space, then merge
   if (used_space <= neighbor_page->leaf_data.free_space) {
@@ -740,9 +899,11 @@ pagenum_t redistribute_leaf(int64_t table_id, pagenum_t root,
   auto *page = buffer_get_page_ptr<bpt_leaf_page_t>(table_id, pagenum);
   auto *neighbor =
       buffer_get_page_ptr<bpt_leaf_page_t>(table_id, neighbor_pagenum);
-  bpt_leaf_page_t upd_neighbor;
+  bpt_scratch_page_t scratch;
+  auto &upd_neighbor = scratch.leaf;
   auto parent_page = page->leaf_data.header.parent_page;
-  init_leaf_page_struct(&upd_neighbor, parent_page);
+  auto page_size = bpt_page_size(&page->leaf_data.header);
+  init_leaf_page_struct(&upd_neighbor, parent_page, page_size);
   upd_neighbor.leaf_data.right_sibling = neighbor->leaf_data.right_sibling;
 
   auto slots = leaf_slot_array(page);
@@ -765,7 +926,7 @@ pagenum_t redistribute_leaf(int64_t table_id, pagenum_t root,
   if (page_is_left) {
     // move slots
     int right_idx = 0;
-    while (left->leaf_data.free_space >= kMergeOrDistributeThreshold &&
+    while (left->leaf_data.free_space >= merge_threshold(left) &&
            right_idx < right_num_of_keys) {
       auto slot = right_slots[right_idx++];
       // cause maximum slot.size is 108, space is always enough
@@ -779,7 +940,7 @@ pagenum_t redistribute_leaf(int64_t table_id, pagenum_t root,
     }
 
     // rebuild neighbor
-    uint16_t offset = kPageSize;
+    uint16_t offset = page_size;
     for (int i = right_idx, j = 0; i < right_num_of_keys; ++i, ++j) {
       auto slot = right_slots[i];
       offset -= slot.size;
@@ -794,7 +955,7 @@ pagenum_t redistribute_leaf(int64_t table_id, pagenum_t root,
   } else {  // page is right
     // move slots
     int left_idx = left_num_of_keys - 1;
-    while (right->leaf_data.free_space >= kMergeOrDistributeThreshold &&
+    while (right->leaf_data.free_space >= merge_threshold(right) &&
            left_idx >= 0) {
       auto slot = left_slots[left_idx--];
       if (!insert_into_leaf(right, slot.key, slot.size,
@@ -807,7 +968,7 @@ pagenum_t redistribute_leaf(int64_t table_id, pagenum_t root,
     }
 
     // rebuild neighbor
-    uint16_t offset = kPageSize;
+    uint16_t offset = page_size;
     for (int i = 0; i <= left_idx; ++i) {
       auto slot = left_slots[i];
       offset -= slot.size;
@@ -821,7 +982,7 @@ pagenum_t redistribute_leaf(int64_t table_id, pagenum_t root,
     new_key_in_parent = right_slots[0].key;
   }
 
-  memcpy(neighbor->page.data, upd_neighbor.page.data, sizeof(upd_neighbor));
+  memcpy(neighbor->page.data, upd_neighbor.page.data, page_size);
   set_dirty(page);
   set_dirty(neighbor);
   unpin(page);
@@ -842,7 +1003,7 @@ bool insert_into_internal(int64_t table_id, pagenum_t pagenum,
   auto num_of_keys = page->internal_data.header.num_of_keys;
   auto slots = internal_slot_array(page);
 
-  if (num_of_keys >= kMaxNumInternalPageEntries) {
+  if (num_of_keys >= max_internal_entries(page)) {
     LOG_ERR(2, "not enough space");
     return false;
   }
@@ -880,21 +1041,22 @@ pagenum_t insert_into_internal_after_splitting(int64_t table_id, pagenum_t root,
   auto old_num_of_keys = page->internal_data.header.num_of_keys;
 
   // check if page is full
-  if (old_num_of_keys < kMaxNumInternalPageEntries) {
+  if (old_num_of_keys < max_internal_entries(page)) {
     unpin(page);
     LOG_WARN("tried to split but page is not full");
     return 0;
   }
 
-  // create new internal page
-  *sibling = buffer_alloc_page(table_id);
+  // create new internal page (next to the page)
+  *sibling = buffer_alloc_page(table_id, pagenum + 1);
   if (*sibling == 0) {
     unpin(page);
     LOG_ERR(2, "failed to allocate new sibling page");
     return 0;
   }
   auto *new_page = buffer_get_page_ptr<bpt_internal_page_t>(table_id, *sibling);
-  init_internal_page_struct(new_page, parent_page);
+  auto page_size = bpt_page_size(&page->internal_data.header);
+  init_internal_page_struct(new_page, parent_page, page_size);
 
   // get slot arrays
   auto slots = internal_slot_array(page);
@@ -922,8 +1084,9 @@ pagenum_t insert_into_internal_after_splitting(int64_t table_id, pagenum_t root,
 
   // split into two internal page
   // create updated page (alter page)
-  bpt_internal_page_t upd_page;
-  init_internal_page_struct(&upd_page, parent_page);
+  bpt_scratch_page_t scratch;
+  auto &upd_page = scratch.internal;
+  init_internal_page_struct(&upd_page, parent_page, page_size);
   auto upd_slots = internal_slot_array(&upd_page);
 
   // insert into updated page (alter page)
@@ -949,7 +1112,7 @@ pagenum_t insert_into_internal_after_splitting(int64_t table_id, pagenum_t root,
   free(temp_slots);
 
   // write
-  memcpy(page->page.data, upd_page.page.data, sizeof(upd_page));
+  memcpy(page->page.data, upd_page.page.data, page_size);
   set_dirty(page);
   set_dirty(new_page);
   unpin(page);
@@ -1023,8 +1186,8 @@ pagenum_t delete_from_parent(int64_t table_id, pagenum_t root,
   auto num_of_keys = page->internal_data.header.num_of_keys;
 
   // if page has enough keys
-  const auto min_keys =
-      kMaxNumInternalPageEntries / 2 + kMaxNumInternalPageEntries % 2 - 1;
+  const auto max_entries = max_internal_entries(page);
+  const auto min_keys = max_entries / 2 + max_entries % 2 - 1;
   if (num_of_keys >= min_keys) {
     unpin(page);
     return root;
@@ -1053,7 +1216,7 @@ pagenum_t delete_from_parent(int64_t table_id, pagenum_t root,
   }
 
   // if there is enough space, then merge
-  if (num_of_keys + neig_num_of_keys < kMaxNumInternalPageEntries) {
+  if (num_of_keys + neig_num_of_keys < max_entries) {
     unpin(page);
     unpin(neighbor_page);
     return merge_internal(table_id, root, key_in_parent, pagenum,
@@ -1203,19 +1366,23 @@ bool bpt_find(int64_t table_id, pagenum_t root, bpt_key_t key, uint16_t *size,
     return false;
   }
 
-  auto *page = buffer_get_page_ptr<bpt_leaf_page_t>(table_id, leaf_pagenum);
-  if (lock == NULL &&
-      trx_id > 0) {  // acquire record lock before getting page latch
+  // acquiring a record lock may convert the implicit lock in the page, so
+  // the leaf is only shared if no lock is acquired
+  auto need_lock = lock == NULL && trx_id > 0;
+  auto *page = buffer_get_page_ptr<bpt_leaf_page_t>(table_id, leaf_pagenum,
+                                                    !need_lock);
+  if (need_lock) {  // acquire record lock before getting page latch
     int waited = false;
     auto *new_lock = lock_acquire((bpt_page_t **)&page, table_id, leaf_pagenum,
                                   key, trx_id, S_LOCK, &waited);
     if (new_lock == NULL) {
-      unpin(page);
+      // page is unpinned if the trx is aborted
+      if (page != NULL) unpin(page);
       return false;
     } else if (waited) {
       // do it again
       auto *header =
-          buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
+          buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum, true);
       root = header->header.root_page_number;
       unpin(header);
       return bpt_find(table_id, root, key, size, value, trx_id, new_lock);
@@ -1236,6 +1403,45 @@ bool bpt_find(int64_t table_id, pagenum_t root, bpt_key_t key, uint16_t *size,
   return false;
 }
 
+int64_t bpt_scan(int64_t table_id, pagenum_t root, bpt_key_t begin,
+                 bpt_key_t end, bpt_scan_callback_t callback, void *arg) {
+  if (callback == NULL || begin > end) return 0;
+
+  int64_t num_scanned = 0;
+  bool stop = false;
+  auto leaf_pagenum = find_leaf(table_id, root, begin);
+  while (leaf_pagenum != 0 && !stop) {
+    auto *page =
+        buffer_get_page_ptr<bpt_leaf_page_t>(table_id, leaf_pagenum, true);
+    auto next_pagenum = page->leaf_data.right_sibling;
+    // siblings are placed next to each other, but splits of full extents
+    // and compaction break that, so the next leaves are read ahead along
+    // the chain (from the mapping if the table is mapped)
+    if (file_is_read_only(table_id)) {
+      if (next_pagenum != 0) file_prefetch_pages(table_id, next_pagenum, 1);
+    } else {
+      buffer_read_ahead(page, leaf_right_sibling);
+    }
+
+    auto slots = leaf_slot_array(page);
+    auto num_of_keys = page->leaf_data.header.num_of_keys;
+    for (int i = 0; i < num_of_keys && !stop; ++i) {
+      if (slots[i].key < begin) continue;
+      if (slots[i].key > end) {
+        stop = true;
+        break;
+      }
+      ++num_scanned;
+      if (callback(slots[i].key, page->page.data + slots[i].offset,
+                   slots[i].size, arg))
+        stop = true;
+    }
+    unpin((page_t *)page);
+    leaf_pagenum = next_pagenum;
+  }
+  return num_scanned;
+}
+
 bool bpt_update(int64_t table_id, pagenum_t root, bpt_key_t key, byte *value,
                 uint16_t new_val_size, uint16_t *old_val_size, int trx_id,
                 lock_t *lock) {
@@ -1251,12 +1457,13 @@ bool bpt_update(int64_t table_id, pagenum_t root, bpt_key_t key, byte *value,
     auto *new_lock = lock_acquire((bpt_page_t **)&page, table_id, leaf_pagenum,
                                   key, trx_id, X_LOCK, &waited);
     if (new_lock == NULL) {
-      unpin(page);
+      // page is unpinned if the trx is aborted
+      if (page != NULL) unpin(page);
       return false;
     } else if (waited) {
       // do it again
       auto *header =
-          buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
+          buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum, true);
       root = header->header.root_page_number;
       unpin(header);
       return bpt_update(table_id, root, key, value, new_val_size, old_val_size,
@@ -1337,10 +1544,10 @@ pagenum_t bpt_insert(int64_t table_id, pagenum_t root, bpt_key_t key,
     }
 
     auto *page = buffer_get_page_ptr<bpt_leaf_page_t>(table_id, root);
-    init_leaf_page_struct(page, 0);
+    init_leaf_page_struct(page, 0, file_page_size(table_id));
     auto slots = leaf_slot_array(page);
 
-    uint16_t offset = kPageSize - size;
+    uint16_t offset = bpt_page_size(&page->leaf_data.header) - size;
     slots[0] = {key, size, offset};
     memcpy(page->page.data + offset, value, size);
     page->leaf_data.free_space -= required_space;
@@ -1383,3 +1590,104 @@ pagenum_t bpt_delete(int64_t table_id, pagenum_t root, bpt_key_t key) {
 
   return delete_from_leaf(table_id, root, leaf_pagenum, key);
 }
+
+bool bpt_move_page(int64_t table_id, pagenum_t from, pagenum_t to,
+                   const page_patch_t *extra, int num_extra) {
+  if (from == kHeaderPagenum || to == kHeaderPagenum || from == to) {
+    LOG_WARN("invalid parameters");
+    return false;
+  }
+
+  auto *header = buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
+  auto root = header->header.root_page_number;
+  unpin(header);
+
+  auto *page = buffer_get_page_ptr<bpt_internal_page_t>(table_id, from);
+  // records are locked by page number
+  if (lock_is_page_locked((bpt_page_t *)page, table_id, from)) {
+    unpin((page_t *)page);
+    return false;
+  }
+  auto page_size = bpt_page_size(&page->internal_data.header);
+  bpt_scratch_page_t image;
+  memcpy(image.data, page->page.data, page_size);
+  unpin((page_t *)page);
+  auto *moved = &image.internal;
+  auto parent = moved->internal_data.header.parent_page;
+  auto num_of_keys = moved->internal_data.header.num_of_keys;
+
+  std::vector<page_patch_t> patches(extra, extra + num_extra);
+  patches.push_back({to, 0, (uint16_t)page_size, image.data});
+
+  // pointer from the parent (or the header if the page is root)
+  if (from == root) {
+    patches.push_back({kHeaderPagenum,
+                       offsetof(header_page_t, header.root_page_number),
+                       sizeof(pagenum_t), (const byte *)&to});
+  } else {
+    auto *parent_page =
+        buffer_get_page_ptr<bpt_internal_page_t>(table_id, parent);
+    auto slots = internal_slot_array(parent_page);
+    auto num_of_parent_keys = parent_page->internal_data.header.num_of_keys;
+    int64_t idx = -1;
+    if (parent_page->internal_data.first_child_page == from) {
+      patches.push_back({parent,
+                         offsetof(bpt_internal_page_t,
+                                  internal_data.first_child_page),
+                         sizeof(pagenum_t), (const byte *)&to});
+      idx = 0;
+    }
+    for (int i = 0; idx < 0 && i < num_of_parent_keys; ++i) {
+      if (slots[i].pagenum != from) continue;
+      patches.push_back({parent,
+                         (uint16_t)(kBptPageHeaderSize +
+                                    i * sizeof(internal_slot_t) +
+                                    offsetof(internal_slot_t, pagenum)),
+                         sizeof(pagenum_t), (const byte *)&to});
+      idx = i;
+    }
+    unpin((page_t *)parent_page);
+    if (idx < 0) {
+      LOG_WARN("there is no page %llu in parent page %llu", from, parent);
+      return false;
+    }
+  }
+
+  if (moved->internal_data.header.is_leaf) {
+    // link from the left sibling
+    auto left = from == root ? 0 : find_left_leaf(table_id, root, from, parent);
+    if (left != 0) {
+      auto *left_page = buffer_get_page_ptr<bpt_leaf_page_t>(table_id, left);
+      auto right_sibling = left_page->leaf_data.right_sibling;
+      unpin((page_t *)left_page);
+      if (right_sibling != from) {
+        LOG_WARN("page %llu is not the left sibling of %llu", left, from);
+        return false;
+      }
+      patches.push_back({left,
+                         offsetof(bpt_leaf_page_t, leaf_data.right_sibling),
+                         sizeof(pagenum_t), (const byte *)&to});
+    }
+  } else {
+    // parent pointers of children
+    auto slots = internal_slot_array(moved);
+    for (int i = -1; i < (int)num_of_keys; ++i) {
+      auto child =
+          i < 0 ? moved->internal_data.first_child_page : slots[i].pagenum;
+      patches.push_back({child, offsetof(bpt_header_t, parent_page),
+                         sizeof(pagenum_t), (const byte *)&to});
+    }
+  }
+
+  // log first, pages are written after the log is flushed (WAL)
+  auto *rec = create_log_page_patch(table_id, from, patches.data(),
+                                    patches.size());
+  if (rec == NULL) return false;
+  if (push_into_log_buffer(rec) || apply_log_page_patch(rec, false)) {
+    free(rec);
+    LOG_ERR(2, "failed to log page move %llu -> %llu", from, to);
+    return false;
+  }
+  free(rec);
+  return true;
+}
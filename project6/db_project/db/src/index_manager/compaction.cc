@@ -0,0 +1,286 @@
+#include "index_manager/compaction.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "buffer_manager.h"
+#include "index_manager/bpt.h"
+#include "log.h"
+#include "recovery.h"
+
+struct table_latch_t {
+  pthread_rwlock_t latch = PTHREAD_RWLOCK_INITIALIZER;
+};
+
+// background compaction of a table
+struct compactor_t {
+  pthread_t thread;
+  bool running = false;
+  bool stopping = false;
+  int64_t moves_per_round = 0;
+  int interval_ms = 0;
+};
+
+table_latch_t table_latches[kMaxNumTables];
+compactor_t compactors[kMaxNumTables];
+pthread_mutex_t compaction_latch = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t compaction_stop_cond = PTHREAD_COND_INITIALIZER;
+
+// latch the table exclusively, retry with exponential backoff
+// return true on success (false if the table stays busy)
+bool try_latch_table_exclusive(int64_t table_id) {
+  auto backoff = kCompactionInitialBackoffUs;
+  for (int i = 0; i < kCompactionLatchRetries; ++i) {
+    if (pthread_rwlock_trywrlock(&table_latches[table_id].latch) == 0)
+      return true;
+    usleep(backoff);
+    backoff *= 2;
+  }
+  return false;
+}
+
+// copy space map page of the group
+void read_space_map(int64_t table_id, uint64_t group, space_map_page_t *dest) {
+  auto *space_map = buffer_get_page_ptr<space_map_page_t>(
+      table_id, space_map_pagenum(group));
+  memcpy(dest, space_map, sizeof(space_map_page_t));
+  unpin(space_map);
+}
+
+// find the last page of the tree
+// return 0 if there is no page in use other than header and space maps
+pagenum_t find_last_used_page(int64_t table_id, uint64_t num_of_pages) {
+  space_map_page_t space_map;
+  for (int64_t group = space_map_group(num_of_pages - 1); group >= 0;
+       --group) {
+    read_space_map(table_id, group, &space_map);
+    auto idx = space_map_last_used(&space_map, group);
+    if (idx >= 0) return group * kPagesPerSpaceMap + idx;
+  }
+  return 0;
+}
+
+// patches of the space map header and the bitmap word of the page
+void add_space_map_patches(std::vector<page_patch_t> &patches,
+                           const space_map_page_t *space_map, uint64_t group,
+                           pagenum_t pagenum) {
+  auto word = (pagenum % kPagesPerSpaceMap) / 64;
+  patches.push_back({space_map_pagenum(group), 0, 2 * sizeof(uint64_t),
+                     (const byte *)&space_map->space_map.num_pages});
+  patches.push_back(
+      {space_map_pagenum(group),
+       (uint16_t)(offsetof(space_map_page_t, space_map.bitmap) +
+                  word * sizeof(uint64_t)),
+       sizeof(uint64_t), (const byte *)&space_map->space_map.bitmap[word]});
+}
+
+// move the last page of the tree into the first free page
+// table should be latched exclusively
+// return 1 if a page is moved, 0 if the table is compact, -1 if the last
+// page cannot be moved now
+int move_last_page(int64_t table_id) {
+  auto *header = buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
+  auto num_of_pages = header->header.num_of_pages;
+  unpin(header);
+
+  auto from = find_last_used_page(table_id, num_of_pages);
+  if (from == 0) return 0;
+  auto to_group = file_find_free_space_map(table_id, 0);
+  auto from_group = space_map_group(from);
+  if (to_group < 0 || (uint64_t)to_group > from_group) return 0;
+
+  // space map changes are logged with the move
+  space_map_page_t to_map, from_map;
+  read_space_map(table_id, to_group, &to_map);
+  auto idx = space_map_alloc(&to_map, 0);
+  if (idx < 0) return -1;
+  pagenum_t to = to_group * kPagesPerSpaceMap + idx;
+  if (to >= from) return 0;
+
+  auto *freed_map = &to_map;
+  if (from_group != (uint64_t)to_group) {
+    read_space_map(table_id, from_group, &from_map);
+    freed_map = &from_map;
+  }
+  space_map_free(freed_map, from % kPagesPerSpaceMap);
+
+  std::vector<page_patch_t> patches;
+  add_space_map_patches(patches, &to_map, to_group, to);
+  add_space_map_patches(patches, freed_map, from_group, from);
+  if (!bpt_move_page(table_id, from, to, patches.data(), patches.size()))
+    return -1;
+  return 1;
+}
+
+// cut off free pages at the end of the table (not below the default size)
+// table should be latched exclusively
+// return 0 on success
+int truncate_table(int64_t table_id) {
+  auto *header = buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
+  uint64_t num_of_pages = header->header.num_of_pages;
+  unpin(header);
+
+  uint64_t new_num_of_pages =
+      std::max(find_last_used_page(table_id, num_of_pages) + 1,
+               kDefaultFileSize / file_page_size(table_id));
+  if (new_num_of_pages < num_of_pages) {
+    // all cut off pages are free
+    auto group = space_map_group(new_num_of_pages - 1);
+    space_map_page_t space_map;
+    read_space_map(table_id, group, &space_map);
+    auto &sm = space_map.space_map;
+    auto num_pages = new_num_of_pages - group * kPagesPerSpaceMap;
+    sm.num_free_pages -= sm.num_pages - num_pages;
+    sm.num_pages = num_pages;
+
+    page_patch_t patches[] = {
+        {space_map_pagenum(group), 0, 2 * sizeof(uint64_t),
+         (const byte *)&sm.num_pages},
+        {kHeaderPagenum, offsetof(header_page_t, header.num_of_pages),
+         sizeof(uint64_t), (const byte *)&new_num_of_pages}};
+    auto *rec = create_log_page_patch(table_id, new_num_of_pages, patches, 2);
+    if (rec == NULL) return 1;
+    if (push_into_log_buffer(rec) || apply_log_page_patch(rec, false)) {
+      free(rec);
+      LOG_ERR(2, "failed to log truncation of table %lld", table_id);
+      return 1;
+    }
+    free(rec);
+    num_of_pages = new_num_of_pages;
+  }
+
+  // file may be left longer by a failed try or a crash
+  if (file_size(table_id) <= num_of_pages * file_page_size(table_id)) return 0;
+  // truncation should be redone if cut off pages are gone
+  if (flush_log()) return 1;
+  if (buffer_discard_pages(table_id, num_of_pages)) return 1;
+  return file_truncate(table_id, num_of_pages);
+}
+
+void *compaction_thread(void *arg) {
+  auto table_id = (int64_t)(intptr_t)arg;
+  auto &compactor = compactors[table_id];
+
+  pthread_mutex_lock(&compaction_latch);
+  while (!compactor.stopping) {
+    auto moves_per_round = compactor.moves_per_round;
+    pthread_mutex_unlock(&compaction_latch);
+    compact_table(table_id, moves_per_round);
+    pthread_mutex_lock(&compaction_latch);
+
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    auto nsec = deadline.tv_nsec + compactor.interval_ms * 1000000LL;
+    deadline.tv_sec += nsec / 1000000000LL;
+    deadline.tv_nsec = nsec % 1000000000LL;
+    while (!compactor.stopping &&
+           pthread_cond_timedwait(&compaction_stop_cond, &compaction_latch,
+                                  &deadline) != ETIMEDOUT) {
+    }
+  }
+  pthread_mutex_unlock(&compaction_latch);
+  return NULL;
+}
+
+void latch_table_shared(int64_t table_id) {
+  if (table_id < 0 || table_id >= kMaxNumTables) return;
+  pthread_rwlock_rdlock(&table_latches[table_id].latch);
+}
+
+void unlatch_table(int64_t table_id) {
+  if (table_id < 0 || table_id >= kMaxNumTables) return;
+  pthread_rwlock_unlock(&table_latches[table_id].latch);
+}
+
+int64_t compact_table(int64_t table_id, int64_t max_moves) {
+  if (table_id < 0 || table_id >= kMaxNumTables) {
+    LOG_ERR(2, "invalid parameters");
+    return -1;
+  }
+  if (file_is_read_only(table_id)) {
+    LOG_WARN("cannot compact read-only table %lld", table_id);
+    return -1;
+  }
+
+  // table is latched per move, so index operations run between moves
+  int64_t num_moved = 0;
+  while (max_moves <= 0 || num_moved < max_moves) {
+    if (!try_latch_table_exclusive(table_id)) return num_moved;
+    auto result = move_last_page(table_id);
+    unlatch_table(table_id);
+    if (result <= 0) break;
+    ++num_moved;
+  }
+
+  if (try_latch_table_exclusive(table_id)) {
+    truncate_table(table_id);
+    unlatch_table(table_id);
+  }
+  return num_moved;
+}
+
+int start_compaction(int64_t table_id, int64_t moves_per_round,
+                     int interval_ms) {
+  if (table_id < 0 || table_id >= kMaxNumTables || interval_ms < 0) {
+    LOG_ERR(2, "invalid parameters");
+    return 1;
+  }
+  if (file_is_read_only(table_id)) {
+    LOG_WARN("cannot compact read-only table %lld", table_id);
+    return 1;
+  }
+
+  pthread_mutex_lock(&compaction_latch);
+  auto &compactor = compactors[table_id];
+  if (compactor.running) {
+    pthread_mutex_unlock(&compaction_latch);
+    LOG_WARN("compaction of table %lld is already running", table_id);
+    return 1;
+  }
+  compactor.moves_per_round = moves_per_round;
+  compactor.interval_ms = interval_ms;
+  compactor.stopping = false;
+  if (pthread_create(&compactor.thread, NULL, compaction_thread,
+                     (void *)(intptr_t)table_id)) {
+    pthread_mutex_unlock(&compaction_latch);
+    LOG_WARN("failed to create compaction thread, %s", strerror(errno));
+    return 1;
+  }
+  compactor.running = true;
+  pthread_mutex_unlock(&compaction_latch);
+  return 0;
+}
+
+void stop_compaction(int64_t table_id) {
+  if (table_id < 0 || table_id >= kMaxNumTables) return;
+
+  pthread_mutex_lock(&compaction_latch);
+  auto &compactor = compactors[table_id];
+  if (!compactor.running) {
+    pthread_mutex_unlock(&compaction_latch);
+    return;
+  }
+  compactor.stopping = true;
+  pthread_cond_broadcast(&compaction_stop_cond);
+  pthread_mutex_unlock(&compaction_latch);
+
+  pthread_join(compactor.thread, NULL);
+
+  pthread_mutex_lock(&compaction_latch);
+  compactor.running = false;
+  compactor.stopping = false;
+  pthread_mutex_unlock(&compaction_latch);
+}
+
+void stop_all_compactions() {
+  for (int64_t table_id = 0; table_id < kMaxNumTables; ++table_id)
+    stop_compaction(table_id);
+}
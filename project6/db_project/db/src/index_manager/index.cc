@@ -4,24 +4,39 @@
 
 #include "buffer_manager.h"
 #include "index_manager/bpt.h"
+#include "index_manager/compaction.h"
 #include "log.h"
 
 int64_t open_table(char *pathname) { return file_open_table_file(pathname); }
 
+int64_t open_table_read_only(char *pathname) {
+  return file_open_mapped_table_file(pathname);
+}
+
 int db_insert(int64_t table_id, int64_t key, char *value, uint16_t val_size) {
   if (table_id < 0) {
     LOG_ERR(2, "invalid parameters");
     return 1;
   }
-  auto *header = buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
+  if (file_is_read_only(table_id)) {
+    LOG_WARN("table %lld is read-only", table_id);
+    return 1;
+  }
+  latch_table_shared(table_id);
+  auto *header =
+      buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum, true);
   auto root = header->header.root_page_number;
   unpin(table_id, kHeaderPagenum);
   root = bpt_insert(table_id, root, key, val_size, value);
-  if (root == 0) return 1;
+  if (root == 0) {
+    unlatch_table(table_id);
+    return 1;
+  }
   header = buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
   header->header.root_page_number = root != kNullPagenum ? root : 0;
   set_dirty((page_t *)header);
   unpin((page_t *)header);
+  unlatch_table(table_id);
 
   return 0;
 }
@@ -32,13 +47,35 @@ int db_find(int64_t table_id, int64_t key, char *ret_val, uint16_t *val_size,
     LOG_ERR(2, "invalid parameters");
     return 1;
   }
-  auto *header = buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
+  // read-only table never changes, so records need no lock
+  if (file_is_read_only(table_id)) trx_id = 0;
+  latch_table_shared(table_id);
+  auto *header =
+      buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum, true);
   auto root = header->header.root_page_number;
   unpin(header);
-  if (bpt_find(table_id, root, key, val_size, ret_val, trx_id))
-    return 0;
-  else
-    return 1;
+  auto found = bpt_find(table_id, root, key, val_size, ret_val, trx_id);
+  unlatch_table(table_id);
+  return found ? 0 : 1;
+}
+
+int64_t db_scan(int64_t table_id, int64_t begin_key, int64_t end_key,
+                int (*callback)(int64_t key, const char *value,
+                                uint16_t size, void *arg),
+                void *arg) {
+  if (table_id < 0 || callback == NULL) {
+    LOG_ERR(2, "invalid parameters");
+    return -1;
+  }
+  latch_table_shared(table_id);
+  auto *header =
+      buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum, true);
+  auto root = header->header.root_page_number;
+  unpin(header);
+  auto num_scanned =
+      bpt_scan(table_id, root, begin_key, end_key, callback, arg);
+  unlatch_table(table_id);
+  return num_scanned;
 }
 
 int db_update(int64_t table_id, int64_t key, char *values,
@@ -47,14 +84,19 @@ int db_update(int64_t table_id, int64_t key, char *values,
     LOG_ERR(2, "invalid parameters");
     return 1;
   }
-  auto *header = buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
+  if (file_is_read_only(table_id)) {
+    LOG_WARN("table %lld is read-only", table_id);
+    return 1;
+  }
+  latch_table_shared(table_id);
+  auto *header =
+      buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum, true);
   auto root = header->header.root_page_number;
   unpin(header);
-  if (bpt_update(table_id, root, key, values, new_val_size, old_val_size,
-                 trx_id))
-    return 0;
-  else
-    return 1;
+  auto updated = bpt_update(table_id, root, key, values, new_val_size,
+                            old_val_size, trx_id);
+  unlatch_table(table_id);
+  return updated ? 0 : 1;
 }
 
 int db_delete(int64_t table_id, int64_t key) {
@@ -62,15 +104,25 @@ int db_delete(int64_t table_id, int64_t key) {
     LOG_ERR(2, "invalid parameters");
     return 1;
   }
-  auto *header = buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
+  if (file_is_read_only(table_id)) {
+    LOG_WARN("table %lld is read-only", table_id);
+    return 1;
+  }
+  latch_table_shared(table_id);
+  auto *header =
+      buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum, true);
   auto root = header->header.root_page_number;
   unpin((page_t *)header);
   root = bpt_delete(table_id, root, key);
-  if (root == 0) return 1;
+  if (root == 0) {
+    unlatch_table(table_id);
+    return 1;
+  }
   header = buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
   header->header.root_page_number = root != kNullPagenum ? root : 0;
   set_dirty((page_t *)header);
   unpin((page_t *)header);
+  unlatch_table(table_id);
 
   return 0;
 }
\ No newline at end of file
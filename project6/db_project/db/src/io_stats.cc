@@ -0,0 +1,208 @@
+#include "io_stats.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#include "disk_space_manager/file.h"
+#include "log.h"
+
+struct io_counter_t {
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> total_ns{0};
+  std::atomic<uint64_t> latency[kIoLatencyBuckets] = {};
+};
+
+io_counter_t site_counters[kNumIoSites][kNumIoOps];
+io_counter_t table_counters[kMaxNumTables][kNumIoOps];
+
+std::atomic<bool> io_timing_enabled{false};
+// set while trace_fp is open, so untraced calls skip the latch
+std::atomic<bool> io_trace_enabled{false};
+pthread_mutex_t io_trace_latch = PTHREAD_MUTEX_INITIALIZER;
+FILE *trace_fp = NULL;
+
+const char *kIoOpNames[kNumIoOps] = {"read", "write", "sync", "expand"};
+const char *kIoSiteNames[kNumIoSites] = {"page", "batch", "meta",
+                                         "double_write", "log", "recovery"};
+
+// utilities used in io_stats.cc (not exported in io_stats.h)
+uint64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int latency_bucket(uint64_t ns) {
+  auto us = ns / 1000;
+  if (us == 0) return 0;
+  int bucket = 64 - __builtin_clzll(us);
+  return bucket < kIoLatencyBuckets ? bucket : kIoLatencyBuckets - 1;
+}
+
+void add_counter(io_counter_t &counter, uint64_t bytes, uint64_t ns,
+                 bool timed) {
+  counter.count.fetch_add(1, std::memory_order_relaxed);
+  counter.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  if (!timed) return;
+  counter.total_ns.fetch_add(ns, std::memory_order_relaxed);
+  counter.latency[latency_bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void add_to_stat(const io_counter_t &counter, io_stat_t *dest) {
+  dest->count += counter.count.load(std::memory_order_relaxed);
+  dest->bytes += counter.bytes.load(std::memory_order_relaxed);
+  dest->total_ns += counter.total_ns.load(std::memory_order_relaxed);
+  for (int i = 0; i < kIoLatencyBuckets; ++i)
+    dest->latency[i] += counter.latency[i].load(std::memory_order_relaxed);
+}
+
+void clear_counter(io_counter_t &counter) {
+  counter.count.store(0, std::memory_order_relaxed);
+  counter.bytes.store(0, std::memory_order_relaxed);
+  counter.total_ns.store(0, std::memory_order_relaxed);
+  for (auto &bucket : counter.latency)
+    bucket.store(0, std::memory_order_relaxed);
+}
+
+void print_stat(FILE *fp, const char *name, int op, const io_stat_t &stat) {
+  fprintf(fp, "%-14s %-6s %10llu %14llu", name, io_op_name(op),
+          (unsigned long long)stat.count, (unsigned long long)stat.bytes);
+  uint64_t num_timed = 0;
+  for (auto n : stat.latency) num_timed += n;
+  if (num_timed > 0) {
+    fprintf(fp, " %10.1f %8llu %8llu",
+            (double)stat.total_ns / num_timed / 1000,
+            (unsigned long long)io_stats_percentile(&stat, 0.5),
+            (unsigned long long)io_stats_percentile(&stat, 0.99));
+  }
+  fprintf(fp, "\n");
+}
+
+// api functions
+uint64_t io_stats_start() {
+  if (!io_timing_enabled.load(std::memory_order_relaxed) &&
+      !io_trace_enabled.load(std::memory_order_relaxed))
+    return 0;
+  return monotonic_ns();
+}
+
+void io_stats_record(int op, int site, int64_t table_id, uint64_t offset,
+                     uint64_t bytes, uint64_t start) {
+  if (op < 0 || op >= kNumIoOps || site < 0 || site >= kNumIoSites) return;
+  uint64_t ns = 0;
+  auto timed = start != 0 && io_timing_enabled.load(std::memory_order_relaxed);
+  if (start != 0) ns = monotonic_ns() - start;
+
+  add_counter(site_counters[site][op], bytes, ns, timed);
+  if (table_id >= 0 && table_id < kMaxNumTables)
+    add_counter(table_counters[table_id][op], bytes, ns, timed);
+
+  if (start == 0 || !io_trace_enabled.load(std::memory_order_relaxed)) return;
+  pthread_mutex_lock(&io_trace_latch);
+  if (trace_fp != NULL) {
+    fprintf(trace_fp, "%llu %s %s %lld %llu %llu %llu\n",
+            (unsigned long long)start, io_op_name(op), io_site_name(site),
+            (long long)table_id, (unsigned long long)offset,
+            (unsigned long long)bytes, (unsigned long long)ns);
+  }
+  pthread_mutex_unlock(&io_trace_latch);
+}
+
+void io_stats_set_timing(int enable) {
+  io_timing_enabled.store(enable, std::memory_order_relaxed);
+}
+
+int io_stats_set_trace(const char *path) {
+  FILE *fp = NULL;
+  if (path != NULL) {
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+      LOG_WARN("cannot open I/O trace file %s, errno: %s", path,
+               strerror(errno));
+      return 1;
+    }
+    fprintf(fp, "# start_ns op site table offset bytes latency_ns\n");
+  }
+
+  pthread_mutex_lock(&io_trace_latch);
+  if (trace_fp != NULL) fclose(trace_fp);
+  trace_fp = fp;
+  io_trace_enabled.store(fp != NULL, std::memory_order_relaxed);
+  pthread_mutex_unlock(&io_trace_latch);
+  return 0;
+}
+
+void io_stats_snapshot(int site, int op, io_stat_t *dest) {
+  if (dest == NULL) return;
+  memset(dest, 0, sizeof(io_stat_t));
+  if (op < 0 || op >= kNumIoOps || site >= kNumIoSites) return;
+  for (int s = 0; s < kNumIoSites; ++s) {
+    if (site < 0 || s == site) add_to_stat(site_counters[s][op], dest);
+  }
+}
+
+void io_stats_table_snapshot(int64_t table_id, int op, io_stat_t *dest) {
+  if (dest == NULL) return;
+  memset(dest, 0, sizeof(io_stat_t));
+  if (op < 0 || op >= kNumIoOps || table_id < 0 || table_id >= kMaxNumTables)
+    return;
+  add_to_stat(table_counters[table_id][op], dest);
+}
+
+uint64_t io_stats_percentile(const io_stat_t *stat, double ratio) {
+  if (stat == NULL) return 0;
+  uint64_t num_timed = 0;
+  for (auto n : stat->latency) num_timed += n;
+  if (num_timed == 0) return 0;
+
+  uint64_t sum = 0;
+  for (int i = 0; i < kIoLatencyBuckets; ++i) {
+    sum += stat->latency[i];
+    if (sum >= ratio * num_timed) return 1ULL << i;
+  }
+  return 1ULL << (kIoLatencyBuckets - 1);
+}
+
+void io_stats_reset() {
+  for (auto &counters : site_counters) {
+    for (auto &counter : counters) clear_counter(counter);
+  }
+  for (auto &counters : table_counters) {
+    for (auto &counter : counters) clear_counter(counter);
+  }
+}
+
+void io_stats_print(FILE *fp) {
+  if (fp == NULL) return;
+  fprintf(fp, "%-14s %-6s %10s %14s %10s %8s %8s\n", "site/table", "op",
+          "count", "bytes", "avg_us", "p50_us", "p99_us");
+  io_stat_t stat;
+  for (int site = 0; site < kNumIoSites; ++site) {
+    for (int op = 0; op < kNumIoOps; ++op) {
+      io_stats_snapshot(site, op, &stat);
+      if (stat.count > 0) print_stat(fp, io_site_name(site), op, stat);
+    }
+  }
+  char name[32];
+  for (int64_t table_id = 0; table_id < kMaxNumTables; ++table_id) {
+    for (int op = 0; op < kNumIoOps; ++op) {
+      io_stats_table_snapshot(table_id, op, &stat);
+      if (stat.count == 0) continue;
+      snprintf(name, sizeof(name), "table %lld", (long long)table_id);
+      print_stat(fp, name, op, stat);
+    }
+  }
+}
+
+const char *io_op_name(int op) {
+  return op >= 0 && op < kNumIoOps ? kIoOpNames[op] : "unknown";
+}
+
+const char *io_site_name(int site) {
+  return site >= 0 && site < kNumIoSites ? kIoSiteNames[site] : "unknown";
+}
@@ -8,10 +8,12 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 
 #include "buffer_manager.h"
+#include "io_stats.h"
 #include "log.h"
 #include "trx.h"
 
@@ -20,7 +22,15 @@ struct log_list_t {
   log_record_t *rec;
 };
 
-uint64_t LSN = 1;
+// logs are created concurrently, page cleaners rely on unique lsns
+std::atomic<uint64_t> LSN{1};
+
+// patch entry of page patch log, followed by len bytes of new image
+struct page_patch_header_t {
+  pagenum_t page_num;
+  uint16_t offset;
+  uint16_t len;
+} __attribute__((packed));
 
 // mutex
 #ifdef __unix__
@@ -34,6 +44,43 @@ FILE *logmsg_fp = NULL;
 byte *log_buffer = NULL;
 uint64_t log_buffer_size = 0;
 uint64_t log_buffer_max_size = INITIAL_LOG_BUFFER_SIZE;
+// logs are pushed out of lsn order, pushed_lsn is the lsn up to which all
+// logs are pushed (pushed_ahead holds the ones after a gap), flushed_lsn is
+// pushed_lsn of the last flush. guarded by log_latch
+uint64_t pushed_lsn = 0;
+std::set<uint64_t> pushed_ahead;
+std::atomic<uint64_t> flushed_lsn{0};
+
+// logs up to lsn are on disk (opened log)
+void reset_flushed_lsn(uint64_t lsn) {
+  pthread_mutex_lock(&log_latch);
+  pushed_lsn = lsn;
+  pushed_ahead.clear();
+  flushed_lsn.store(lsn, std::memory_order_release);
+  pthread_mutex_unlock(&log_latch);
+}
+
+// log I/O, accounted to kIoSiteRecovery (reads) and kIoSiteLog (io_stats)
+ssize_t read_log(void *buf, size_t count) {
+  auto start = io_stats_start();
+  auto res = read(log_fd, buf, count);
+  io_stats_record(kIoOpRead, kIoSiteRecovery, -1, 0, res < 0 ? 0 : res, start);
+  return res;
+}
+
+ssize_t write_log(const void *buf, size_t count) {
+  auto start = io_stats_start();
+  auto res = write(log_fd, buf, count);
+  io_stats_record(kIoOpWrite, kIoSiteLog, -1, 0, res < 0 ? 0 : res, start);
+  return res;
+}
+
+int sync_log() {
+  auto start = io_stats_start();
+  auto res = fsync(log_fd);
+  io_stats_record(kIoOpSync, kIoSiteLog, -1, 0, 0, start);
+  return res;
+}
 
 byte *get_old(log_record_t *rec) {
   if (rec == NULL) return NULL;
@@ -71,9 +118,8 @@ int analysis_phase(std::set<trx_id_t> &winners, std::set<trx_id_t> &losers) {
   uint64_t current_lsn = 0;
   trx_id_t max_trx_id = 0;
 
-  // allocate maximum size log_record (max slot length is 108)
-  log_record_t *rec =
-      (log_record_t *)malloc(sizeof(log_record_t) + 108 * 2 + 8);
+  // allocate maximum size log_record
+  log_record_t *rec = (log_record_t *)malloc(MAX_LOG_RECORD_SIZE);
   if (rec == NULL) {
     LOG_ERR(4, "failed to allocate record struct, %s", strerror(errno));
     return 1;
@@ -89,15 +135,15 @@ int analysis_phase(std::set<trx_id_t> &winners, std::set<trx_id_t> &losers) {
       LOG_ERR(4, "failed to seek, %s", strerror(errno));
       return 1;
     }
-    if (read(log_fd, &log_size, sizeof(log_size)) != sizeof(log_size) ||
-        log_size == 0)
+    if (read_log(&log_size, sizeof(log_size)) != sizeof(log_size) ||
+        log_size == 0 || log_size > MAX_LOG_RECORD_SIZE)
       break;
     if (lseek(log_fd, -4, SEEK_CUR) < 0) {
       LOG_ERR(4, "failed to seek, %s", strerror(errno));
       return 1;
     }
 
-    if (read(log_fd, rec, log_size) != log_size) break;
+    if (read_log(rec, log_size) != log_size) break;
 
     current_lsn = rec->lsn;
     switch (rec->type) {
@@ -125,6 +171,7 @@ int analysis_phase(std::set<trx_id_t> &winners, std::set<trx_id_t> &losers) {
   free(rec);
 
   LSN = current_lsn + 1;
+  reset_flushed_lsn(current_lsn);
 
   if (fprintf(logmsg_fp, "[ANALYSIS] Analysis success. Winner:") < 0) {
     LOG_ERR(4, "failed to write into logmsg file, %s", strerror(errno));
@@ -172,9 +219,8 @@ int redo_phase(int log_num, std::set<trx_id_t> &winners,
     }
   }
 
-  // allocate maximum size log_record (max slot length is 108)
-  log_record_t *rec =
-      (log_record_t *)malloc(sizeof(log_record_t) + 108 * 2 + 8);
+  // allocate maximum size log_record
+  log_record_t *rec = (log_record_t *)malloc(MAX_LOG_RECORD_SIZE);
   if (rec == NULL) {
     LOG_ERR(4, "failed to allocate record struct, %s", strerror(errno));
     return 1;
@@ -192,15 +238,15 @@ int redo_phase(int log_num, std::set<trx_id_t> &winners,
       LOG_ERR(4, "failed to seek, %s", strerror(errno));
       return 1;
     }
-    if (read(log_fd, &log_size, sizeof(log_size)) != sizeof(log_size) ||
-        log_size == 0)
+    if (read_log(&log_size, sizeof(log_size)) != sizeof(log_size) ||
+        log_size == 0 || log_size > MAX_LOG_RECORD_SIZE)
       break;
     if (lseek(log_fd, -4, SEEK_CUR) < 0) {
       LOG_ERR(4, "failed to seek, %s", strerror(errno));
       return 1;
     }
 
-    if (read(log_fd, rec, log_size) != log_size) break;
+    if (read_log(rec, log_size) != log_size) break;
 
     auto is_loser = losers.find(rec->trx_id) != losers.end();
 
@@ -229,6 +275,22 @@ int redo_phase(int log_num, std::set<trx_id_t> &winners,
         }
         break;
 
+      case PAGE_PATCH_LOG:
+        if (file_open_table_file(rec->table_id) < 0) {
+          LOG_ERR(4, "failed to open table file");
+          return 1;
+        }
+        if (apply_log_page_patch(rec, true)) {
+          LOG_ERR(4, "failed to apply page patch log");
+          return 1;
+        }
+        if (fprintf(logmsg_fp, "LSN %llu [PAGE PATCH] page %llu redo apply\n",
+                    rec->lsn, rec->page_num) < 0) {
+          LOG_ERR(4, "failed to write into logmsg file, %s", strerror(errno));
+          return 1;
+        }
+        break;
+
       case UPDATE_LOG:
       case COMPENSATE_LOG:
         if (file_open_table_file(rec->table_id) < 0) {
@@ -306,9 +368,8 @@ int undo_phase(int log_num, std::set<trx_id_t> &winners,
                std::map<uint64_t, uint64_t> &lsn_pos_map) {
   uint32_t log_size;
 
-  // allocate maximum size log_record (max slot length is 108)
-  log_record_t *rec =
-      (log_record_t *)malloc(sizeof(log_record_t) + 108 * 2 + 8);
+  // allocate maximum size log_record
+  log_record_t *rec = (log_record_t *)malloc(MAX_LOG_RECORD_SIZE);
   if (rec == NULL) {
     LOG_ERR(4, "failed to allocate record struct, %s", strerror(errno));
     return 1;
@@ -334,14 +395,14 @@ int undo_phase(int log_num, std::set<trx_id_t> &winners,
       LOG_ERR(4, "failed to seek, %s", strerror(errno));
       return 1;
     }
-    if (read(log_fd, &log_size, sizeof(log_size)) != sizeof(log_size) ||
-        log_size == 0)
+    if (read_log(&log_size, sizeof(log_size)) != sizeof(log_size) ||
+        log_size == 0 || log_size > MAX_LOG_RECORD_SIZE)
       break;
     if (lseek(log_fd, -4, SEEK_CUR) < 0) {
       LOG_ERR(4, "failed to seek, %s", strerror(errno));
       return 1;
     }
-    if (read(log_fd, rec, log_size) != log_size) break;
+    if (read_log(rec, log_size) != log_size) break;
 
     if (rec->type == BEGIN_LOG) {
       auto *trx = get_trx(rec->trx_id);
@@ -486,14 +547,15 @@ int init_recovery(int flag, int log_num, char *log_path, char *logmsg_path) {
 
     // write guard log_size (for reading)
     uint32_t guard = 0;
-    if (write(log_fd, &guard, sizeof(guard)) != sizeof(guard)) {
+    if (write_log(&guard, sizeof(guard)) != sizeof(guard)) {
       LOG_ERR(5, "cannot write log, errno: %s", strerror(errno));
       return 1;
     }
-    if (fsync(log_fd) < 0) {
+    if (sync_log() < 0) {
       LOG_ERR(5, "cannot sync log file, errno: %s", strerror(errno));
       return 1;
     }
+    reset_flushed_lsn(get_last_lsn());
 
   } else {
     log_fd = open(log_path, O_RDWR);
@@ -609,6 +671,115 @@ log_record_t *create_log_compensate(trx_t *trx, int64_t table_id,
   return rec;
 }
 
+log_record_t *create_log_page_patch(int64_t table_id, pagenum_t page_id,
+                                    const page_patch_t *patches, int n) {
+  if (patches == NULL || n < 1 || n > UINT16_MAX) {
+    LOG_ERR(5, "invalid parameters");
+    return NULL;
+  }
+  uint64_t log_size = sizeof(log_record_t);
+  for (int i = 0; i < n; ++i) {
+    if (patches[i].data == NULL ||
+        patches[i].offset + patches[i].len > file_page_size(table_id)) {
+      LOG_ERR(5, "invalid patch on page %llu", patches[i].page_num);
+      return NULL;
+    }
+    log_size += sizeof(page_patch_header_t) + patches[i].len;
+  }
+  if (log_size > MAX_LOG_RECORD_SIZE) {
+    LOG_WARN("too large page patch log (%llu bytes)", log_size);
+    return NULL;
+  }
+
+  log_record_t *rec = (log_record_t *)malloc(log_size);
+  if (rec == NULL) {
+    LOG_ERR(5, "failed to allocate");
+    return NULL;
+  }
+  rec->log_size = log_size;
+  rec->lsn = LSN++;
+  rec->prev_lsn = 0;
+  rec->trx_id = 0;
+  rec->type = PAGE_PATCH_LOG;
+  rec->table_id = table_id;
+  rec->page_num = page_id;
+  rec->offset = 0;
+  rec->len = n;
+
+  auto *iter = ((byte *)rec) + sizeof(log_record_t);
+  for (int i = 0; i < n; ++i) {
+    page_patch_header_t patch = {patches[i].page_num, patches[i].offset,
+                                 patches[i].len};
+    memcpy(iter, &patch, sizeof(patch));
+    memcpy(iter + sizeof(patch), patches[i].data, patch.len);
+    iter += sizeof(patch) + patch.len;
+  }
+  return rec;
+}
+
+int apply_log_page_patch(log_record_t *rec, bool redo) {
+  if (rec == NULL || rec->type != PAGE_PATCH_LOG) {
+    LOG_ERR(5, "invalid parameters");
+    return 1;
+  }
+  auto table_id = rec->table_id;
+
+  // pages cut off by a later truncation are not redone
+  uint64_t num_of_pages = UINT64_MAX;
+  if (redo) {
+    auto *header = buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum);
+    num_of_pages = header->header.num_of_pages;
+    unpin(header);
+  }
+
+  // all patches on a page are redone or none of them
+  std::set<pagenum_t> applied, skipped;
+  auto *iter = ((byte *)rec) + sizeof(log_record_t);
+  for (int i = 0; i < rec->len; ++i) {
+    page_patch_header_t patch;
+    memcpy(&patch, iter, sizeof(patch));
+    auto *data = iter + sizeof(patch);
+    iter = data + patch.len;
+    if (patch.page_num >= num_of_pages || skipped.count(patch.page_num))
+      continue;
+
+    auto *page = buffer_get_page_ptr<bpt_page_t>(table_id, patch.page_num);
+    if (page == NULL) {
+      LOG_ERR(5, "failed to get page %llu", patch.page_num);
+      return 1;
+    }
+    if (redo && applied.count(patch.page_num) == 0 &&
+        page->header.page_lsn >= rec->lsn) {
+      skipped.insert(patch.page_num);
+      unpin(page);
+      continue;
+    }
+
+    auto group = space_map_group(patch.page_num);
+    auto *space_map = (space_map_page_t *)page;
+    auto old_num_free_pages = space_map->space_map.num_free_pages;
+    memcpy(page->page.data + patch.offset, data, patch.len);
+    page->header.page_lsn = std::max(page->header.page_lsn, rec->lsn);
+    set_dirty(page);
+    applied.insert(patch.page_num);
+
+    // keep the space summary in sync with space maps and the header
+    if (patch.page_num == space_map_pagenum(group)) {
+      file_update_space_summary(
+          table_id, group,
+          space_map->space_map.num_free_pages - old_num_free_pages);
+    } else if (patch.page_num == kHeaderPagenum) {
+      auto *header = (header_page_t *)page;
+      file_truncate_space_summary(
+          table_id, space_map_group(header->header.num_of_pages - 1) + 1);
+    }
+    unpin(page);
+  }
+  return 0;
+}
+
+uint64_t get_last_lsn() { return LSN - 1; }
+
 int push_into_log_buffer(log_record_t *rec) {
   if (rec == NULL) return 1;
 
@@ -620,6 +791,15 @@ int push_into_log_buffer(log_record_t *rec) {
   }
   memcpy(log_buffer + log_buffer_size, rec, rec->log_size);
   log_buffer_size += rec->log_size;
+  if (rec->lsn == pushed_lsn + 1) {
+    ++pushed_lsn;
+    while (!pushed_ahead.empty() && *pushed_ahead.begin() == pushed_lsn + 1) {
+      pushed_ahead.erase(pushed_ahead.begin());
+      ++pushed_lsn;
+    }
+  } else if (rec->lsn > pushed_lsn) {
+    pushed_ahead.insert(rec->lsn);
+  }
   pthread_mutex_unlock(&log_latch);
 
   return 0;
@@ -634,29 +814,34 @@ int flush_log() {
     return 1;
   }
 
-  if (write(log_fd, log_buffer, log_buffer_size) != log_buffer_size) {
+  if (write_log(log_buffer, log_buffer_size) != log_buffer_size) {
     LOG_ERR(5, "cannot flush log, errno: %s", strerror(errno));
     return 1;
   }
-  if (fsync(log_fd) < 0) {
+  if (sync_log() < 0) {
     LOG_ERR(5, "cannot sync log file, errno: %s", strerror(errno));
     return 1;
   }
   // write guard log_size (for reading)
   uint32_t guard = 0;
-  if (write(log_fd, &guard, sizeof(guard)) != sizeof(guard)) {
+  if (write_log(&guard, sizeof(guard)) != sizeof(guard)) {
     LOG_ERR(5, "cannot write log, errno: %s", strerror(errno));
     return 1;
   }
-  if (fsync(log_fd) < 0) {
+  if (sync_log() < 0) {
     LOG_ERR(5, "cannot sync log file, errno: %s", strerror(errno));
     return 1;
   }
   log_buffer_size = 0;
+  flushed_lsn.store(pushed_lsn, std::memory_order_release);
   pthread_mutex_unlock(&log_latch);
   return 0;
 }
 
+uint64_t get_flushed_lsn() {
+  return flushed_lsn.load(std::memory_order_acquire);
+}
+
 void descript_log_file(int n) {
   uint32_t log_size;
   log_record_t *rec = NULL;
@@ -666,7 +851,7 @@ void descript_log_file(int n) {
     return;
   }
 
-  while (n-- && read(log_fd, &log_size, 4) == 4 && log_size != 0) {
+  while (n-- && read_log(&log_size, 4) == 4 && log_size != 0) {
     if (lseek(log_fd, -4, SEEK_CUR) < 0) {
       LOG_ERR(5, "failed to seek");
       return;
@@ -676,7 +861,7 @@ void descript_log_file(int n) {
       LOG_ERR(5, "failed to allocate log record struct");
       return;
     }
-    auto read_res = read(log_fd, rec, log_size);
+    auto read_res = read_log(rec, log_size);
     if (read_res < 0) {
       LOG_ERR(5, "failed to read, %s", strerror(errno));
       return;
@@ -708,6 +893,10 @@ void descript_log_file(int n) {
             rec->lsn, rec->trx_id, rec->table_id, rec->page_num, rec->offset,
             rec->prev_lsn, get_next_undo_lsn(rec));
         break;
+      case PAGE_PATCH_LOG:
+        printf("%llu: page patch (table %lld, page %llu, %u patches)\n",
+               rec->lsn, rec->table_id, rec->page_num, rec->len);
+        break;
     }
 
     free(rec);
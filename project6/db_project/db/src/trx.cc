@@ -542,6 +542,33 @@ struct leaf_slot_t {
   int32_t trx_id;
 } __attribute__((packed));
 
+bool lock_is_page_locked(bpt_page_t *page, int64_t table_id,
+                         pagenum_t page_id) {
+  if (page == NULL) {
+    LOG_ERR(6, "invalid parameters");
+    return true;
+  }
+
+  pthread_mutex_lock(&lock_table_latch);
+  pthread_mutex_lock(&trx_table_latch);
+  bool result = false;
+  auto found = lock_table.find(std::make_pair(table_id, page_id));
+  if (found != lock_table.end() && found->second.head != NULL) result = true;
+
+  if (!result && page->header.is_leaf) {
+    leaf_slot_t *slots = (leaf_slot_t *)(page->page.data + kBptPageHeaderSize);
+    for (uint32_t i = 0; i < page->header.num_of_keys; ++i) {
+      if (slots[i].trx_id != 0 && is_trx_assigned(slots[i].trx_id)) {
+        result = true;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&trx_table_latch);
+  pthread_mutex_unlock(&lock_table_latch);
+  return result;
+}
+
 int convert_implicit_lock(bpt_page_t *page, int table_id, pagenum_t page_id,
                           int64_t key, trx_id_t trx_id, int *slotnum) {
 #ifdef TIME_CHECKING
@@ -786,7 +813,9 @@ lock_t *lock_acquire(bpt_page_t **page_ptr, int64_t table_id, pagenum_t page_id,
     return NULL;
   }
   if (is_deadlock(new_lock)) {
+    // rollback of the trx latches its pages
     unpin(*page_ptr);
+    *page_ptr = NULL;
     trx->releasing = true;
     pthread_mutex_unlock(&trx_table_latch);
     pthread_mutex_unlock(&lock_table_latch);
@@ -807,6 +836,7 @@ lock_t *lock_acquire(bpt_page_t **page_ptr, int64_t table_id, pagenum_t page_id,
 
   if (find_conflicting_lock(new_lock) != NULL) {
     unpin(*page_ptr);
+    *page_ptr = NULL;
     pthread_cond_wait(&new_lock->cond, &lock_table_latch);
     pthread_mutex_unlock(&lock_table_latch);
     // because there is no insertion and deletion, able to continue immediately
@@ -3,9 +3,11 @@
 #include <string.h>
 #include <time.h>
 
+#include "buffer_manager.h"
 #include "database.h"
 #include "disk_space_manager/file.h"
 #include "index_manager/index.h"
+#include "io_stats.h"
 #include "log.h"
 #include "recovery.h"
 #include "trx.h"
@@ -23,6 +25,11 @@ const int SCAN_COUNT = 10000;
 const int LONG_TRX_TEST_BUF_SIZE = 100;
 const int TRANSFER_PER_TRX_IN_LONG_TRX = 100;
 
+// pool of the replacement benchmark holds about a quarter of the tables
+const int BENCHMARK_BUF_SIZE = 300;
+const int BENCHMARK_TRANSFER_COUNT = 20000;
+const int BENCHMARK_SCAN_INTERVAL = 1000;  // transfers between full scans
+
 const long long INITIAL_MONEY = 100000;
 const int MAX_MONEY_TRANSFERRED = 100;
 const long long SUM_MONEY = TABLE_NUMBER * RECORD_NUMBER * INITIAL_MONEY;
@@ -40,11 +47,13 @@ int single_thread();
 int multi_thread();
 int multi_thread_long_trx();
 int scan_after_recovery();
+int replacement_benchmark();
 
 // int main(int argc, char **argv) { return single_thread(); }
 // int main(int argc, char **argv) { return print_log(20000); }
 // int main(int argc, char **argv) { return multi_thread(); }
 // int main(int argc, char **argv) { return multi_thread_long_trx(); }
+// int main(int argc, char **argv) { return replacement_benchmark(); }
 int main(int argc, char **argv) { return scan_after_recovery(); }
 
 int print_log(int n) {
@@ -57,6 +66,7 @@ int single_thread() {
   auto start = clock();
   char filename[TABLE_NUMBER][100];
   int64_t table_id[TABLE_NUMBER];
+  io_stats_set_timing(true);
   init_db(5000, 0, 100, LOG_FILENAME, LOGMSG_FILENAME);
   for (int i = 0; i < TABLE_NUMBER; ++i) {
     sprintf(filename[i], "DATA%d", i + 1);
@@ -189,6 +199,7 @@ int single_thread() {
   LOG_INFO("complete in %llf seconds", (double)time / CLOCKS_PER_SEC);
 
   print_debugging_infos();
+  io_stats_print(stdout);
 
   for (int i = 0; i < TABLE_NUMBER; ++i) {
     remove(filename[i]);
@@ -521,4 +532,90 @@ int scan_after_recovery() {
   }
   LOG_INFO("Scan is done.");
   return 0;
-}
\ No newline at end of file
+}
+
+int sum_money(int64_t key, const char *value, uint16_t size, void *arg) {
+  *(long long *)arg += ((const account_t *)value)->money;
+  return 0;
+}
+
+int replacement_benchmark() {
+  const char *policy_names[kNumReplacementPolicies] = {"LRU", "LRU-2", "2Q",
+                                                       "CLOCK"};
+  char filename[TABLE_NUMBER][100];
+  int64_t table_id[TABLE_NUMBER];
+
+  for (int policy = 0; policy < kNumReplacementPolicies; ++policy) {
+    buffer_set_replacement_policy(policy);
+    remove(LOG_FILENAME);
+    init_db(BENCHMARK_BUF_SIZE, 0, 100, LOG_FILENAME, LOGMSG_FILENAME);
+    for (int i = 0; i < TABLE_NUMBER; ++i) {
+      sprintf(filename[i], "DATA%d", i + 1);
+      remove(filename[i]);
+      table_id[i] = file_open_table_file(filename[i]);
+    }
+
+    account_t acc;
+    acc.money = INITIAL_MONEY;
+    for (int tid = 0; tid < TABLE_NUMBER; ++tid) {
+      for (int rid = 0; rid < RECORD_NUMBER; ++rid) {
+        if (db_insert(table_id[tid], rid, acc.data, sizeof(acc))) {
+          LOG_ERR(-1, "failed to insert!");
+          return -1;
+        }
+      }
+    }
+
+    // same transfers and scans for every policy
+    srand(0);
+    buffer_reset_hit_stats();
+    for (int i = 0; i < BENCHMARK_TRANSFER_COUNT; ++i) {
+      auto src_table_id = table_id[rand() % TABLE_NUMBER];
+      auto src_record_id = rand() % RECORD_NUMBER;
+      auto dest_table_id = table_id[rand() % TABLE_NUMBER];
+      auto dest_record_id = rand() % RECORD_NUMBER;
+      if (src_table_id == dest_table_id && src_record_id == dest_record_id)
+        continue;
+      long long money_transferred = rand() % MAX_MONEY_TRANSFERRED;
+
+      auto trx = trx_begin();
+      account_t acc1, acc2;
+      uint16_t size;
+      if (db_find(src_table_id, src_record_id, acc1.data, &size, trx) ||
+          db_find(dest_table_id, dest_record_id, acc2.data, &size, trx)) {
+        LOG_ERR(-1, "find failed!");
+        return -1;
+      }
+      acc1.money -= money_transferred;
+      acc2.money += money_transferred;
+      if (db_update(src_table_id, src_record_id, acc1.data, sizeof(acc1),
+                    &size, trx) ||
+          db_update(dest_table_id, dest_record_id, acc2.data, sizeof(acc2),
+                    &size, trx)) {
+        LOG_ERR(-1, "update failed!");
+        return -1;
+      }
+      trx_commit(trx);
+
+      if ((i + 1) % BENCHMARK_SCAN_INTERVAL == 0) {
+        long long sum = 0;
+        for (int tid = 0; tid < TABLE_NUMBER; ++tid)
+          db_scan(table_id[tid], 0, RECORD_NUMBER, sum_money, &sum);
+        if (sum != SUM_MONEY) {
+          LOG_ERR(-1, "inconsistent state is detected!");
+          return -1;
+        }
+      }
+    }
+
+    uint64_t hits, misses;
+    buffer_get_hit_stats(&hits, &misses);
+    LOG_INFO("%s: %llu hits, %llu misses, hit ratio %.4f",
+             policy_names[policy], hits, misses,
+             (double)hits / (hits + misses));
+    shutdown_db();
+    for (int i = 0; i < TABLE_NUMBER; ++i) remove(filename[i]);
+  }
+  buffer_set_replacement_policy(kReplaceLRU);
+  return 0;
+}
@@ -1,9 +1,29 @@
 #include <gtest/gtest.h>
+#include <pthread.h>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
 #include <vector>
 
 #include "disk_space_manager/file.h"
+#include "disk_space_manager/page_checksum.h"
+#include "disk_space_manager/page_codec.h"
+#include "io_stats.h"
 #include "log.h"
+#include "recovery.h"
+
+// compare pages except their checksum fields (set on write)
+bool same_page(const page_t *a, const page_t *b, pagenum_t pagenum,
+               uint64_t size = kPageSize) {
+  auto offset = page_checksum_offset(pagenum);
+  return memcmp(a, b, offset) == 0 &&
+         memcmp(a->data + offset + 4, b->data + offset + 4,
+                size - offset - 4) == 0;
+}
 
 class DiskSpaceManagerTest : public ::testing::Test {
  protected:
@@ -20,6 +40,7 @@ class DiskSpaceManagerTest : public ::testing::Test {
 
   void TearDown() override {
     file_close_table_files();
+    file_close_double_write();
     remove(_filename);
     remove(log_path);
     remove(logmsg_path);
@@ -57,9 +78,10 @@ TEST_F(DiskSpaceManagerTest, alloc_dealloc_pages) {
     file_free_page(table_id, page);
   }
 
+  // every page except header and space map page can be allocated
   header_page_t header_page;
   file_read_header_page(table_id, &header_page);
-  for (int i = 0; i < header_page.header.num_of_pages - 1; ++i) {
+  for (int i = 0; i < header_page.header.num_of_pages - 2; ++i) {
     ASSERT_NE(file_alloc_page(table_id), 0);
   }
   ASSERT_EQ(file_size(table_id), kDefaultFileSize);
@@ -83,6 +105,79 @@ TEST_F(DiskSpaceManagerTest, auto_expand) {
   }
 }
 
+TEST_F(DiskSpaceManagerTest, space_map) {
+  SetUp("DATA1");
+
+  header_page_t header_page;
+  file_read_header_page(table_id, &header_page);
+  ASSERT_EQ(header_page.header.magic, kHeaderMagic);
+
+  // free pages are handed out in order, skipping space map pages
+  auto num_of_pages = kPagesPerSpaceMap + 100;
+  for (pagenum_t i = 2; i < num_of_pages; ++i) {
+    if (i == space_map_pagenum(1)) continue;
+    ASSERT_EQ(file_alloc_page(table_id), i);
+  }
+  file_read_header_page(table_id, &header_page);
+  ASSERT_GE(header_page.header.num_of_pages, num_of_pages);
+  ASSERT_EQ(file_size(table_id), header_page.header.num_of_pages * kPageSize);
+
+  space_map_page_t space_map;
+  file_read_page(table_id, space_map_pagenum(1), &space_map.page);
+  ASSERT_EQ(space_map.space_map.num_pages,
+            header_page.header.num_of_pages - kPagesPerSpaceMap);
+  ASSERT_EQ(space_map.space_map.num_free_pages,
+            header_page.header.num_of_pages - num_of_pages);
+  ASSERT_EQ(space_map_last_used(&space_map, 1),
+            num_of_pages - 1 - kPagesPerSpaceMap);
+  space_map_page_t empty_map;
+  space_map_init(&empty_map, 0);
+  space_map_extend(&empty_map, kPagesPerSpaceMap);
+  ASSERT_LT(space_map_last_used(&empty_map, 0), 0);
+  space_map_init(&empty_map, 1);
+  space_map_extend(&empty_map, kPagesPerSpaceMap);
+  ASSERT_LT(space_map_last_used(&empty_map, 1), 0);
+
+  // freed page is reused, free page near the hint is taken
+  file_free_page(table_id, 1234);
+  file_free_page(table_id, 4321);
+  ASSERT_EQ(file_alloc_page(table_id, 2000), 4321);
+  ASSERT_EQ(file_alloc_page(table_id), 1234);
+  ASSERT_EQ(file_alloc_page(table_id, num_of_pages - 1), num_of_pages);
+  ASSERT_EQ(file_alloc_page(table_id, num_of_pages), num_of_pages + 1);
+
+  // summary is rebuilt from space maps on open
+  file_close_table_files();
+  table_id = file_open_table_file(_filename);
+  ASSERT_TRUE(table_id > 0);
+  file_free_page(table_id, 777);
+  ASSERT_EQ(file_alloc_page(table_id), 777);
+  ASSERT_EQ(file_alloc_page(table_id, num_of_pages + 1), num_of_pages + 2);
+}
+
+TEST_F(DiskSpaceManagerTest, extent_allocation) {
+  SetUp("DATA1");
+
+  for (pagenum_t i = 2; i <= 400; ++i) {
+    ASSERT_EQ(file_alloc_page(table_id), i);
+  }
+  // scattered holes in the third extent [128, 192)
+  file_free_page(table_id, 130);
+  file_free_page(table_id, 140);
+  file_free_page(table_id, 150);
+
+  // extent of the hint is full, new run starts in the extent having room
+  // instead of the nearest hole
+  ASSERT_EQ(file_alloc_page(table_id, 100), 401);
+  ASSERT_EQ(file_alloc_page(table_id, 402), 402);
+  ASSERT_EQ(file_alloc_page(table_id, 403), 403);
+
+  // holes are used when the hint is in their extent
+  ASSERT_EQ(file_alloc_page(table_id, 135), 140);
+  ASSERT_EQ(file_alloc_page(table_id, 135), 150);
+  ASSERT_EQ(file_alloc_page(table_id, 135), 130);
+}
+
 TEST_F(DiskSpaceManagerTest, read_write_page) {
   SetUp("DATA1");
 
@@ -99,6 +194,483 @@ TEST_F(DiskSpaceManagerTest, read_write_page) {
   ASSERT_TRUE(strcmp(page.data, "Hello World!") == 0);
 }
 
+TEST_F(DiskSpaceManagerTest, direct_io) {
+  SetUp("DATA1");
+  file_close_table_files();
+  file_set_direct_io(true);
+  table_id = file_open_table_file(_filename);
+  file_set_direct_io(false);
+  ASSERT_TRUE(table_id > 0);
+  if (!file_is_direct_io(table_id)) {
+    LOG_WARN("file system does not support O_DIRECT");
+  }
+
+  // unaligned page (bounced)
+  auto unaligned_page = file_alloc_page(table_id);
+  std::vector<byte> buf(sizeof(page_t) + 1);
+  auto *page = (page_t *)(buf.data() + 1);
+  strcpy(page->data, "unaligned page");
+  file_write_page(table_id, unaligned_page, page);
+
+  // aligned page
+  auto aligned_page = file_alloc_page(table_id);
+  page_t *frame;
+  ASSERT_EQ(posix_memalign((void **)&frame, kPageSize, sizeof(page_t)), 0);
+  strcpy(frame->data, "aligned page");
+  file_write_page(table_id, aligned_page, frame);
+
+  memset(page, 0, sizeof(page_t));
+  memset(frame, 0, sizeof(page_t));
+  file_read_page(table_id, unaligned_page, frame);
+  file_read_page(table_id, aligned_page, page);
+  ASSERT_STREQ(frame->data, "unaligned page");
+  ASSERT_STREQ(page->data, "aligned page");
+  free(frame);
+
+  header_page_t header;
+  file_read_header_page(table_id, &header);
+  ASSERT_EQ(header.header.magic, kHeaderMagic);
+}
+
+TEST_F(DiskSpaceManagerTest, deferred_sync) {
+  SetUp("DATA1");
+  file_set_deferred_sync(true);
+
+  // more writes than a sync batch, page writes ask for a sync each
+  const int kNumPages = 2 * kDeferredSyncPages + 100;
+  std::vector<pagenum_t> pagenums;
+  page_t page, read_page;
+  for (int i = 0; i < kNumPages; ++i) {
+    auto pagenum = file_alloc_page(table_id);
+    memset(&page, 0, sizeof(page));
+    snprintf(page.data, 100, "deferred page %d", i);
+    file_write_page(table_id, pagenum, &page);
+    pagenums.push_back(pagenum);
+  }
+  file_sync_all();
+
+  // header and space map pages are not recovered by the log
+  io_stats_reset();
+  header_page_t header;
+  file_read_header_page(table_id, &header);
+  file_write_header_page(table_id, &header);
+  io_stat_t stat;
+  io_stats_snapshot(kIoSitePage, kIoOpSync, &stat);
+  ASSERT_EQ(stat.count, 1);
+  file_set_deferred_sync(false);
+
+  file_close_table_files();
+  table_id = file_open_table_file(_filename);
+  ASSERT_TRUE(table_id > 0);
+  for (int i = 0; i < kNumPages; ++i) {
+    snprintf(page.data, 100, "deferred page %d", i);
+    file_read_page(table_id, pagenums[i], &read_page);
+    ASSERT_STREQ(read_page.data, page.data);
+  }
+}
+
+TEST_F(DiskSpaceManagerTest, io_stats) {
+  SetUp("DATA1");
+  const char *trace_path = "DATA1_io_trace.txt";
+  auto pagenum = file_alloc_page(table_id);
+  io_stats_reset();
+  io_stats_set_timing(true);
+  ASSERT_EQ(io_stats_set_trace(trace_path), 0);
+
+  page_t page;
+  memset(&page, 0, sizeof(page));
+  file_write_page(table_id, pagenum, &page);
+  file_read_page(table_id, pagenum, &page);
+  file_read_page(table_id, pagenum, &page);
+  flush_log();
+  io_stats_set_trace(NULL);
+  io_stats_set_timing(false);
+
+  io_stat_t stat;
+  io_stats_snapshot(kIoSitePage, kIoOpRead, &stat);
+  ASSERT_EQ(stat.count, 2);
+  ASSERT_EQ(stat.bytes, 2 * kPageSize);
+  ASSERT_GT(io_stats_percentile(&stat, 0.99), 0);
+  io_stats_snapshot(kIoSitePage, kIoOpWrite, &stat);
+  ASSERT_EQ(stat.count, 1);
+  io_stats_snapshot(kIoSitePage, kIoOpSync, &stat);
+  ASSERT_EQ(stat.count, 1);
+  io_stats_table_snapshot(table_id, kIoOpRead, &stat);
+  ASSERT_EQ(stat.count, 2);
+  // buffer and guard of the log
+  io_stats_snapshot(kIoSiteLog, kIoOpSync, &stat);
+  ASSERT_EQ(stat.count, 2);
+  io_stats_table_snapshot(table_id, kIoOpSync, &stat);
+  ASSERT_EQ(stat.count, 1);
+
+  // header line and a line per call
+  FILE *fp = fopen(trace_path, "r");
+  ASSERT_TRUE(fp != NULL);
+  int num_lines = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), fp) != NULL) ++num_lines;
+  fclose(fp);
+  remove(trace_path);
+  ASSERT_EQ(num_lines, 1 + 4 + 4);
+
+  // counting is always on, latency is not
+  io_stats_reset();
+  file_read_page(table_id, pagenum, &page);
+  io_stats_snapshot(-1, kIoOpRead, &stat);
+  ASSERT_EQ(stat.count, 1);
+  ASSERT_EQ(io_stats_percentile(&stat, 0.5), 0);
+}
+
+TEST_F(DiskSpaceManagerTest, page_size) {
+  SetUp("DATA1");
+  file_close_table_files();
+  remove(_filename);
+  const uint64_t kLargePageSize = 16 * 1024;
+  ASSERT_EQ(file_set_page_size(kLargePageSize), 0);
+  table_id = file_open_table_file(_filename);
+  file_set_page_size(kPageSize);
+  ASSERT_TRUE(table_id > 0);
+  ASSERT_EQ(file_page_size(table_id), kLargePageSize);
+  ASSERT_EQ(file_size(table_id), kDefaultFileSize);
+
+  header_page_t header;
+  file_read_header_page(table_id, &header);
+  ASSERT_EQ(header.header.num_of_pages, kDefaultFileSize / kLargePageSize);
+  ASSERT_EQ(header.header.page_size, kLargePageSize);
+
+  // whole page is transferred, its tail is at the end of its slot
+  std::vector<byte> page(kLargePageSize), read_page(kLargePageSize);
+  auto pagenum = file_alloc_page(table_id);
+  strcpy(page.data(), "head of large page");
+  strcpy(page.data() + kLargePageSize - 32, "tail of large page");
+  file_write_page(table_id, pagenum, (page_t *)page.data());
+
+  file_close_table_files();
+  table_id = file_open_table_file(_filename);
+  ASSERT_TRUE(table_id > 0);
+  ASSERT_EQ(file_page_size(table_id), kLargePageSize);
+  file_read_page(table_id, pagenum, (page_t *)read_page.data());
+  ASSERT_TRUE(same_page((page_t *)page.data(), (page_t *)read_page.data(),
+                        pagenum, kLargePageSize));
+
+  int fd = open(_filename, O_RDONLY);
+  char tail[32];
+  ASSERT_EQ(pread(fd, tail, sizeof(tail), (pagenum + 1) * kLargePageSize - 32),
+            sizeof(tail));
+  close(fd);
+  ASSERT_STREQ(tail, "tail of large page");
+
+  // file is expanded once its pages are used up
+  for (uint64_t i = 0; i < kDefaultFileSize / kLargePageSize; ++i)
+    file_alloc_page(table_id);
+  ASSERT_EQ(file_size(table_id), 2 * kDefaultFileSize);
+}
+
+TEST_F(DiskSpaceManagerTest, double_write) {
+  SetUp("DATA1");
+  const char *kDoubleWritePath = "DATA1_dw";
+  const char *kCheck = "123456789";
+  ASSERT_EQ(crc32c(0, kCheck, strlen(kCheck)), 0xe3069283);
+
+  // torn page is detected by its checksum
+  page_t page, read_page;
+  memset(&page, 0, sizeof(page));
+  strcpy(page.data, "page to be torn");
+  auto pagenum = file_alloc_page(table_id);
+  file_write_page(table_id, pagenum, &page);
+  int fd = open(_filename, O_WRONLY);
+  ASSERT_EQ(pwrite(fd, "torn", 4, pagenum * kPageSize + kPageSize / 2), 4);
+  file_io_request_t req;
+  memset(&req, 0, sizeof(req));
+  req.table_id = table_id;
+  req.pagenum = pagenum;
+  req.page = &read_page;
+  ASSERT_EQ(file_io_submit(&req, 1), 0);
+  ASSERT_NE(file_io_wait(&req, 1), 0);
+
+  // batched writes are restored from the double-write area
+  ASSERT_EQ(file_open_double_write(kDoubleWritePath), 0);
+  const int kBatchSize = 16;
+  std::vector<page_t> pages(kBatchSize);
+  std::vector<file_io_request_t> reqs(kBatchSize);
+  memset(reqs.data(), 0, kBatchSize * sizeof(file_io_request_t));
+  for (int i = 0; i < kBatchSize; ++i) {
+    snprintf(pages[i].data, 100, "double written page %d", i);
+    reqs[i].table_id = table_id;
+    reqs[i].pagenum = i == 0 ? pagenum : file_alloc_page(table_id);
+    reqs[i].page = &pages[i];
+    reqs[i].is_write = true;
+  }
+  ASSERT_EQ(file_io_submit(reqs.data(), kBatchSize), 0);
+  for (int i = 0; i < kBatchSize; ++i) ASSERT_TRUE(reqs[i].done);
+  ASSERT_EQ(file_io_wait(reqs.data(), kBatchSize), 0);
+
+  // crash in the middle of writing pages in place
+  std::vector<byte> garbage(kPageSize / 2, 'x');
+  for (int i = 0; i < kBatchSize; i += 2) {
+    ASSERT_EQ(pwrite(fd, garbage.data(), garbage.size(),
+                     reqs[i].pagenum * kPageSize + kPageSize / 2),
+              garbage.size());
+  }
+  close(fd);
+  file_close_table_files();
+  ASSERT_EQ(file_open_double_write(kDoubleWritePath), 0);
+  table_id = file_open_table_file(_filename);
+  ASSERT_TRUE(table_id > 0);
+  for (int i = 0; i < kBatchSize; ++i) {
+    file_read_page(table_id, reqs[i].pagenum, &read_page);
+    ASSERT_TRUE(same_page(&pages[i], &read_page, reqs[i].pagenum));
+  }
+  file_close_double_write();
+  ASSERT_NE(access(kDoubleWritePath, F_OK), 0);
+}
+
+TEST_F(DiskSpaceManagerTest, page_codec) {
+  std::default_random_engine rng(1234);
+  std::vector<std::vector<byte>> inputs;
+  inputs.emplace_back(kPageSize, 0);
+  inputs.emplace_back(kPageSize);
+  for (auto &c : inputs.back()) c = (byte)rng();
+  inputs.emplace_back(kPageSize);
+  for (int i = 0; i < kPageSize; ++i)
+    inputs.back()[i] = i < 1000 ? "record "[i % 7] : (byte)(i % 3);
+  inputs.emplace_back(3, 'a');
+  inputs.emplace_back();
+
+  std::vector<byte> compressed(2 * kPageSize), output(kPageSize);
+  for (auto &input : inputs) {
+    auto size = page_compress(input.data(), input.size(), compressed.data(),
+                              compressed.size());
+    ASSERT_GT(size, 0);
+    ASSERT_EQ(page_decompress(compressed.data(), size, output.data(),
+                              output.size()),
+              input.size());
+    ASSERT_TRUE(std::equal(input.begin(), input.end(), output.begin()));
+  }
+  // zero page is almost free, random page does not fit in a page
+  ASSERT_LT(page_compress(inputs[0].data(), kPageSize, compressed.data(),
+                          compressed.size()),
+            64);
+  ASSERT_EQ(page_compress(inputs[1].data(), kPageSize, compressed.data(),
+                          kPageSize - 512),
+            0);
+  // malformed input is rejected
+  compressed[0] = (byte)0xf0;
+  ASSERT_LT(page_decompress(compressed.data(), 2, output.data(),
+                            output.size()),
+            0);
+}
+
+TEST_F(DiskSpaceManagerTest, compressed_table) {
+  SetUp("DATA1");
+  file_close_table_files();
+  remove(_filename);
+  file_set_compression(true);
+  table_id = file_open_table_file(_filename);
+  file_set_compression(false);
+  ASSERT_TRUE(table_id > 0);
+  ASSERT_TRUE(file_is_compressed(table_id));
+
+  // sparse pages (like leaves with free space) and an incompressible one
+  const int kNumPages = 1000;
+  std::default_random_engine rng(1234);
+  std::vector<pagenum_t> pagenums;
+  page_t page, read_page;
+  for (int i = 0; i < kNumPages; ++i) {
+    auto pagenum = file_alloc_page(table_id);
+    memset(&page, 0, sizeof(page));
+    snprintf(page.data, 100, "page %d is compressed", i);
+    file_write_page(table_id, pagenum, &page, false);
+    pagenums.push_back(pagenum);
+  }
+  auto random_pagenum = file_alloc_page(table_id);
+  page_t random_page;
+  for (auto &c : random_page.data) c = (byte)rng();
+  file_write_page(table_id, random_pagenum, &random_page);
+
+  struct stat st;
+  ASSERT_EQ(stat(_filename, &st), 0);
+  ASSERT_LT(st.st_blocks * 512, kNumPages * kPageSize / 2);
+  ASSERT_LT(st.st_size, file_size(table_id) / 2);
+
+  // format is kept in the header
+  file_close_table_files();
+  table_id = file_open_table_file(_filename);
+  ASSERT_TRUE(table_id > 0);
+  ASSERT_TRUE(file_is_compressed(table_id));
+  for (int i = 0; i < kNumPages; ++i) {
+    memset(&page, 0, sizeof(page));
+    snprintf(page.data, 100, "page %d is compressed", i);
+    file_read_page(table_id, pagenums[i], &read_page);
+    ASSERT_TRUE(same_page(&page, &read_page, pagenums[i]));
+  }
+  file_read_page(table_id, random_pagenum, &read_page);
+  ASSERT_TRUE(same_page(&random_page, &read_page, random_pagenum));
+
+  // batched I/O goes through the same slots
+  file_io_request_t req;
+  memset(&req, 0, sizeof(req));
+  req.table_id = table_id;
+  req.pagenum = pagenums[0];
+  req.page = &page;
+  req.is_write = true;
+  snprintf(page.data, 100, "rewritten page");
+  ASSERT_EQ(file_io_submit(&req, 1), 0);
+  ASSERT_EQ(file_io_wait(&req, 1), 0);
+  file_read_page(table_id, pagenums[0], &read_page);
+  ASSERT_STREQ(read_page.data, "rewritten page");
+
+  // page moves to a raw slot when it stops compressing
+  file_write_page(table_id, pagenums[1], &random_page);
+  file_close_table_files();
+  table_id = file_open_table_file(_filename);
+  file_read_page(table_id, pagenums[1], &read_page);
+  ASSERT_TRUE(same_page(&random_page, &read_page, pagenums[1]));
+  file_read_page(table_id, pagenums[2], &read_page);
+  ASSERT_STREQ(read_page.data, "page 2 is compressed");
+
+  // compressed slots cannot be served from a mapping
+  file_close_table_files();
+  ASSERT_LT(file_open_mapped_table_file(_filename), 0);
+}
+
+TEST_F(DiskSpaceManagerTest, striped_table) {
+  SetUp("DATA1");
+  file_close_table_files();
+  remove(_filename);
+  mkdir("stripe_dir1", 0755);
+  mkdir("stripe_dir2", 0755);
+  const char *dirs[] = {"stripe_dir1", "stripe_dir2"};
+  const uint64_t kStripePages = 16;
+  ASSERT_EQ(file_set_striping(3, kStripePages, dirs), 0);
+  table_id = file_open_table_file(_filename);
+  file_set_striping(1, 0);
+  ASSERT_TRUE(table_id > 0);
+  ASSERT_EQ(file_num_stripes(table_id), 3);
+
+  // page is written into its stripe, the table keeps its size
+  auto stripe_size = [](const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+  };
+  const char *stripe_paths[] = {_filename, "stripe_dir1/DATA1.1",
+                                "stripe_dir2/DATA1.2"};
+  ASSERT_EQ(file_size(table_id), kDefaultFileSize);
+  uint64_t total = 0;
+  for (auto *path : stripe_paths) {
+    ASSERT_GT(stripe_size(path), 0);
+    total += stripe_size(path);
+  }
+  ASSERT_EQ(total, kDefaultFileSize);
+
+  std::vector<pagenum_t> pagenums;
+  page_t page, read_page;
+  for (int i = 0; i < 100; ++i) {
+    auto pagenum = file_alloc_page(table_id);
+    memset(&page, 0, sizeof(page));
+    snprintf(page.data, 100, "striped page %llu", (unsigned long long)pagenum);
+    file_write_page(table_id, pagenum, &page, false);
+    pagenums.push_back(pagenum);
+  }
+  file_sync_all();
+  // first page of the second run is the first page of stripe 1
+  ASSERT_NE(std::find(pagenums.begin(), pagenums.end(), kStripePages),
+            pagenums.end());
+  auto fd = open(stripe_paths[1], O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(pread(fd, &read_page, sizeof(read_page), 0), sizeof(read_page));
+  close(fd);
+  ASSERT_STREQ(read_page.data, "striped page 16");
+
+  // stripes grow together
+  pagenum_t start, end;
+  uint64_t num_new_pages;
+  ASSERT_EQ(file_expand_twice(table_id, &start, &end, &num_new_pages), 0);
+  ASSERT_EQ(file_size(table_id), 2 * kDefaultFileSize);
+  ASSERT_EQ(stripe_size(stripe_paths[0]) + stripe_size(stripe_paths[1]) +
+                stripe_size(stripe_paths[2]),
+            2 * kDefaultFileSize);
+
+  // layout is kept in the header
+  file_close_table_files();
+  table_id = file_open_table_file(_filename);
+  ASSERT_TRUE(table_id > 0);
+  ASSERT_EQ(file_num_stripes(table_id), 3);
+  for (auto pagenum : pagenums) {
+    file_read_page(table_id, pagenum, &read_page);
+    snprintf(page.data, 100, "striped page %llu", (unsigned long long)pagenum);
+    ASSERT_STREQ(read_page.data, page.data);
+  }
+
+  // batched I/O spreads over stripes
+  file_io_request_t reqs[2 * kStripePages];
+  page_t pages[2 * kStripePages];
+  memset(reqs, 0, sizeof(reqs));
+  for (int i = 0; i < 2 * kStripePages; ++i) {
+    reqs[i].table_id = table_id;
+    reqs[i].pagenum = pagenums[i];
+    reqs[i].page = &pages[i];
+    reqs[i].is_write = true;
+    snprintf(pages[i].data, 100, "batched page %d", i);
+  }
+  ASSERT_EQ(file_io_submit(reqs, 2 * kStripePages), 0);
+  ASSERT_EQ(file_io_wait(reqs, 2 * kStripePages), 0);
+  for (int i = 0; i < 2 * kStripePages; ++i) {
+    file_read_page(table_id, pagenums[i], &read_page);
+    ASSERT_STREQ(read_page.data, pages[i].data);
+  }
+
+  // striped table cannot be mapped
+  file_close_table_files();
+  ASSERT_LT(file_open_mapped_table_file(_filename), 0);
+  remove(stripe_paths[1]);
+  remove(stripe_paths[2]);
+  rmdir("stripe_dir1");
+  rmdir("stripe_dir2");
+}
+
+TEST_F(DiskSpaceManagerTest, mapped_table) {
+  SetUp("DATA1");
+
+  auto pagenum = file_alloc_page(table_id);
+  page_t page;
+  memset(&page, 0, sizeof(page));
+  strcpy(page.data, "mapped page");
+  file_write_page(table_id, pagenum, &page);
+  ASSERT_FALSE(file_is_read_only(table_id));
+  ASSERT_EQ(file_mapped_page(table_id, pagenum), nullptr);
+
+  file_close_table_files();
+  table_id = file_open_mapped_table_file(_filename);
+  ASSERT_TRUE(table_id > 0);
+  ASSERT_TRUE(file_is_read_only(table_id));
+  ASSERT_EQ(file_open_mapped_table_file(_filename), table_id);
+
+  auto *mapped = file_mapped_page(table_id, pagenum);
+  ASSERT_NE(mapped, nullptr);
+  ASSERT_STREQ(mapped->data, "mapped page");
+  file_prefetch_pages(table_id, pagenum, 4);
+
+  header_page_t header;
+  file_read_header_page(table_id, &header);
+  ASSERT_EQ(memcmp(file_mapped_page(table_id, kHeaderPagenum), &header,
+                   sizeof(header)),
+            0);
+  ASSERT_EQ(header.header.magic, kHeaderMagic);
+  ASSERT_EQ(file_mapped_page(table_id, file_size(table_id) / kPageSize),
+            nullptr);
+
+  // file of another format is not mapped
+  file_close_table_files();
+  int fd = open(_filename, O_WRONLY);
+  uint64_t magic = 0;
+  ASSERT_EQ(pwrite(fd, &magic, sizeof(magic),
+                   offsetof(header_page_t, header.magic)),
+            (ssize_t)sizeof(magic));
+  close(fd);
+  ASSERT_LT(file_open_mapped_table_file(_filename), 0);
+}
+
 TEST_F(DiskSpaceManagerTest, read_write_header) {
   SetUp("DATA1");
 
@@ -107,19 +679,108 @@ TEST_F(DiskSpaceManagerTest, read_write_header) {
   strcpy(page.data, "Hello World!");
   file_write_page(table_id, t1, &page);
 
-  pagenum_t val1 = 54321;
+  uint64_t val1 = kHeaderMagic;
   uint64_t val2 = 12345;
   pagenum_t val3 = 321123;
 
   header_page_t header;
-  header.header.first_free_page = val1;
+  header.header.magic = val1;
   header.header.num_of_pages = val2;
   header.header.root_page_number = val3;
   file_write_header_page(table_id, &header);
 
   memset(&header, 0, sizeof(header));
   file_read_header_page(table_id, &header);
-  ASSERT_EQ(header.header.first_free_page, val1);
+  ASSERT_EQ(header.header.magic, val1);
   ASSERT_EQ(header.header.num_of_pages, val2);
   ASSERT_EQ(header.header.root_page_number, val3);
-}
\ No newline at end of file
+}
+
+struct page_io_arg_t {
+  int64_t table_id;
+  pagenum_t first;
+  int count;
+  int failed;
+};
+
+void *page_io_thread_func(void *arg) {
+  auto *io_arg = (page_io_arg_t *)arg;
+  page_t page;
+  for (int round = 0; round < 10; ++round) {
+    for (int i = 0; i < io_arg->count; ++i) {
+      auto pagenum = io_arg->first + i;
+      memset(page.data, 0, kPageSize);
+      snprintf(page.data, kPageSize, "page %llu round %d",
+               (unsigned long long)pagenum, round);
+      file_write_page(io_arg->table_id, pagenum, &page, false);
+    }
+    for (int i = 0; i < io_arg->count; ++i) {
+      auto pagenum = io_arg->first + i;
+      char expected[64];
+      snprintf(expected, sizeof(expected), "page %llu round %d",
+               (unsigned long long)pagenum, round);
+      file_read_page(io_arg->table_id, pagenum, &page);
+      if (strcmp(page.data, expected) != 0) ++io_arg->failed;
+    }
+  }
+  return NULL;
+}
+
+TEST_F(DiskSpaceManagerTest, concurrent_page_io) {
+  SetUp("DATA1");
+
+  const int kThreads = 8;
+  const int kPagesPerThread = 64;
+  std::vector<pagenum_t> pages;
+  for (int i = 0; i < kThreads * kPagesPerThread; ++i) {
+    pages.push_back(file_alloc_page(table_id));
+  }
+  std::sort(pages.begin(), pages.end());
+
+  pthread_t threads[kThreads];
+  page_io_arg_t args[kThreads];
+  for (int i = 0; i < kThreads; ++i) {
+    args[i] = {table_id, pages[i * kPagesPerThread], kPagesPerThread, 0};
+    pthread_create(&threads[i], 0, page_io_thread_func, &args[i]);
+  }
+  for (int i = 0; i < kThreads; ++i) {
+    pthread_join(threads[i], NULL);
+    ASSERT_EQ(args[i].failed, 0) << "thread " << i << " read torn pages";
+  }
+}
+
+void count_completion(file_io_request_t *req) { ++*(int *)req->arg; }
+
+TEST_F(DiskSpaceManagerTest, batched_page_io) {
+  SetUp("DATA1");
+
+  const int kBatchSize = 200;  // larger than the io_uring queue
+  for (int async = 1; async >= 0; --async) {
+    file_io_set_async(async);
+    std::vector<page_t> pages(kBatchSize);
+    std::vector<file_io_request_t> reqs(kBatchSize);
+    int completed = 0;
+    for (int i = 0; i < kBatchSize; ++i) {
+      snprintf(pages[i].data, kPageSize, "async page %d (%d)", i, async);
+      // pages after the header and the space map
+      reqs[i] = {table_id, (pagenum_t)(i + 2), &pages[i], true,
+                 count_completion, &completed};
+    }
+    ASSERT_EQ(file_io_submit(reqs.data(), kBatchSize), 0);
+    ASSERT_EQ(file_io_wait(reqs.data(), kBatchSize), 0);
+    ASSERT_EQ(completed, kBatchSize);
+
+    std::vector<page_t> read_pages(kBatchSize);
+    for (int i = 0; i < kBatchSize; ++i) {
+      reqs[i].page = &read_pages[i];
+      reqs[i].is_write = false;
+    }
+    ASSERT_EQ(file_io_submit(reqs.data(), kBatchSize), 0);
+    ASSERT_EQ(file_io_wait(reqs.data(), kBatchSize), 0);
+    ASSERT_EQ(completed, kBatchSize * 2);
+    for (int i = 0; i < kBatchSize; ++i) {
+      ASSERT_STREQ(read_pages[i].data, pages[i].data);
+    }
+  }
+  file_io_set_async(true);
+}
@@ -2,13 +2,20 @@
 
 #include <gtest/gtest.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <functional>
 #include <random>
 #include <set>
 #include <string>
 #include <vector>
 
+#include "buffer_manager.h"
 #include "database.h"
+#include "index_manager/compaction.h"
+#include "io_stats.h"
 #include "log.h"
 
 const int DUMMY_TRX = -1;
@@ -29,7 +36,37 @@ class IndexTest : public ::testing::Test {
     ASSERT_TRUE(table_id > 0);
   }
 
+  // Reopen the db on a pool of num_buf frames with a fresh table, setting is
+  // called with true before init_db and with false once the table is open
+  // to apply and reset options of the pool or the table
+  // (call it in ASSERT_NO_FATAL_FAILURE)
+  void ReopenWith(int num_buf,
+                  const std::function<int(bool)> &setting = nullptr) {
+    shutdown_db();
+    remove(_filename);
+    if (setting) {
+      ASSERT_EQ(setting(true), 0);
+    }
+    init_db(num_buf, 0, 100, log_path, logmsg_path);
+    table_id = open_table(_filename);
+    if (setting) {
+      ASSERT_EQ(setting(false), 0);
+    }
+    ASSERT_TRUE(table_id > 0);
+  }
+
+  // Reopen the db on a pool of num_buf frames and the table as it is
+  // (call it in ASSERT_NO_FATAL_FAILURE)
+  void Reopen(int num_buf) {
+    shutdown_db();
+    init_db(num_buf, 0, 100, log_path, logmsg_path);
+    table_id = open_table(_filename);
+    ASSERT_TRUE(table_id > 0);
+  }
+
   void TearDown() override {
+    // runtime options a test turns on are reset even if it fails
+    file_set_deferred_sync(false);
     shutdown_db();
     remove(_filename);
     remove(log_path);
@@ -224,4 +261,719 @@ TEST_F(IndexTest, insert_delete_find_update) {
           << "data of key = " << key << " is invalid";
     }
   }
-}
\ No newline at end of file
+}
+int collect_keys(int64_t key, const char *value, uint16_t size, void *arg) {
+  ((std::vector<int64_t> *)arg)->push_back(key);
+  return 0;
+}
+
+TEST_F(IndexTest, read_only_table) {
+  SetUp("DATA1");
+
+  const int kinds = 4;
+  char vals[kinds][112] = {
+      "Hello World!",
+      "My name is DBMS!",
+      "BPT is dynamic index!",
+      "disk is managed as page!",
+  };
+  uint16_t sizes[kinds] = {50, 70, 90, 100};
+
+  uint32_t inserting_cnt = INSERTING_N / 10;
+  std::vector<int> keys;
+  for (int i = 1; i <= inserting_cnt; ++i) {
+    keys.emplace_back(i * 2);
+  }
+  std::random_device rd;
+  std::default_random_engine rng(rd());
+  std::shuffle(keys.begin(), keys.end(), rng);
+
+  for (auto key : keys) {
+    ASSERT_EQ(db_insert(table_id, key, vals[key % kinds], sizes[key % kinds]),
+              0)
+        << "failed to insert " << key;
+  }
+
+  shutdown_db();
+  init_db(NUM_BUF, 0, 100, log_path, logmsg_path);
+  table_id = open_table_read_only(_filename);
+  ASSERT_TRUE(table_id > 0);
+
+  char read_buf[112];
+  uint16_t size;
+  for (auto key : keys) {
+    ASSERT_EQ(db_find(table_id, key, read_buf, &size, DUMMY_TRX), 0)
+        << "failed to find " << key;
+    ASSERT_EQ(size, sizes[key % kinds])
+        << "size of key = " << key << " is invalid";
+    ASSERT_TRUE(strcmp(read_buf, vals[key % kinds]) == 0)
+        << "data of key = " << key << " is invalid";
+    ASSERT_NE(db_find(table_id, key + 1, read_buf, &size, DUMMY_TRX), 0);
+  }
+
+  // scan crosses leaves in key order
+  std::vector<int64_t> scanned;
+  ASSERT_EQ(db_scan(table_id, 1001, 5000, collect_keys, &scanned), 2000);
+  ASSERT_EQ(scanned.size(), 2000);
+  for (int i = 0; i < scanned.size(); ++i) {
+    ASSERT_EQ(scanned[i], 1002 + i * 2);
+  }
+
+  // pages are not loaded into the buffer
+  ASSERT_EQ(count_free_frames(), NUM_BUF);
+  ASSERT_NE(db_insert(table_id, 1, vals[0], sizes[0]), 0);
+  ASSERT_NE(db_delete(table_id, keys[0]), 0);
+  ASSERT_NE(db_update(table_id, keys[0], vals[0], sizes[0], &size, DUMMY_TRX),
+            0);
+}
+
+TEST_F(IndexTest, compaction) {
+  SetUp("DATA1");
+
+  char value[112] = "compaction moves pages to the front";
+  uint16_t size = 100;
+  for (int key = 1; key <= INSERTING_N; ++key) {
+    ASSERT_EQ(db_insert(table_id, key, value, size), 0)
+        << "failed to insert " << key;
+  }
+  auto old_file_size = file_size(table_id);
+  ASSERT_GT(old_file_size, kDefaultFileSize);
+
+  // leave a few records on pages spread over the file
+  std::vector<int> keys;
+  for (int key = 1; key <= INSERTING_N; ++key) {
+    if (key % 97 == 0)
+      keys.push_back(key);
+    else
+      ASSERT_EQ(db_delete(table_id, key), 0) << "failed to delete " << key;
+  }
+
+  // background compaction runs with index operations
+  ASSERT_EQ(start_compaction(table_id, 8, 1), 0);
+  char read_buf[112];
+  for (int round = 0; round < 10; ++round) {
+    for (auto key : keys) {
+      ASSERT_EQ(db_find(table_id, key, read_buf, &size, DUMMY_TRX), 0)
+          << "failed to find " << key;
+    }
+  }
+  stop_compaction(table_id);
+  ASSERT_GE(compact_table(table_id, 0), 0);
+  ASSERT_EQ(compact_table(table_id, 0), 0);
+  ASSERT_EQ(file_size(table_id), kDefaultFileSize);
+
+  ASSERT_NO_FATAL_FAILURE(Reopen(NUM_BUF));
+  ASSERT_EQ(file_size(table_id), kDefaultFileSize);
+
+  for (auto key : keys) {
+    ASSERT_EQ(db_find(table_id, key, read_buf, &size, DUMMY_TRX), 0)
+        << "failed to find " << key;
+    ASSERT_TRUE(strcmp(read_buf, value) == 0);
+    ASSERT_NE(db_find(table_id, key + 1, read_buf, &size, DUMMY_TRX), 0);
+  }
+  std::vector<int64_t> scanned;
+  ASSERT_EQ(db_scan(table_id, 0, INSERTING_N, collect_keys, &scanned),
+            keys.size());
+  for (int i = 0; i < keys.size(); ++i) ASSERT_EQ(scanned[i], keys[i]);
+
+  // table grows again after compaction
+  for (int key = 1; key <= INSERTING_N; ++key) {
+    if (key % 97 == 0) continue;
+    ASSERT_EQ(db_insert(table_id, key, value, size), 0)
+        << "failed to insert " << key;
+  }
+  for (int key = 1; key <= INSERTING_N; ++key) {
+    ASSERT_EQ(db_find(table_id, key, read_buf, &size, DUMMY_TRX), 0)
+        << "failed to find " << key;
+  }
+}
+
+TEST_F(IndexTest, compaction_keeps_leaf_chain) {
+  SetUp("DATA1");
+
+  char value[112] = "moved leaves stay in the leaf chain";
+  uint16_t size = 100;
+  const int n = INSERTING_N * 3;
+  for (int key = 1; key <= n; ++key) {
+    ASSERT_EQ(db_insert(table_id, key, value, size), 0)
+        << "failed to insert " << key;
+  }
+  auto old_file_size = file_size(table_id);
+
+  // free the leaves of the lower keys, and delete odd keys of the others so
+  // that many leaves lose their first key (separators in parents are kept)
+  std::vector<int64_t> keys;
+  for (int key = 1; key <= n; ++key) {
+    if (key > n / 4 && key % 2 == 0)
+      keys.push_back(key);
+    else
+      ASSERT_EQ(db_delete(table_id, key), 0) << "failed to delete " << key;
+  }
+
+  ASSERT_GT(compact_table(table_id, 0), 0);
+  ASSERT_LT(file_size(table_id), old_file_size);
+  ASSERT_GT(file_size(table_id), kDefaultFileSize);
+
+  std::vector<int64_t> scanned;
+  ASSERT_EQ(db_scan(table_id, 0, n, collect_keys, &scanned),
+            keys.size());
+  ASSERT_EQ(scanned, keys);
+
+  ASSERT_NO_FATAL_FAILURE(Reopen(NUM_BUF));
+  scanned.clear();
+  ASSERT_EQ(db_scan(table_id, 0, n, collect_keys, &scanned),
+            keys.size());
+  ASSERT_EQ(scanned, keys);
+}
+
+TEST_F(IndexTest, large_pages) {
+  SetUp("DATA1");
+  ASSERT_NE(file_set_page_size(kPageSize + 1), 0);
+  ASSERT_NE(file_set_page_size(2 * kMaxPageSize), 0);
+  ASSERT_NO_FATAL_FAILURE(ReopenWith(NUM_BUF, [](bool on) {
+    return file_set_page_size(on ? 16 * 1024 : kPageSize);
+  }));
+  ASSERT_EQ(file_page_size(table_id), 16 * 1024);
+
+  char value[112] = "pages are four times larger";
+  uint16_t size = 100;
+  std::vector<int> keys;
+  for (int key = 1; key <= INSERTING_N; ++key) keys.push_back(key);
+  std::random_device rd;
+  std::default_random_engine rng(rd());
+  std::shuffle(keys.begin(), keys.end(), rng);
+  for (auto key : keys) {
+    ASSERT_EQ(db_insert(table_id, key, value, size), 0)
+        << "failed to insert " << key;
+  }
+  // leaves merge and redistribute
+  for (auto key : keys) {
+    if (key % 3 != 0) {
+      ASSERT_EQ(db_delete(table_id, key), 0) << "failed to delete " << key;
+    }
+  }
+
+  ASSERT_NO_FATAL_FAILURE(Reopen(NUM_BUF));
+  ASSERT_EQ(file_page_size(table_id), 16 * 1024);
+
+  char read_buf[112];
+  for (int key = 1; key <= INSERTING_N; ++key) {
+    if (key % 3 == 0) {
+      ASSERT_EQ(db_find(table_id, key, read_buf, &size, DUMMY_TRX), 0)
+          << "failed to find " << key;
+      ASSERT_TRUE(strcmp(read_buf, value) == 0);
+    } else {
+      ASSERT_NE(db_find(table_id, key, read_buf, &size, DUMMY_TRX), 0);
+    }
+  }
+
+  // read-only mapping uses the page size of the table as well
+  shutdown_db();
+  init_db(NUM_BUF, 0, 100, log_path, logmsg_path);
+  table_id = open_table_read_only(_filename);
+  ASSERT_TRUE(table_id > 0);
+  std::vector<int64_t> scanned;
+  ASSERT_EQ(db_scan(table_id, 1, INSERTING_N, collect_keys, &scanned),
+            INSERTING_N / 3);
+  for (int i = 0; i < scanned.size(); ++i) ASSERT_EQ(scanned[i], (i + 1) * 3);
+}
+
+struct find_thread_arg_t {
+  int64_t table_id;
+  int seed;
+  int num_failed;
+};
+
+void *find_thread_func(void *arg) {
+  auto *find_arg = (find_thread_arg_t *)arg;
+  std::default_random_engine rng(find_arg->seed);
+  std::uniform_int_distribution<int> dist(1, INSERTING_N / 2);
+  char read_buf[112];
+  uint16_t size;
+  for (int i = 0; i < 20000; ++i) {
+    if (db_find(find_arg->table_id, dist(rng), read_buf, &size, DUMMY_TRX))
+      ++find_arg->num_failed;
+  }
+  return NULL;
+}
+
+TEST_F(IndexTest, partitioned_buffer) {
+  SetUp("DATA1");
+  // pool smaller than the table, pages are evicted in every partition
+  const int kNumBuf = 1000;
+  const int kNumThreads = 8;
+  ASSERT_NO_FATAL_FAILURE(ReopenWith(kNumBuf));
+  ASSERT_EQ(buffer_num_partitions(), kNumBuf / 64);
+
+  char value[112] = "pages are spread over partitions";
+  for (int key = 1; key <= INSERTING_N / 2; ++key) {
+    ASSERT_EQ(db_insert(table_id, key, value, 100), 0)
+        << "failed to insert " << key;
+  }
+
+  pthread_t threads[kNumThreads];
+  find_thread_arg_t args[kNumThreads];
+  for (int i = 0; i < kNumThreads; ++i) {
+    args[i] = {table_id, i, 0};
+    pthread_create(&threads[i], NULL, find_thread_func, &args[i]);
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    pthread_join(threads[i], NULL);
+    ASSERT_EQ(args[i].num_failed, 0);
+  }
+  ASSERT_EQ(count_free_frames(), kNumBuf);
+}
+
+TEST_F(IndexTest, page_table) {
+  SetUp("DATA1");
+  // same pages of several tables are cached and evicted in one partition
+  const int kNumBuf = 64;
+  const int kNumTables = 3;
+  const int kNumKeys = 5000;
+  char filenames[kNumTables][16] = {"DATA1", "DATA2", "DATA3"};
+  int64_t table_ids[kNumTables];
+  ASSERT_NO_FATAL_FAILURE(ReopenWith(kNumBuf));
+  ASSERT_EQ(buffer_num_partitions(), 1);
+  table_ids[0] = table_id;
+  for (int t = 1; t < kNumTables; ++t) {
+    remove(filenames[t]);
+    table_ids[t] = open_table(filenames[t]);
+    ASSERT_TRUE(table_ids[t] > 0);
+  }
+
+  char value[112];
+  for (int key = 1; key <= kNumKeys; ++key) {
+    for (int t = 0; t < kNumTables; ++t) {
+      snprintf(value, sizeof(value), "table %d key %d", t, key);
+      ASSERT_EQ(db_insert(table_ids[t], key, value, 100), 0)
+          << "failed to insert " << key << " into table " << t;
+    }
+  }
+
+  char read_buf[112];
+  uint16_t size;
+  for (int key = kNumKeys; key >= 1; --key) {
+    for (int t = 0; t < kNumTables; ++t) {
+      ASSERT_EQ(db_find(table_ids[t], key, read_buf, &size, DUMMY_TRX), 0)
+          << "failed to find " << key << " in table " << t;
+      snprintf(value, sizeof(value), "table %d key %d", t, key);
+      ASSERT_TRUE(strcmp(read_buf, value) == 0);
+    }
+  }
+  ASSERT_EQ(count_free_frames(), kNumBuf);
+  shutdown_db();
+  for (int t = 1; t < kNumTables; ++t) remove(filenames[t]);
+  init_db(NUM_BUF, 0, 100, log_path, logmsg_path);
+}
+
+TEST_F(IndexTest, page_arena) {
+  SetUp("DATA1");
+  auto kind = buffer_page_arena_kind();
+  ASSERT_TRUE(kind == kArenaPages || kind == kArenaTransparentHugePages ||
+              kind == kArenaHugePages);
+
+  char value[112] = "page data is apart from frames";
+  for (int key = 1; key <= INSERTING_N / 10; ++key) {
+    ASSERT_EQ(db_insert(table_id, key, value, 100), 0)
+        << "failed to insert " << key;
+  }
+  // page data is aligned for direct I/O
+  auto *header = buffer_get_page_ptr(table_id, kHeaderPagenum, true);
+  ASSERT_EQ((uintptr_t)header % kPageSize, 0);
+  unpin(header);
+
+  // arena is unmapped and mapped again with the pool
+  ASSERT_NO_FATAL_FAILURE(Reopen(NUM_BUF));
+  char read_buf[112];
+  uint16_t size;
+  for (int key = 1; key <= INSERTING_N / 10; ++key) {
+    ASSERT_EQ(db_find(table_id, key, read_buf, &size, DUMMY_TRX), 0)
+        << "failed to find " << key;
+    ASSERT_TRUE(strcmp(read_buf, value) == 0);
+  }
+  ASSERT_EQ(count_free_frames(), NUM_BUF);
+}
+
+TEST_F(IndexTest, resize_pool) {
+  SetUp("DATA1");
+  const int kNumBuf = 1000;
+  const int kMaxNumBuf = 4000;
+  const int kNumThreads = 4;
+  ASSERT_NO_FATAL_FAILURE(ReopenWith(kNumBuf, [](bool on) {
+    return buffer_set_max_frames(on ? kMaxNumBuf : 0);
+  }));
+  ASSERT_EQ(buffer_pool_size(), kNumBuf);
+
+  char value[112] = "pool is resized under the finds";
+  for (int key = 1; key <= INSERTING_N / 2; ++key) {
+    ASSERT_EQ(db_insert(table_id, key, value, 100), 0)
+        << "failed to insert " << key;
+  }
+
+  // dirty pages of removed frames are written back while finds go on
+  pthread_t threads[kNumThreads];
+  find_thread_arg_t args[kNumThreads];
+  for (int i = 0; i < kNumThreads; ++i) {
+    args[i] = {table_id, i, 0};
+    pthread_create(&threads[i], NULL, find_thread_func, &args[i]);
+  }
+  const int kSizes[] = {kMaxNumBuf, 300, 2000, kNumBuf};
+  for (auto size : kSizes) {
+    ASSERT_EQ(buffer_resize(size), 0);
+    ASSERT_EQ(buffer_pool_size(), size);
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    pthread_join(threads[i], NULL);
+    ASSERT_EQ(args[i].num_failed, 0);
+  }
+  ASSERT_NE(buffer_resize(kMaxNumBuf + 1), 0);
+  ASSERT_NE(buffer_resize(1), 0);
+  ASSERT_EQ(buffer_pool_size(), kNumBuf);
+  ASSERT_EQ(count_free_frames(), kNumBuf);
+
+  ASSERT_EQ(buffer_resize(300), 0);
+  char read_buf[112];
+  uint16_t size;
+  for (int key = 1; key <= INSERTING_N / 2; key += 7) {
+    ASSERT_EQ(db_find(table_id, key, read_buf, &size, DUMMY_TRX), 0)
+        << "failed to find " << key;
+    ASSERT_TRUE(strcmp(read_buf, value) == 0);
+  }
+  ASSERT_EQ(count_free_frames(), 300);
+}
+
+TEST_F(IndexTest, resize_pinned_pool) {
+  SetUp("DATA1");
+  // a single partition, all of its frames are pinned below
+  const int kNumBuf = 64;
+  ASSERT_NO_FATAL_FAILURE(ReopenWith(kNumBuf));
+  ASSERT_EQ(buffer_num_partitions(), 1);
+
+  // shrink gives up on a frame which stays pinned
+  std::vector<page_t *> pinned;
+  auto num_free_frames = count_free_frames();
+  for (int i = 0; i < num_free_frames; ++i)
+    pinned.push_back(buffer_get_page_ptr(table_id, i + 1));
+  ASSERT_EQ(count_free_frames(), 0);
+  ASSERT_NE(buffer_resize(16), 0);
+  ASSERT_EQ(buffer_pool_size(), kNumBuf);
+
+  for (auto *page : pinned) unpin(page);
+  ASSERT_EQ(buffer_resize(16), 0);
+  ASSERT_EQ(buffer_pool_size(), 16);
+}
+
+TEST_F(IndexTest, shared_page_latch) {
+  SetUp("DATA1");
+  const int kNumThreads = 4;
+  char value[112] = "read through a shared root";
+  for (int key = 1; key <= INSERTING_N / 2; ++key) {
+    ASSERT_EQ(db_insert(table_id, key, value, 100), 0)
+        << "failed to insert " << key;
+  }
+
+  // finds only read pages, so they pass the root held shared here
+  auto *header =
+      buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum, true);
+  auto *root =
+      buffer_get_page_ptr(table_id, header->header.root_page_number, true);
+  unpin(header);
+  pthread_t threads[kNumThreads];
+  find_thread_arg_t args[kNumThreads];
+  for (int i = 0; i < kNumThreads; ++i) {
+    args[i] = {table_id, i, 0};
+    pthread_create(&threads[i], NULL, find_thread_func, &args[i]);
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    pthread_join(threads[i], NULL);
+    ASSERT_EQ(args[i].num_failed, 0);
+  }
+  ASSERT_EQ(count_free_frames(), NUM_BUF - 1);
+  unpin(root);
+  ASSERT_EQ(count_free_frames(), NUM_BUF);
+}
+
+TEST_F(IndexTest, optimistic_read) {
+  SetUp("DATA1");
+  char value[112] = "inner pages are read optimistically";
+  for (int key = 1; key <= INSERTING_N / 2; ++key) {
+    ASSERT_EQ(db_insert(table_id, key, value, 100), 0)
+        << "failed to insert " << key;
+  }
+  auto *header =
+      buffer_get_page_ptr<header_page_t>(table_id, kHeaderPagenum, true);
+  auto root = header->header.root_page_number;
+  unpin(header);
+
+  uint64_t version;
+  auto *page = buffer_read_optimistic(table_id, root, &version);
+  ASSERT_TRUE(page != NULL);
+  ASSERT_TRUE(buffer_validate_page(page, version));
+  // shared pins do not change the page
+  unpin(buffer_get_page_ptr(table_id, root, true));
+  ASSERT_TRUE(buffer_validate_page(page, version));
+
+  // exclusive pin may change it
+  auto *pinned = buffer_get_page_ptr(table_id, root);
+  ASSERT_FALSE(buffer_validate_page(page, version));
+  uint64_t locked_version;
+  ASSERT_TRUE(buffer_read_optimistic(table_id, root, &locked_version) ==
+              NULL);
+  unpin(pinned);
+  ASSERT_FALSE(buffer_validate_page(page, version));
+  ASSERT_TRUE(buffer_read_optimistic(table_id, root, &version) == page);
+  ASSERT_TRUE(buffer_validate_page(page, version));
+
+  char read_buf[112];
+  uint16_t size;
+  for (int key = 1; key <= INSERTING_N / 2; key += 97) {
+    ASSERT_EQ(db_find(table_id, key, read_buf, &size, DUMMY_TRX), 0);
+    ASSERT_EQ(size, 100);
+  }
+  ASSERT_EQ(count_free_frames(), NUM_BUF);
+}
+
+TEST_F(IndexTest, pointer_swizzling) {
+  SetUp("DATA1");
+  ASSERT_NO_FATAL_FAILURE(ReopenWith(NUM_BUF, buffer_set_pointer_swizzling));
+  ASSERT_TRUE(table_id > 0);
+
+  char value[112] = "children are reached through swizzled pointers";
+  for (int key = 1; key <= INSERTING_N; ++key) {
+    ASSERT_EQ(db_insert(table_id, key, value, 100), 0)
+        << "failed to insert " << key;
+  }
+  // splits change the links while the tree grows
+  for (int key = 1; key <= INSERTING_N; key += 3) {
+    ASSERT_EQ(db_delete(table_id, key), 0) << "failed to delete " << key;
+  }
+
+  buffer_reset_hit_stats();
+  char read_buf[112];
+  uint16_t size;
+  for (int round = 0; round < 2; ++round) {
+    for (int key = 1; key <= INSERTING_N; ++key) {
+      ASSERT_EQ(db_find(table_id, key, read_buf, &size, DUMMY_TRX) == 0,
+                key % 3 != 1)
+          << "key " << key;
+    }
+  }
+  // the tree fits in the pool, so children are swizzled once
+  uint64_t hits, misses;
+  buffer_get_swizzle_stats(&hits, &misses);
+  ASSERT_GT(hits, 10 * misses);
+  ASSERT_EQ(count_free_frames(), NUM_BUF);
+}
+
+TEST_F(IndexTest, clock_replacement) {
+  SetUp("DATA1");
+  // hits are served without latch of the partition while others evict
+  const int kNumBuf = 1000;
+  const int kNumThreads = 8;
+  ASSERT_NO_FATAL_FAILURE(ReopenWith(kNumBuf, [](bool on) {
+    return buffer_set_replacement_policy(on ? kReplaceClock : kReplaceLRU);
+  }));
+
+  char value[112] = "pages are swept by the clock";
+  for (int key = 1; key <= INSERTING_N / 2; ++key) {
+    ASSERT_EQ(db_insert(table_id, key, value, 100), 0)
+        << "failed to insert " << key;
+  }
+
+  buffer_reset_hit_stats();
+  pthread_t threads[kNumThreads];
+  find_thread_arg_t args[kNumThreads];
+  for (int i = 0; i < kNumThreads; ++i) {
+    args[i] = {table_id, i, 0};
+    pthread_create(&threads[i], NULL, find_thread_func, &args[i]);
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    pthread_join(threads[i], NULL);
+    ASSERT_EQ(args[i].num_failed, 0);
+  }
+  uint64_t hits, misses;
+  buffer_get_hit_stats(&hits, &misses);
+  ASSERT_GT(hits, 0);
+  ASSERT_GT(misses, 0);
+  ASSERT_EQ(count_free_frames(), kNumBuf);
+}
+
+TEST_F(IndexTest, page_cleaners) {
+  SetUp("DATA1");
+  // inserts dirty pages of a table larger than the pool
+  const int kNumBuf = 256;
+  ASSERT_NO_FATAL_FAILURE(ReopenWith(kNumBuf, [](bool on) {
+    return buffer_set_page_cleaners(on ? 2 : 0, on ? 32 : 0);
+  }));
+
+  io_stats_reset();
+  char value[112] = "written back by the cleaners";
+  for (int key = 1; key <= INSERTING_N / 2; ++key) {
+    ASSERT_EQ(db_insert(table_id, key, value, 100), 0)
+        << "failed to insert " << key;
+  }
+  // dirty victims are written by misses one by one (page site), cleaners
+  // write batches ahead of them
+  io_stat_t foreground, background;
+  io_stats_snapshot(kIoSitePage, kIoOpWrite, &foreground);
+  io_stats_snapshot(kIoSiteBatch, kIoOpWrite, &background);
+  ASSERT_GT(background.count, foreground.count);
+
+  char read_buf[112];
+  uint16_t size;
+  for (int key = 1; key <= INSERTING_N / 2; ++key) {
+    ASSERT_EQ(db_find(table_id, key, read_buf, &size, DUMMY_TRX), 0)
+        << "failed to find " << key;
+  }
+  ASSERT_EQ(count_free_frames(), kNumBuf);
+
+  // pages written by the cleaners are read back after reopening
+  ASSERT_NO_FATAL_FAILURE(Reopen(kNumBuf));
+  for (int key = 1; key <= INSERTING_N / 2; key += 7) {
+    ASSERT_EQ(db_find(table_id, key, read_buf, &size, DUMMY_TRX), 0)
+        << "failed to find " << key;
+    ASSERT_TRUE(strcmp(read_buf, value) == 0);
+  }
+}
+
+TEST_F(IndexTest, torn_eviction_write) {
+  SetUp("DATA1");
+  // pages written back by eviction are not synced in deferred mode
+  const int kNumBuf = 16;
+  ASSERT_NO_FATAL_FAILURE(ReopenWith(kNumBuf));
+  file_set_deferred_sync(true);
+  auto pagenum = buffer_alloc_page(table_id);
+  std::vector<pagenum_t> others;
+  for (int i = 0; i < 2 * kNumBuf; ++i)
+    others.push_back(buffer_alloc_page(table_id));
+  ASSERT_EQ(buffer_flush_all_frames(), 0);
+
+  auto *page = buffer_get_page_ptr(table_id, pagenum);
+  strcpy(page->data, "written back by eviction");
+  set_dirty(page);
+  unpin(page);
+  io_stats_reset();
+  for (auto other : others) unpin(buffer_get_page_ptr(table_id, other));
+
+  // the page is staged until the sync point, it is not written in place
+  // but read back from the stage
+  io_stat_t stat;
+  io_stats_snapshot(kIoSiteDoubleWrite, kIoOpWrite, &stat);
+  ASSERT_EQ(stat.count, 0);
+  std::vector<char> in_place(kPageSize);
+  auto fd = open(_filename, O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(pread(fd, in_place.data(), kPageSize, pagenum * kPageSize),
+            (ssize_t)kPageSize);
+  close(fd);
+  ASSERT_STRNE(in_place.data(), "written back by eviction");
+  page = buffer_get_page_ptr(table_id, pagenum);
+  ASSERT_STREQ(page->data, "written back by eviction");
+  unpin(page);
+  file_sync_all();
+  io_stats_snapshot(kIoSiteDoubleWrite, kIoOpWrite, &stat);
+  ASSERT_GT(stat.count, 0);
+
+  // crash in the middle of writing the page in place
+  std::string double_write_path = std::string(log_path) + ".dw";
+  std::vector<char> area(1 << 20);
+  fd = open(double_write_path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  auto area_size = read(fd, area.data(), area.size());
+  ASSERT_GT(area_size, 0);
+  close(fd);
+  shutdown_db();
+  fd = open(_filename, O_WRONLY);
+  std::vector<char> garbage(kPageSize / 2, 'x');
+  ASSERT_EQ(pwrite(fd, garbage.data(), garbage.size(),
+                   pagenum * kPageSize + kPageSize / 2),
+            (ssize_t)garbage.size());
+  close(fd);
+  fd = open(double_write_path.c_str(), O_WRONLY | O_CREAT, 0644);
+  ASSERT_EQ(write(fd, area.data(), area_size), area_size);
+  close(fd);
+
+  // the page is restored from the double-write area on open
+  init_db(kNumBuf, 0, 100, log_path, logmsg_path);
+  table_id = open_table(_filename);
+  ASSERT_TRUE(table_id > 0);
+  page = buffer_get_page_ptr(table_id, pagenum);
+  ASSERT_STREQ(page->data, "written back by eviction");
+  unpin(page);
+}
+
+TEST_F(IndexTest, replacement_policies) {
+  SetUp("DATA1");
+  // hot records are found between scans over a table larger than the pool
+  const int kNumBuf = 256;
+  const int kNumKeys = INSERTING_N / 2;
+  const int kNumHotKeys = 2000;
+  char value[112] = "replaced by the policy";
+  char read_buf[112];
+  uint16_t size;
+  uint64_t hits[kNumReplacementPolicies];
+  for (int policy = 0; policy < kNumReplacementPolicies; ++policy) {
+    ASSERT_NO_FATAL_FAILURE(ReopenWith(kNumBuf, [policy](bool on) {
+      return buffer_set_replacement_policy(on ? policy : kReplaceLRU);
+    }));
+    for (int key = 1; key <= kNumKeys; ++key) {
+      ASSERT_EQ(db_insert(table_id, key, value, 100), 0)
+          << "failed to insert " << key;
+    }
+
+    buffer_reset_hit_stats();
+    std::default_random_engine rng(0);
+    std::uniform_int_distribution<int> dist(1, kNumHotKeys);
+    for (int round = 0; round < 20; ++round) {
+      for (int i = 0; i < 2000; ++i) {
+        ASSERT_EQ(db_find(table_id, dist(rng), read_buf, &size, DUMMY_TRX),
+                  0);
+      }
+      std::vector<int64_t> scanned;
+      ASSERT_EQ(db_scan(table_id, 1, kNumKeys, collect_keys, &scanned),
+                kNumKeys);
+    }
+    uint64_t misses;
+    buffer_get_hit_stats(&hits[policy], &misses);
+    ASSERT_GT(misses, 0);
+    ASSERT_EQ(count_free_frames(), kNumBuf);
+  }
+  ASSERT_NE(buffer_set_replacement_policy(kNumReplacementPolicies), 0);
+  // hot pages are not pushed out by the scans
+  ASSERT_GT(hits[kReplaceLRUK], hits[kReplaceLRU]);
+  ASSERT_GT(hits[kReplace2Q], hits[kReplaceLRU]);
+}
+
+TEST_F(IndexTest, read_ahead) {
+  SetUp("DATA1");
+  // leaves of the table do not fit in the pool
+  const int kNumBuf = 256;
+  const int kNumKeys = INSERTING_N / 2;
+  char value[112] = "read ahead along the leaves";
+  ASSERT_NO_FATAL_FAILURE(ReopenWith(kNumBuf));
+  for (int key = 1; key <= kNumKeys; ++key) {
+    ASSERT_EQ(db_insert(table_id, key, value, 100), 0)
+        << "failed to insert " << key;
+  }
+
+  // misses of scans without and with read-ahead
+  uint64_t misses[2];
+  for (int read_ahead = 0; read_ahead < 2; ++read_ahead) {
+    ASSERT_EQ(buffer_set_read_ahead(read_ahead ? 32 : 0), 0);
+    ASSERT_NO_FATAL_FAILURE(Reopen(kNumBuf));
+    buffer_reset_hit_stats();
+    for (int round = 0; round < 3; ++round) {
+      std::vector<int64_t> scanned;
+      ASSERT_EQ(db_scan(table_id, 1, kNumKeys, collect_keys, &scanned),
+                kNumKeys);
+      for (int i = 0; i < kNumKeys; ++i) ASSERT_EQ(scanned[i], i + 1);
+    }
+    uint64_t hits;
+    buffer_get_hit_stats(&hits, &misses[read_ahead]);
+    ASSERT_EQ(count_free_frames(), kNumBuf);
+  }
+  ASSERT_NE(buffer_set_read_ahead(-1), 0);
+  buffer_set_read_ahead(0);
+  // leaves are loaded before the scans reach them
+  ASSERT_LT(misses[1], misses[0]);
+}